@@ -1,10 +1,3 @@
-#include <arpa/inet.h>
-
-#include <netinet/in.h>
-
-#include <sys/types.h>
-#include <sys/socket.h>
-
 #include <err.h>
 #include <errno.h>
 #include <limits.h>
@@ -14,227 +7,147 @@
 #include <string.h>
 #include <unistd.h>
 
-#include <tls.h>
+#include <pthread.h>
 
-struct Proxy
-{
-	int port;
-	char *name;
-};
+#include "tlscache.h"
+
+static pthread_mutex_t outputLock = PTHREAD_MUTEX_INITIALIZER;
 
 static void usage()
 {
 	extern char *__progname;
-	fprintf(stderr, "usage: %s filename\n", __progname);
+	fprintf(stderr, "usage: %s [-z] [-j parallel] [-t connect-timeout-ms] [-f listfile|-] filename...\n", __progname);
 	exit(1);
 }
 
 /**
- * Given a string, will return the ascii sum of each character in it
- * 
+ * Prints one result as soon as it arrives.
+ * Runs on a library thread, so output is serialized.
  * */
-
-int stringToInt(const char *fileName)
+static void printResult(const struct tlscache_result *result, void *arg)
 {
-	long k = 0;
-	int i = 0;
-	while (fileName[i] != '\0')
+	(void)arg;
+	pthread_mutex_lock(&outputLock);
+	// first check to see if the file is denied or does not exist..
+	switch (result->status)
 	{
-		k += fileName[i];
-		i++;
+	case TLSCACHE_OK:
+		printf("[+]Finished receiving '%s'. Printing contents...\n", result->fileName);
+		printf("%s: %s\n", result->fileName, result->content);
+		break;
+	case TLSCACHE_DENIED:
+		printf("[!]%s: %s File is blacklisted.\n", result->fileName, result->content);
+		break;
+	case TLSCACHE_NOT_FOUND:
+		printf("[!]%s: File does not exist.\n", result->fileName);
+		break;
+	default:
+		printf("[!]%s: %s\n", result->fileName, result->content);
 	}
-	return k;
+	fflush(stdout);
+	pthread_mutex_unlock(&outputLock);
 }
 
 /**
- * Given array of 5 Proxies, and the file name will perform a rendezvous hashing scheme.
- * Concatenates the file name with each proxy name and hashes the strings to get 5 hash values
- * returns the index of the proxy with the highest hash value.
+ * Appends name to the file list, growing it as needed
  * */
-int whichProxy(const struct Proxy *proxies, const char *fileName)
+static void addFile(const char ***fileNames, int *numFiles, int *capacity, const char *name)
 {
-	int hash[5] = {0,0,0,0,0}; // hold hash values for each proxy
-	int maxIndex = 0;
-	for (int i = 0; i < 5; i++) {
-		hash[i] = stringToInt(fileName)+stringToInt(proxies[i].name); // concatenate object name with proxy name
-		hash[i] = hash[i] % 17; // hash the string s_i
-		if (hash[maxIndex] < hash[i]) {
-			// pick the highest hash value
-			maxIndex = i;
-		}
+	if (*numFiles == *capacity)
+	{
+		const char **grown = realloc(*fileNames, *capacity * 2 * sizeof(char *));
+		if (grown == NULL)
+			err(1, "[-]Could not grow the file list");
+		*fileNames = grown;
+		*capacity *= 2;
 	}
-	// return the proxy number
-	return maxIndex;
+	(*fileNames)[(*numFiles)++] = name;
 }
 
-// your application name filename
-int main(int argc, char *argv[])
+/**
+ * Appends one name per line from fp to the file list
+ * */
+static void readFileList(FILE *fp, const char ***fileNames, int *numFiles, int *capacity)
 {
-	int clientSocket, ret;
-	struct sockaddr_in serverAddr;
-	char buffer[1024], *ep;
-	char fileName[1024];
-	ssize_t r, rc;
-	u_short port;
-	u_long p;
-	int sd;
-
-	ssize_t len;
-	int fileSize;
-	int remainingData = 0;
-
-	/* Creating structs for TLS */
-	struct tls_config *cfg = NULL;
-	struct tls *ctx = NULL;
-	struct tls *cctx = NULL;
-
-	
-	/* Done configuring tls */
-	if (argc != 2) // not enough arguments passed in
-	{
-		usage();
-	}
-
-
-	// 5 proxies
-	struct Proxy *proxies = malloc(5*sizeof(struct Proxy)); 
-	proxies[0] = (struct Proxy) {.name = "ProxyOne", .port = 9990};
-	proxies[1] = (struct Proxy) {.name = "ProxyTwo", .port = 9991};
-	proxies[2] = (struct Proxy) {.name = "ProxyThree", .port = 9992};
-	proxies[3] = (struct Proxy) {.name = "ProxyFour", .port = 9993};
-	proxies[4] = (struct Proxy) {.name = "ProxyFive", .port = 9994};
-
-	// grab the filename from argument
-	strcpy(fileName, argv[1]);
-	printf("[+]File Name: %s\n", fileName);
-
-	// get the port of the proxy we should connect to
-	port = proxies[whichProxy(proxies, fileName)].port;
-	printf("[+]Connecting to Port: %d\n", port);
-
-	/*
-	* first set up "serverAddr" to be the location of the server
-	*/
-	memset(&serverAddr, 0, sizeof(serverAddr));
-	serverAddr.sin_family = AF_INET;
-	serverAddr.sin_port = htons(port);
-	serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-	clientSocket = socket(AF_INET, SOCK_STREAM, 0);
-	if (clientSocket < 0)
-	{
-		printf("[-]Error in connection.\n");
-		exit(1);
-	}
-
-	printf("[+]Client Socket is created.\n");
-
-	printf("[+]Running TLS Configuration for client\n");
-	/* Calling TLS */
-
-	if((tls_init()) != 0)
+	char line[1024], *name;
+	while (fgets(line, sizeof(line), fp) != NULL)
 	{
-		err(1, "[-]TLS could not be initialized\n");
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0')
+			continue;
+		if ((name = strdup(line)) == NULL)
+			err(1, "[-]Could not read the file list");
+		addFile(fileNames, numFiles, capacity, name);
 	}
-	
-	printf("[+]TLS initialized.\n");
-	
-	if((cfg = tls_config_new()) == NULL) //Initiates client TLS config.
-	{
-		err(1, "[-]TLS Config could not finish.\n");
-	}
-
-	printf("[+]TLS config created.\n");
-
-	if(tls_config_set_ca_file(cfg, "../../certificates/root.pem") != 0) //Sets client root certificate.
-	{
-		err(1, "[-]Could not set client root certificate.\n");
-	}
-
-	printf("[+]TLS certificate set.\n");
-
-	tls_config_insecure_noverifyname(cfg); // Needed to use tls_connectsocket as proxy was trying to verify a name within the certificate.
+}
 
-	if((ctx = tls_client())== NULL)
+// your application name [-z] [-j parallel] [-t connect-timeout-ms] [-f listfile] filename...
+int main(int argc, char *argv[])
+{
+	struct tlscache_config config = {0};
+	struct tlscache *cache;
+	int ch, i, failures;
+	int numFiles = 0, capacity = 16;
+	const char **fileNames = malloc(capacity * sizeof(char *));
+	FILE *listFile;
+
+	if (fileNames == NULL)
+		err(1, "[-]Could not allocate the file list");
+	while ((ch = getopt(argc, argv, "f:j:t:z")) != -1)
 	{
-		err(1, "[-]Could not create client TLS context.\n");
+		switch (ch)
+		{
+		case 'f':
+			// "-" reads the list from stdin
+			if (strcmp(optarg, "-") == 0)
+				listFile = stdin;
+			else if ((listFile = fopen(optarg, "r")) == NULL)
+				err(1, "[-]Could not open %s", optarg);
+			readFileList(listFile, &fileNames, &numFiles, &capacity);
+			if (listFile != stdin)
+				fclose(listFile);
+			break;
+		case 'j':
+			if ((config.parallel = atoi(optarg)) <= 0)
+				usage();
+			break;
+		case 't':
+			if ((config.connectTimeout = atoi(optarg)) <= 0)
+				usage();
+			break;
+		case 'z':
+			config.compress = 1;
+			break;
+		default:
+			usage();
+		}
 	}
-
-	printf("[+]TLS client context created.\n");
-
-	if(tls_configure(ctx, cfg) != 0)
+	for (i = optind; i < argc; i++)
 	{
-		err(1, "[-]Could not create client TLS configuration.\n");
+		addFile(&fileNames, &numFiles, &capacity, argv[i]);
 	}
-	
-	printf("[+]TLS client instance created.\n");
-
-	connect(clientSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
-
-	printf("[+]Connected to proxy.\n");
-	
-	/*TLS Connect Check*/
-
-	if((tls_connect_socket(ctx, clientSocket, "client")) != 0)
+	if (numFiles == 0) // not enough arguments passed in
 	{
-		err(1, "[-]tls_connect_socket: %s", tls_error(ctx));
+		usage();
 	}
 
-	printf("[+]Connected to proxy socket and intializing handshake...\n");
-
-	if((tls_handshake(ctx) != 0))
+	config.workers = 1; // we only use tlscache_multi_get()
+	if ((cache = tlscache_init(&config)) == NULL)
 	{
-		errx(1, "[-]Could not establish handshake with proxy.\n");
+		errx(1, "[-]Could not set up TLS with root certificate.");
 	}
+	printf("[+]TLS client configured. Fetching %d files\n", numFiles);
 
-	printf("[+]Handshake successful. Connection secured to proxy with TLS\n");
+	struct tlscache_result *results = calloc(numFiles, sizeof(struct tlscache_result));
+	if (results == NULL)
+		err(1, "[-]Could not allocate the results");
+	failures = tlscache_multi_get(cache, fileNames, numFiles, results, printResult, NULL);
 
-	while (1)
+	for (i = 0; i < numFiles; i++)
 	{
-		ssize_t written, w;
-		w = 0;
-		written = 0;
-		while (written < strlen(fileName))
-		{
-			if((w = tls_write(ctx, fileName+written, strlen(fileName) - written)) <= 0)
-			{
-				err(1, "tls_write: %s", tls_error(ctx));
-				
-			}
-			else
-				written += w;
-		}
-
-		printf("[+]Sent Proxy file name: %s\n", fileName);
-
-		// recieve the file size
-		if((tls_read(ctx, buffer, sizeof(buffer))) <= 0)
-		{
-			err(1, "tls_read from proxy error");
-		}
-
-		// first check to see if the file is denied or does not exist..
-		if (strstr(buffer, "Denied") != NULL)
-		{
-			printf("[!]%s File is blacklisted.\n", buffer);
-			exit(1);
-		}
-		else if (strstr(buffer, "File does not exist") != NULL)
-		{
-			printf("[!]%s\n", buffer);
-			exit(1);
-		}
-		else
-		{
-			printf("[+]Finished receiving '%s'. Printing contents...\n", fileName);
-			printf("%s\n", buffer);
-			bzero(buffer, sizeof(buffer)); //Zero out buffers
-			bzero(fileName, sizeof(fileName)); //Zero out buffers
-			free(ctx);
-			close(clientSocket);
-			return 0;
-		}
+		tlscache_free_result(&results[i]);
 	}
-
-	return 0;
-}
\ No newline at end of file
+	free(results);
+	tlscache_close(cache);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,763 @@
+#include <arpa/inet.h>
+
+#include <netinet/in.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <tls.h>
+
+#include "compress.h"
+#include "hash.h"
+#include "net.h"
+#include "protocol.h"
+#include "tlscache.h"
+
+#define NUM_PROXIES 5
+#define REPLY_SIZE 1024 // the proxy replies with a full buffer unless the connection is framed
+#define DEFAULT_CA_FILE "../../certificates/root.pem"
+#define DEFAULT_WORKERS 4
+#define DEFAULT_MAX_IDLE 4
+#define DEFAULT_CONNECT_TIMEOUT 500 // milliseconds
+#define DEFAULT_IO_TIMEOUT 5000		// milliseconds, the proxy may have to ask the server first
+#define HEALTH_BACKOFF 2			// seconds a failed proxy is skipped, doubled on every further failure
+#define HEALTH_MAX_BACKOFF 30
+#define HOT_FILES 64 // hot files remembered, direct mapped by hash
+#define HOT_TTL 10	 // seconds a file stays hot unless a proxy says so again
+
+struct Proxy
+{
+	int port;
+	char *name;
+};
+
+static const struct Proxy proxies[NUM_PROXIES] = {
+	{.name = "ProxyOne", .port = 9990},
+	{.name = "ProxyTwo", .port = 9991},
+	{.name = "ProxyThree", .port = 9992},
+	{.name = "ProxyFour", .port = 9993},
+	{.name = "ProxyFive", .port = 9994},
+};
+
+struct Connection
+{
+	struct tls *ctx;
+	int fd;
+	int framed; // encodings were negotiated, replies carry a frame header (see protocol.h)
+	int ioTimeout; // milliseconds
+	struct Connection *next;
+};
+
+// idle connections to one proxy, and whether it answered recently
+struct Pool
+{
+	pthread_mutex_t lock;
+	struct Connection *idle;
+	int numIdle;
+	int failures;	 // in a row
+	time_t downUntil; // skipped until then unless every proxy is down
+};
+
+// a file a proxy said is hot, and over how many proxies it may be spread
+struct HotFile
+{
+	uint64_t hash;
+	int replicas;
+	time_t expires;
+};
+
+struct Job
+{
+	char *fileName;
+	tlscache_callback callback;
+	void *arg;
+	struct Job *next;
+};
+
+struct tlscache
+{
+	struct tls_config *cfg;
+	struct Pool pools[NUM_PROXIES];
+	int parallel;
+	int maxIdle;
+	int compress;
+	int connectTimeout; // milliseconds
+	int ioTimeout;
+
+	pthread_mutex_t hotLock;
+	struct HotFile hot[HOT_FILES];
+	unsigned spread; // round robin over the replicas of hot files
+
+	// tlscache_get_async() queue
+	pthread_t *workers;
+	int numWorkers;
+	pthread_mutex_t queueLock;
+	pthread_cond_t queueReady;
+	struct Job *head;
+	struct Job *tail;
+	int closing;
+};
+
+/**
+ * Given a string, will return the ascii sum of each character in it
+ *
+ * */
+static int stringToInt(const char *fileName)
+{
+	long k = 0;
+	int i = 0;
+	while (fileName[i] != '\0')
+	{
+		k += fileName[i];
+		i++;
+	}
+	return k;
+}
+
+/**
+ * Given array of 5 Proxies, and the file name will perform a rendezvous hashing scheme.
+ * Concatenates the file name with each proxy name and hashes the strings to get 5 hash values
+ * returns the index of the proxy with the highest hash value.
+ * */
+static int whichProxy(const struct Proxy *proxies, const char *fileName)
+{
+	int hash[5] = {0,0,0,0,0}; // hold hash values for each proxy
+	int maxIndex = 0;
+	for (int i = 0; i < 5; i++) {
+		hash[i] = stringToInt(fileName)+stringToInt(proxies[i].name); // concatenate object name with proxy name
+		hash[i] = hash[i] % 17; // hash the string s_i
+		if (hash[maxIndex] < hash[i]) {
+			// pick the highest hash value
+			maxIndex = i;
+		}
+	}
+	// return the proxy number
+	return maxIndex;
+}
+
+/**
+ * Orders all proxies by their rendezvous score for fileName, best first.
+ * ranks[0] is whichProxy(); each later one is where the file goes if those before it are down.
+ * */
+static void rankProxies(const struct Proxy *proxies, const char *fileName, int ranks[NUM_PROXIES])
+{
+	int score[NUM_PROXIES];
+	for (int i = 0; i < NUM_PROXIES; i++)
+	{
+		score[i] = (stringToInt(fileName) + stringToInt(proxies[i].name)) % 17;
+		// insertion sort, ties keep the lower index first like whichProxy()
+		int j = i;
+		for (; j > 0 && score[ranks[j - 1]] < score[i]; j--)
+			ranks[j] = ranks[j - 1];
+		ranks[j] = i;
+	}
+}
+
+static void closeConnection(struct Connection *conn)
+{
+	tls_close(conn->ctx);
+	tls_free(conn->ctx);
+	close(conn->fd);
+	free(conn);
+}
+
+/**
+ * Tells the proxy which codecs we decode, possibly none: framed replies
+ * are shorter, and tell us which files are hot. A proxy that does not know
+ * the ENCODINGS message treats it as a file name; its replies stay unframed.
+ * Returns 0 on success, -1 if the connection failed
+ * */
+static int negotiateEncodings(struct Connection *conn, unsigned codecs)
+{
+	char buffer[REPLY_SIZE];
+
+	snprintf(buffer, sizeof(buffer), CLIENT_ENCODINGS " %x", codecs);
+	if (netWriteFull(conn->ctx, buffer, strlen(buffer), conn->ioTimeout) != 0 || netReadFull(conn->ctx, buffer, REPLY_SIZE, conn->ioTimeout) != 0)
+		return -1;
+	buffer[REPLY_SIZE - 1] = '\0';
+	conn->framed = sscanf(buffer, CLIENT_ENCODINGS " %x", &codecs) == 1;
+	return 0;
+}
+
+/**
+ * Connects to a proxy and completes the TLS handshake, both within connectTimeout
+ * so that a proxy that is down or hung is given up on quickly.
+ * Returns NULL on failure
+ * */
+static struct Connection *openConnection(struct tlscache *cache, const struct Proxy *proxy)
+{
+	struct sockaddr_in proxyAddr;
+	struct Connection *conn = calloc(1, sizeof(struct Connection));
+	if (conn == NULL)
+		return NULL;
+
+	memset(&proxyAddr, 0, sizeof(proxyAddr));
+	proxyAddr.sin_family = AF_INET;
+	proxyAddr.sin_port = htons(proxy->port);
+	proxyAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	conn->ioTimeout = cache->ioTimeout;
+
+	if ((conn->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	{
+		free(conn);
+		return NULL;
+	}
+	if (netConnectTimeout(conn->fd, &proxyAddr, cache->connectTimeout) != 0 ||
+		netSetTimeout(conn->fd, cache->connectTimeout) != 0 ||
+		(conn->ctx = tls_client()) == NULL ||
+		tls_configure(conn->ctx, cache->cfg) != 0 ||
+		tls_connect_socket(conn->ctx, conn->fd, "client") != 0 ||
+		netClientHandshake(conn->ctx, cache->connectTimeout) != 0 ||
+		netSetTimeout(conn->fd, cache->ioTimeout) != 0 ||
+		negotiateEncodings(conn, cache->compress ? codecsAvailable() : 0) != 0)
+	{
+		tls_free(conn->ctx);
+		close(conn->fd);
+		free(conn);
+		return NULL;
+	}
+	return conn;
+}
+
+/**
+ * Takes an idle connection to the proxy from the pool, or opens a new one.
+ * *reused tells the caller whether the connection had been used before.
+ * */
+static struct Connection *acquireConnection(struct tlscache *cache, int proxyIndex, int *reused)
+{
+	struct Pool *pool = &cache->pools[proxyIndex];
+	struct Connection *conn;
+
+	pthread_mutex_lock(&pool->lock);
+	if ((conn = pool->idle) != NULL)
+	{
+		pool->idle = conn->next;
+		pool->numIdle--;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	*reused = conn != NULL;
+	if (conn == NULL)
+		conn = openConnection(cache, &proxies[proxyIndex]);
+	return conn;
+}
+
+/**
+ * Returns a healthy connection to the pool, closes it if the pool is full
+ * */
+static void releaseConnection(struct tlscache *cache, int proxyIndex, struct Connection *conn)
+{
+	struct Pool *pool = &cache->pools[proxyIndex];
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->numIdle < cache->maxIdle)
+	{
+		conn->next = pool->idle;
+		pool->idle = conn;
+		pool->numIdle++;
+		conn = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (conn != NULL)
+		closeConnection(conn);
+}
+
+/**
+ * Returns 1 if the proxy has not failed recently, 0 if it should be skipped
+ * */
+static int isHealthy(struct tlscache *cache, int proxyIndex)
+{
+	struct Pool *pool = &cache->pools[proxyIndex];
+	int healthy;
+
+	pthread_mutex_lock(&pool->lock);
+	healthy = pool->downUntil <= time(NULL);
+	pthread_mutex_unlock(&pool->lock);
+	return healthy;
+}
+
+static void markUp(struct tlscache *cache, int proxyIndex)
+{
+	struct Pool *pool = &cache->pools[proxyIndex];
+
+	pthread_mutex_lock(&pool->lock);
+	pool->failures = 0;
+	pool->downUntil = 0;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Skips the proxy for a while, longer each time it fails again.
+ * Its idle connections are closed since they most likely broke with it.
+ * */
+static void markDown(struct tlscache *cache, int proxyIndex)
+{
+	struct Pool *pool = &cache->pools[proxyIndex];
+	struct Connection *idle;
+	int backoff = HEALTH_BACKOFF;
+
+	pthread_mutex_lock(&pool->lock);
+	for (int i = 0; i < pool->failures && backoff < HEALTH_MAX_BACKOFF; i++)
+		backoff *= 2;
+	pool->failures++;
+	pool->downUntil = time(NULL) + (backoff < HEALTH_MAX_BACKOFF ? backoff : HEALTH_MAX_BACKOFF);
+	idle = pool->idle;
+	pool->idle = NULL;
+	pool->numIdle = 0;
+	pthread_mutex_unlock(&pool->lock);
+
+	while (idle != NULL)
+	{
+		struct Connection *next = idle->next;
+		closeConnection(idle);
+		idle = next;
+	}
+}
+
+/**
+ * Reads a framed reply and decompresses it into buffer.
+ * *replicas is set to the number of proxies the file may be fetched from
+ * Returns 0 on success, -1 if the connection failed or the reply is corrupt
+ * */
+static int readFrame(struct Connection *conn, char *buffer, int *replicas)
+{
+	char header[CLIENT_FRAME_HEADER_SIZE], payload[REPLY_SIZE];
+	size_t headerLength = 0, length;
+	ssize_t decompressed;
+	int codec;
+
+	// the header is short, read it a byte at a time so nothing past it is consumed
+	do
+	{
+		if (headerLength == sizeof(header) - 1 || netReadFull(conn->ctx, header + headerLength, 1, conn->ioTimeout) != 0)
+			return -1;
+	} while (header[headerLength++] != '\n');
+	header[headerLength] = '\0';
+	if (sscanf(header, "%d %zu %d", &codec, &length, replicas) < 2 || length > REPLY_SIZE - 1 || netReadFull(conn->ctx, payload, length, conn->ioTimeout) != 0)
+		return -1;
+
+	if (codec == CODEC_NONE)
+	{
+		memcpy(buffer, payload, length);
+		buffer[length] = '\0';
+		return 0;
+	}
+	if ((decompressed = codecDecompress(codec, payload, length, buffer, REPLY_SIZE - 1)) < 0)
+		return -1;
+	buffer[decompressed] = '\0';
+	return 0;
+}
+
+/**
+ * Sends the request and reads the proxy's full reply, see readFrame() for replicas
+ * Returns 0 on success, -1 if the connection failed
+ * */
+static int request(struct Connection *conn, const char *message, char *buffer, int *replicas)
+{
+	*replicas = 1;
+	if (netWriteFull(conn->ctx, message, strlen(message), conn->ioTimeout) != 0)
+		return -1;
+	if (conn->framed)
+		return readFrame(conn, buffer, replicas);
+	if (netReadFull(conn->ctx, buffer, REPLY_SIZE, conn->ioTimeout) != 0)
+		return -1;
+	buffer[REPLY_SIZE - 1] = '\0';
+	return 0;
+}
+
+/**
+ * Turns the proxy's reply into a result.
+ * A file arrives as "fileName: content", anything else is a denial or an error.
+ * */
+static void parseReply(const char *fileName, const char *buffer, struct tlscache_result *result)
+{
+	size_t nameLength = strlen(fileName);
+	const char *content = buffer;
+
+	if (strcmp(buffer, CLIENT_BUSY_REPLY) == 0 || strcmp(buffer, CLIENT_RATE_LIMITED_REPLY) == 0)
+		result->status = TLSCACHE_BUSY;
+	else if (strstr(buffer, "File does not exist") != NULL)
+		result->status = TLSCACHE_NOT_FOUND;
+	else if (strstr(buffer, "Denied") != NULL)
+		result->status = TLSCACHE_DENIED;
+	else if (strncmp(buffer, fileName, nameLength) == 0 && buffer[nameLength] == ':')
+	{
+		result->status = TLSCACHE_OK;
+		content = buffer + nameLength + 1;
+		if (*content == ' ')
+			content++;
+	}
+	else
+		result->status = TLSCACHE_ERROR;
+
+	result->length = strlen(content);
+	result->content = strdup(content);
+}
+
+/**
+ * Sends one request to a proxy.
+ * A pooled connection may have been closed by the proxy while idle,
+ * so a failure on a reused connection is retried once on a fresh one.
+ * Returns 0 on success, -1 if the proxy could not be reached
+ * */
+static int fetchFrom(struct tlscache *cache, int proxyIndex, const char *message, char *buffer, int *replicas)
+{
+	int reused = 0;
+
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		struct Connection *conn = acquireConnection(cache, proxyIndex, &reused);
+		if (conn == NULL)
+			break;
+		if (request(conn, message, buffer, replicas) == 0)
+		{
+			releaseConnection(cache, proxyIndex, conn);
+			return 0;
+		}
+		closeConnection(conn);
+		if (!reused)
+			break;
+	}
+	return -1;
+}
+
+/**
+ * Returns the number of proxies a hot file may be fetched from, 1 for other files.
+ * *spread is set to a different one of them on every call.
+ * */
+static int hotReplicas(struct tlscache *cache, const char *fileName, int *spread)
+{
+	uint64_t hash = hashString(fileName);
+	struct HotFile *hot = &cache->hot[hash % HOT_FILES];
+	int replicas = 1;
+
+	pthread_mutex_lock(&cache->hotLock);
+	if (hot->hash == hash && hot->expires > time(NULL))
+		replicas = hot->replicas;
+	*spread = cache->spread++ % replicas;
+	pthread_mutex_unlock(&cache->hotLock);
+	return replicas;
+}
+
+static void markHot(struct tlscache *cache, const char *fileName, int replicas)
+{
+	uint64_t hash = hashString(fileName);
+	struct HotFile *hot = &cache->hot[hash % HOT_FILES];
+
+	pthread_mutex_lock(&cache->hotLock);
+	*hot = (struct HotFile){.hash = hash, .replicas = replicas < NUM_PROXIES ? replicas : NUM_PROXIES, .expires = time(NULL) + HOT_TTL};
+	pthread_mutex_unlock(&cache->hotLock);
+}
+
+/**
+ * Fetches one file from the proxy that owns it. If that proxy is down the next one
+ * in rendezvous order is asked, which serves or forwards the request on its behalf.
+ * Proxies that failed recently are tried last, in case they are back.
+ * Requests for a hot file are spread over the proxies the owner named, which
+ * each keep a replica; those after the owner are asked with "REPLICA <fileName>".
+ * */
+static void fetch(struct tlscache *cache, const char *fileName, struct tlscache_result *result)
+{
+	char buffer[REPLY_SIZE], replicaRequest[REPLY_SIZE];
+	int ranks[NUM_PROXIES], isReplica[NUM_PROXIES] = {0};
+	int spread, replicas = hotReplicas(cache, fileName, &spread), hint;
+
+	memset(result, 0, sizeof(*result));
+	result->fileName = fileName;
+	rankProxies(proxies, fileName, ranks);
+	snprintf(replicaRequest, sizeof(replicaRequest), CLIENT_REPLICA " %s", fileName);
+	for (int i = 1; i < replicas; i++)
+		isReplica[ranks[i]] = 1;
+	// start at this request's replica, the rest keep their order
+	int first = ranks[spread];
+	memmove(&ranks[1], &ranks[0], spread * sizeof(int));
+	ranks[0] = first;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (int i = 0; i < NUM_PROXIES; i++)
+		{
+			if (isHealthy(cache, ranks[i]) != (pass == 0))
+				continue;
+			if (fetchFrom(cache, ranks[i], isReplica[ranks[i]] ? replicaRequest : fileName, buffer, &hint) == 0)
+			{
+				if (hint > 1)
+					markHot(cache, fileName, hint);
+				markUp(cache, ranks[i]);
+				parseReply(fileName, buffer, result);
+				return;
+			}
+			markDown(cache, ranks[i]);
+		}
+	}
+	result->status = TLSCACHE_ERROR;
+	result->content = strdup("Could not reach proxy.");
+	result->length = strlen(result->content);
+}
+
+int tlscache_get(struct tlscache *cache, const char *fileName, struct tlscache_result *result)
+{
+	fetch(cache, fileName, result);
+	return result->status;
+}
+
+void tlscache_free_result(struct tlscache_result *result)
+{
+	free(result->content);
+	result->content = NULL;
+}
+
+/**
+ * Files of one tlscache_multi_get() call that belong to the same proxy
+ * */
+struct Batch
+{
+	struct tlscache *cache;
+	const char **fileNames;
+	struct tlscache_result *results;
+	int *indices;
+	int numFiles;
+	sem_t *slots;
+	tlscache_callback callback;
+	void *arg;
+};
+
+static void *fetchBatch(void *inputs)
+{
+	struct Batch *batch = inputs;
+
+	sem_wait(batch->slots);
+	// sequential on purpose: the batch keeps reusing one pooled connection
+	for (int i = 0; i < batch->numFiles; i++)
+	{
+		struct tlscache_result *result = &batch->results[batch->indices[i]];
+		fetch(batch->cache, batch->fileNames[batch->indices[i]], result);
+		if (batch->callback != NULL)
+			batch->callback(result, batch->arg);
+	}
+	sem_post(batch->slots);
+	return NULL;
+}
+
+/**
+ * Fetches every file, one connection per proxy and proxies in parallel.
+ * results[i] receives the result for fileNames[i]; callback (if not NULL)
+ * runs as each one completes. Free each result with tlscache_free_result().
+ * Returns the number of files that were not fetched successfully, all of them
+ * with TLSCACHE_ERROR and no callbacks if the batches cannot be allocated.
+ * */
+int tlscache_multi_get(struct tlscache *cache, const char **fileNames, int numFiles,
+					   struct tlscache_result *results, tlscache_callback callback, void *arg)
+{
+	struct Batch batches[NUM_PROXIES];
+	pthread_t threads[NUM_PROXIES];
+	int started[NUM_PROXIES] = {0};
+	int i, failures = 0, allocated = 1;
+	sem_t slots;
+
+	for (i = 0; i < NUM_PROXIES; i++)
+	{
+		batches[i] = (struct Batch){.cache = cache, .fileNames = fileNames, .results = results, .slots = &slots,
+									.callback = callback, .arg = arg, .indices = malloc(numFiles * sizeof(int))};
+		allocated = allocated && batches[i].indices != NULL;
+	}
+	if (!allocated)
+	{
+		for (i = 0; i < NUM_PROXIES; i++)
+			free(batches[i].indices);
+		for (i = 0; i < numFiles; i++)
+			results[i] = (struct tlscache_result){.fileName = fileNames[i], .status = TLSCACHE_ERROR};
+		return numFiles;
+	}
+	sem_init(&slots, 0, cache->parallel);
+	// group the files by the proxy rendezvous hashing picks for them
+	for (i = 0; i < numFiles; i++)
+	{
+		struct Batch *batch = &batches[whichProxy(proxies, fileNames[i])];
+		batch->indices[batch->numFiles++] = i;
+	}
+
+	for (i = 0; i < NUM_PROXIES; i++)
+	{
+		if (batches[i].numFiles == 0)
+			continue;
+		if (pthread_create(&threads[i], NULL, &fetchBatch, &batches[i]) == 0)
+			started[i] = 1;
+		else
+			fetchBatch(&batches[i]);
+	}
+	for (i = 0; i < NUM_PROXIES; i++)
+	{
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		free(batches[i].indices);
+	}
+	sem_destroy(&slots);
+
+	for (i = 0; i < numFiles; i++)
+	{
+		if (results[i].status != TLSCACHE_OK)
+			failures++;
+	}
+	return failures;
+}
+
+static void *workerLoop(void *inputs)
+{
+	struct tlscache *cache = inputs;
+	struct tlscache_result result;
+
+	while (1)
+	{
+		pthread_mutex_lock(&cache->queueLock);
+		while (cache->head == NULL && !cache->closing)
+			pthread_cond_wait(&cache->queueReady, &cache->queueLock);
+		struct Job *job = cache->head;
+		if (job == NULL)
+		{
+			// closing and nothing left to do
+			pthread_mutex_unlock(&cache->queueLock);
+			return NULL;
+		}
+		if ((cache->head = job->next) == NULL)
+			cache->tail = NULL;
+		pthread_mutex_unlock(&cache->queueLock);
+
+		fetch(cache, job->fileName, &result);
+		job->callback(&result, job->arg);
+		tlscache_free_result(&result);
+		free(job->fileName);
+		free(job);
+	}
+}
+
+/**
+ * Queues a fetch and returns immediately. callback runs on a library thread
+ * when the result is ready; the result is only valid during the callback.
+ * Returns 0 if queued, -1 on failure.
+ * */
+int tlscache_get_async(struct tlscache *cache, const char *fileName, tlscache_callback callback, void *arg)
+{
+	struct Job *job = calloc(1, sizeof(struct Job));
+	if (job == NULL || (job->fileName = strdup(fileName)) == NULL)
+	{
+		free(job);
+		return -1;
+	}
+	job->callback = callback;
+	job->arg = arg;
+
+	pthread_mutex_lock(&cache->queueLock);
+	if (cache->closing)
+	{
+		pthread_mutex_unlock(&cache->queueLock);
+		free(job->fileName);
+		free(job);
+		return -1;
+	}
+	if (cache->tail != NULL)
+		cache->tail->next = job;
+	else
+		cache->head = job;
+	cache->tail = job;
+	pthread_cond_signal(&cache->queueReady);
+	pthread_mutex_unlock(&cache->queueLock);
+	return 0;
+}
+
+/**
+ * Loads the CA certificate and starts the async workers.
+ * config may be NULL for the defaults. Returns NULL on failure.
+ * */
+struct tlscache *tlscache_init(const struct tlscache_config *config)
+{
+	struct tlscache_config defaults = {0};
+	struct tlscache *cache;
+
+	if (config == NULL)
+		config = &defaults;
+	if (tls_init() != 0 || (cache = calloc(1, sizeof(struct tlscache))) == NULL)
+		return NULL;
+
+	cache->parallel = config->parallel > 0 ? config->parallel : NUM_PROXIES;
+	cache->maxIdle = config->maxIdle > 0 ? config->maxIdle : DEFAULT_MAX_IDLE;
+	cache->compress = config->compress;
+	cache->connectTimeout = config->connectTimeout > 0 ? config->connectTimeout : DEFAULT_CONNECT_TIMEOUT;
+	cache->ioTimeout = config->ioTimeout > 0 ? config->ioTimeout : DEFAULT_IO_TIMEOUT;
+	cache->numWorkers = config->workers > 0 ? config->workers : DEFAULT_WORKERS;
+
+	if ((cache->cfg = tls_config_new()) == NULL ||
+		tls_config_set_ca_file(cache->cfg, config->caFile != NULL ? config->caFile : DEFAULT_CA_FILE) != 0)
+	{
+		tls_config_free(cache->cfg);
+		free(cache);
+		return NULL;
+	}
+	tls_config_insecure_noverifyname(cache->cfg); // the proxy certificate does not carry a name to verify
+
+	for (int i = 0; i < NUM_PROXIES; i++)
+		pthread_mutex_init(&cache->pools[i].lock, NULL);
+	pthread_mutex_init(&cache->queueLock, NULL);
+	pthread_mutex_init(&cache->hotLock, NULL);
+	pthread_cond_init(&cache->queueReady, NULL);
+
+	if ((cache->workers = calloc(cache->numWorkers, sizeof(pthread_t))) == NULL)
+	{
+		for (int i = 0; i < NUM_PROXIES; i++)
+			pthread_mutex_destroy(&cache->pools[i].lock);
+		pthread_mutex_destroy(&cache->queueLock);
+		pthread_mutex_destroy(&cache->hotLock);
+		pthread_cond_destroy(&cache->queueReady);
+		tls_config_free(cache->cfg);
+		free(cache);
+		return NULL;
+	}
+	for (int i = 0; i < cache->numWorkers; i++)
+	{
+		if (pthread_create(&cache->workers[i], NULL, &workerLoop, cache) != 0)
+		{
+			cache->numWorkers = i;
+			break;
+		}
+	}
+	return cache;
+}
+
+/**
+ * Finishes queued async fetches, then closes every pooled connection
+ * */
+void tlscache_close(struct tlscache *cache)
+{
+	pthread_mutex_lock(&cache->queueLock);
+	cache->closing = 1;
+	pthread_cond_broadcast(&cache->queueReady);
+	pthread_mutex_unlock(&cache->queueLock);
+	for (int i = 0; i < cache->numWorkers; i++)
+		pthread_join(cache->workers[i], NULL);
+	free(cache->workers);
+
+	for (int i = 0; i < NUM_PROXIES; i++)
+	{
+		while (cache->pools[i].idle != NULL)
+		{
+			struct Connection *conn = cache->pools[i].idle;
+			cache->pools[i].idle = conn->next;
+			closeConnection(conn);
+		}
+		pthread_mutex_destroy(&cache->pools[i].lock);
+	}
+	tls_config_free(cache->cfg);
+	free(cache);
+}
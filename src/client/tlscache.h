@@ -0,0 +1,53 @@
+#ifndef TLSCACHE_H
+#define TLSCACHE_H
+
+#include <stddef.h>
+
+/**
+ * Client library for the TLS cache.
+ * Keeps the CA config parsed once and a pool of open TLS connections to
+ * every proxy, so repeated requests skip the TCP and TLS handshakes.
+ * A proxy that cannot be reached is skipped for a while, and its files are
+ * fetched through the next proxy in rendezvous order instead.
+ * All functions are safe to call from several threads on the same handle.
+ * */
+
+#define TLSCACHE_OK 0
+#define TLSCACHE_DENIED 1	  // blacklisted
+#define TLSCACHE_NOT_FOUND 2 // the server does not have the file
+#define TLSCACHE_BUSY 3	  // the proxy is overloaded or the client over its rate limit, try again later
+#define TLSCACHE_ERROR -1	  // no usable reply from the proxy
+
+struct tlscache;
+
+struct tlscache_config
+{
+	const char *caFile; // root certificate, NULL for ../../certificates/root.pem
+	int workers;		// threads serving tlscache_get_async(), 0 for 4
+	int parallel;		// proxies tlscache_multi_get() talks to at once, 0 for all
+	int maxIdle;		// idle connections kept per proxy, 0 for 4
+	int compress;		// have proxies send files compressed when they hold them that way
+	int connectTimeout; // milliseconds to wait for a proxy to accept, 0 for 500
+	int ioTimeout;		// milliseconds to wait for a proxy to answer, 0 for 5000
+};
+
+struct tlscache_result
+{
+	const char *fileName;
+	int status;		// one of the TLSCACHE_ codes above
+	char *content;	// file content when status is TLSCACHE_OK, otherwise the proxy's reply
+	size_t length;
+};
+
+// called once per file, from a library thread, as soon as its result is ready
+typedef void (*tlscache_callback)(const struct tlscache_result *result, void *arg);
+
+struct tlscache *tlscache_init(const struct tlscache_config *config);
+int tlscache_get(struct tlscache *cache, const char *fileName, struct tlscache_result *result);
+int tlscache_multi_get(struct tlscache *cache, const char **fileNames, int numFiles,
+					   struct tlscache_result *results, tlscache_callback callback, void *arg);
+int tlscache_get_async(struct tlscache *cache, const char *fileName, tlscache_callback callback, void *arg);
+void tlscache_free_result(struct tlscache_result *result);
+void tlscache_close(struct tlscache *cache);
+
+#endif
@@ -0,0 +1,58 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "stats.h"
+
+struct ArenaChunk
+{
+	struct ArenaChunk *next;
+	size_t size;
+	char data[];
+};
+
+/**
+ * Returns size bytes aligned for any type, NULL if memory could not be allocated
+ * */
+void *arenaAlloc(struct Arena *arena, size_t size)
+{
+	size = (size + 15) & ~(size_t)15;
+	if (arena->chunks == NULL || arena->used + size > arena->chunks->size)
+	{
+		size_t chunkSize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+		struct ArenaChunk *chunk = malloc(sizeof(struct ArenaChunk) + chunkSize);
+		if (chunk == NULL)
+		{
+			return NULL;
+		}
+		chunk->next = arena->chunks;
+		chunk->size = chunkSize;
+		arena->chunks = chunk;
+		arena->used = 0;
+		statsGaugeAdd(GAUGE_ARENA_RESERVED_BYTES, chunkSize);
+	}
+	void *ptr = arena->chunks->data + arena->used;
+	arena->used += size;
+	arena->bytes += size;
+	return ptr;
+}
+
+char *arenaStrdup(struct Arena *arena, const char *string)
+{
+	size_t length = strlen(string) + 1;
+	char *copy = arenaAlloc(arena, length);
+	return copy == NULL ? NULL : memcpy(copy, string, length);
+}
+
+void arenaFree(struct Arena *arena)
+{
+	while (arena->chunks != NULL)
+	{
+		struct ArenaChunk *next = arena->chunks->next;
+		statsGaugeAdd(GAUGE_ARENA_RESERVED_BYTES, -(int64_t)arena->chunks->size);
+		free(arena->chunks);
+		arena->chunks = next;
+	}
+	arena->used = 0;
+	arena->bytes = 0;
+}
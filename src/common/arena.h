@@ -0,0 +1,26 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct ArenaChunk;
+
+/**
+ * Bump allocator for data that is freed all at once, e.g. a blacklist.
+ * Allocations are never freed individually; arenaFree() releases everything.
+ * Not thread safe.
+ * */
+struct Arena
+{
+	struct ArenaChunk *chunks; // most recent first
+	size_t used;			   // bytes handed out from the first chunk
+	size_t bytes;			   // bytes handed out in total
+};
+
+void *arenaAlloc(struct Arena *arena, size_t size);
+char *arenaStrdup(struct Arena *arena, const char *string);
+void arenaFree(struct Arena *arena);
+
+#endif
@@ -0,0 +1,150 @@
+#include <string.h>
+
+#include <zlib.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compress.h"
+
+/**
+ * Returns the mask of codecs this build can use
+ * */
+unsigned codecsAvailable()
+{
+	unsigned codecs = CODEC_BIT(CODEC_ZLIB);
+#ifdef HAVE_LZ4
+	codecs |= CODEC_BIT(CODEC_LZ4);
+#endif
+#ifdef HAVE_ZSTD
+	codecs |= CODEC_BIT(CODEC_ZSTD);
+#endif
+	return codecs;
+}
+
+/**
+ * Returns the codec to use with a peer that accepts codecs, CODEC_NONE if there is none in common
+ * */
+int codecPick(unsigned codecs)
+{
+	// fastest to decode first
+	static const int preference[] = {CODEC_LZ4, CODEC_ZSTD, CODEC_ZLIB};
+
+	codecs &= codecsAvailable();
+	for (size_t i = 0; i < sizeof(preference) / sizeof(preference[0]); i++)
+	{
+		if (codecs & CODEC_BIT(preference[i]))
+			return preference[i];
+	}
+	return CODEC_NONE;
+}
+
+const char *codecName(int codec)
+{
+	static const char *names[CODEC_COUNT] = {"none", "zlib", "lz4", "zstd"};
+	return codec >= 0 && codec < CODEC_COUNT ? names[codec] : "unknown";
+}
+
+/**
+ * Raw deflate: objects are small, so the zlib header and checksum would eat the gain
+ * */
+static ssize_t deflateRaw(const void *src, size_t length, void *dst, size_t size)
+{
+	z_stream stream;
+	ssize_t result = -1;
+
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+	stream.next_in = (Bytef *)src;
+	stream.avail_in = length;
+	stream.next_out = dst;
+	stream.avail_out = size;
+	if (deflate(&stream, Z_FINISH) == Z_STREAM_END)
+		result = stream.total_out;
+	deflateEnd(&stream);
+	return result;
+}
+
+static ssize_t inflateRaw(const void *src, size_t length, void *dst, size_t size)
+{
+	z_stream stream;
+	ssize_t result = -1;
+
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit2(&stream, -15) != Z_OK)
+		return -1;
+	stream.next_in = (Bytef *)src;
+	stream.avail_in = length;
+	stream.next_out = dst;
+	stream.avail_out = size;
+	if (inflate(&stream, Z_FINISH) == Z_STREAM_END)
+		result = stream.total_out;
+	inflateEnd(&stream);
+	return result;
+}
+
+/**
+ * Compresses length bytes of src into dst.
+ * Returns the compressed length, -1 on failure or if compressing would not save space
+ * */
+ssize_t codecCompress(int codec, const void *src, size_t length, void *dst, size_t size)
+{
+	ssize_t compressed = -1;
+
+	switch (codec)
+	{
+	case CODEC_ZLIB:
+		compressed = deflateRaw(src, length, dst, size);
+		break;
+#ifdef HAVE_LZ4
+	case CODEC_LZ4:
+		compressed = LZ4_compress_default(src, dst, length, size);
+		compressed = compressed > 0 ? compressed : -1;
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case CODEC_ZSTD:
+	{
+		size_t n = ZSTD_compress(dst, size, src, length, 3);
+		compressed = ZSTD_isError(n) ? -1 : (ssize_t)n;
+		break;
+	}
+#endif
+	}
+	return compressed >= 0 && (size_t)compressed < length ? compressed : -1;
+}
+
+/**
+ * Decompresses length bytes of src into dst.
+ * Returns the decompressed length, -1 if src is corrupt or does not fit
+ * */
+ssize_t codecDecompress(int codec, const void *src, size_t length, void *dst, size_t size)
+{
+	ssize_t decompressed = -1;
+
+	switch (codec)
+	{
+	case CODEC_ZLIB:
+		decompressed = inflateRaw(src, length, dst, size);
+		break;
+#ifdef HAVE_LZ4
+	case CODEC_LZ4:
+		decompressed = LZ4_decompress_safe(src, dst, length, size);
+		decompressed = decompressed >= 0 ? decompressed : -1;
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case CODEC_ZSTD:
+	{
+		size_t n = ZSTD_decompress(dst, size, src, length);
+		decompressed = ZSTD_isError(n) ? -1 : (ssize_t)n;
+		break;
+	}
+#endif
+	}
+	return decompressed;
+}
@@ -0,0 +1,26 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Codecs for objects stored by the proxy and sent between server, proxy and client.
+ * zlib is always built in; lz4 and zstd only when CMake finds them (HAVE_LZ4, HAVE_ZSTD).
+ * Peers exchange masks of CODEC_BIT()s and use the best codec both sides have.
+ * */
+#define CODEC_NONE 0
+#define CODEC_ZLIB 1
+#define CODEC_LZ4 2
+#define CODEC_ZSTD 3
+#define CODEC_COUNT 4
+
+#define CODEC_BIT(codec) (1u << (codec))
+
+unsigned codecsAvailable();
+int codecPick(unsigned codecs);
+const char *codecName(int codec);
+ssize_t codecCompress(int codec, const void *src, size_t length, void *dst, size_t size);
+ssize_t codecDecompress(int codec, const void *src, size_t length, void *dst, size_t size);
+
+#endif
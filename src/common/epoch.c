@@ -0,0 +1,99 @@
+#include <err.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "epoch.h"
+
+#define EPOCH_POLL_NSEC 100000
+
+/**
+ * One per thread that ever entered a read section.
+ * Like log rings, slots are never freed: a slot released by an exiting thread
+ * is claimed by the next new one.
+ * */
+struct EpochSlot
+{
+	_Atomic uint64_t epoch; // global epoch seen on entry, 0 outside a read section
+	_Atomic int inUse;
+	struct EpochSlot *next;
+};
+
+static _Atomic uint64_t globalEpoch = 1;
+static _Atomic(struct EpochSlot *) slots = NULL;
+static __thread struct EpochSlot *threadSlot = NULL;
+static pthread_key_t slotKey;
+static pthread_once_t slotKeyOnce = PTHREAD_ONCE_INIT;
+
+static void releaseSlot(void *slot)
+{
+	atomic_store(&((struct EpochSlot *)slot)->inUse, 0);
+}
+
+static void makeSlotKey()
+{
+	pthread_key_create(&slotKey, releaseSlot);
+}
+
+static struct EpochSlot *claimSlot()
+{
+	struct EpochSlot *slot;
+	for (slot = atomic_load(&slots); slot != NULL; slot = slot->next)
+	{
+		int expected = 0;
+		if (atomic_compare_exchange_strong(&slot->inUse, &expected, 1))
+		{
+			break;
+		}
+	}
+	if (slot == NULL)
+	{
+		// a reader the writer cannot see would be unsafe, so there is no fallback
+		if ((slot = calloc(1, sizeof(struct EpochSlot))) == NULL)
+		{
+			err(1, "[-]Could not allocate epoch slot");
+		}
+		atomic_store(&slot->inUse, 1);
+		slot->next = atomic_load(&slots);
+		while (!atomic_compare_exchange_weak(&slots, &slot->next, slot))
+			;
+	}
+	pthread_once(&slotKeyOnce, makeSlotKey);
+	pthread_setspecific(slotKey, slot);
+	threadSlot = slot;
+	return slot;
+}
+
+void epochEnter()
+{
+	struct EpochSlot *slot = threadSlot != NULL ? threadSlot : claimSlot();
+	// sequentially consistent, so the shared pointer is loaded after the writer can see us
+	atomic_store(&slot->epoch, atomic_load(&globalEpoch));
+}
+
+void epochExit()
+{
+	atomic_store_explicit(&threadSlot->epoch, 0, memory_order_release);
+}
+
+/**
+ * Waits until every read section that started before the call has ended.
+ * Call it after publishing a new version and before freeing the old one.
+ * */
+void epochSynchronize()
+{
+	uint64_t target = atomic_fetch_add(&globalEpoch, 1) + 1;
+	struct timespec pause = {.tv_sec = 0, .tv_nsec = EPOCH_POLL_NSEC};
+
+	for (struct EpochSlot *slot = atomic_load(&slots); slot != NULL; slot = slot->next)
+	{
+		uint64_t epoch;
+		while ((epoch = atomic_load(&slot->epoch)) != 0 && epoch < target)
+		{
+			nanosleep(&pause, NULL);
+		}
+	}
+}
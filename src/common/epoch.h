@@ -0,0 +1,17 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/**
+ * Epoch based reclamation for data that is read far more often than it is replaced.
+ * Readers bracket their use of a shared pointer with epochEnter()/epochExit(), which
+ * only touch the calling thread's own slot. A writer publishes a new version with an
+ * atomic exchange, calls epochSynchronize() and may then free the old version:
+ * every reader that could still see it has left its read section by then.
+ * Read sections must not nest.
+ * */
+
+void epochEnter();
+void epochExit();
+void epochSynchronize();
+
+#endif
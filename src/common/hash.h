@@ -0,0 +1,39 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_SEED 14695981039346656037ULL
+
+/**
+ * 64-bit FNV-1a hash of a string.
+ * Used to index hash tables; unlike stringToInt() anagrams do not collide.
+ * */
+static inline uint64_t hashString(const char *object)
+{
+	uint64_t h = HASH_SEED;
+	while (*object != '\0')
+	{
+		h ^= (unsigned char)*object++;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/**
+ * Continues an FNV-1a hash over size bytes.
+ * Start with HASH_SEED; feeding data in pieces gives the same result as all at once.
+ * */
+static inline uint64_t hashBytes(uint64_t h, const void *data, size_t size)
+{
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < size; i++)
+	{
+		h ^= bytes[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+#endif
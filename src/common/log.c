@@ -0,0 +1,246 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "log.h"
+
+#define LOG_RECORD_SIZE 512
+#define LOG_RING_RECORDS 256 // must be a power of two
+#define LOG_FLUSH_INTERVAL_NSEC 5000000
+
+/**
+ * Single producer, single consumer ring.
+ * The owning thread advances head, the flusher advances tail.
+ * Rings are never freed: when a thread exits its ring is released
+ * and the next new thread picks it up.
+ * */
+struct LogRing
+{
+	_Atomic unsigned long head;
+	_Atomic unsigned long tail;
+	_Atomic unsigned long dropped;
+	_Atomic int inUse;
+	struct LogRing *next;
+	char records[LOG_RING_RECORDS][LOG_RECORD_SIZE];
+};
+
+int logLevel = LOG_LEVEL_INFO;
+
+static _Atomic(struct LogRing *) rings = NULL;
+static __thread struct LogRing *threadRing = NULL;
+static pthread_key_t ringKey;
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+// held while draining, so a fork never copies a half-written batch
+static pthread_mutex_t drainLock = PTHREAD_MUTEX_INITIALIZER;
+static int started = 0;
+
+static const char *levelNames[] = {"error", "warn", "info", "debug"};
+
+static void releaseRing(void *ring)
+{
+	atomic_store(&((struct LogRing *)ring)->inUse, 0);
+}
+
+static void makeRingKey()
+{
+	pthread_key_create(&ringKey, releaseRing);
+}
+
+/**
+ * Finds a released ring or pushes a new one onto the list
+ * */
+static struct LogRing *claimRing()
+{
+	struct LogRing *ring;
+	for (ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+	{
+		int expected = 0;
+		if (atomic_compare_exchange_strong(&ring->inUse, &expected, 1))
+		{
+			break;
+		}
+	}
+	if (ring == NULL)
+	{
+		if ((ring = calloc(1, sizeof(struct LogRing))) == NULL)
+		{
+			return NULL;
+		}
+		atomic_store(&ring->inUse, 1);
+		ring->next = atomic_load(&rings);
+		while (!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+			;
+	}
+	pthread_once(&ringKeyOnce, makeRingKey);
+	pthread_setspecific(ringKey, ring);
+	threadRing = ring;
+	return ring;
+}
+
+/**
+ * Formats the message into the calling thread's ring.
+ * Never blocks: if the flusher has fallen behind the message is dropped and counted.
+ * Before logInit() (or if no ring can be allocated) it writes straight to stdout.
+ * */
+void logWrite(int level, const char *format, ...)
+{
+	va_list args;
+	struct LogRing *ring = threadRing;
+
+	(void)level; // the LOG_ macros already filtered by level
+	if (!started || (ring == NULL && (ring = claimRing()) == NULL))
+	{
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+		return;
+	}
+
+	unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_RECORDS)
+	{
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return;
+	}
+	va_start(args, format);
+	vsnprintf(ring->records[head & (LOG_RING_RECORDS - 1)], LOG_RECORD_SIZE, format, args);
+	va_end(args);
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Writes out everything queued so far. Returns the number of records written.
+ * Caller holds drainLock.
+ * */
+static int drain()
+{
+	int written = 0;
+	for (struct LogRing *ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+	{
+		unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		for (; tail != head; tail++)
+		{
+			fputs(ring->records[tail & (LOG_RING_RECORDS - 1)], stdout);
+			written++;
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+		unsigned long dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+		if (dropped > 0)
+		{
+			printf("[-]Log: dropped %lu messages\n", dropped);
+			written++;
+		}
+	}
+	if (written > 0)
+	{
+		fflush(stdout);
+	}
+	return written;
+}
+
+void logFlush()
+{
+	pthread_mutex_lock(&drainLock);
+	drain();
+	pthread_mutex_unlock(&drainLock);
+}
+
+static void *flushLoop(void *arg)
+{
+	struct timespec interval = {0, LOG_FLUSH_INTERVAL_NSEC};
+	(void)arg;
+	while (1)
+	{
+		pthread_mutex_lock(&drainLock);
+		int written = drain();
+		pthread_mutex_unlock(&drainLock);
+		if (written == 0)
+		{
+			nanosleep(&interval, NULL);
+		}
+	}
+	return NULL;
+}
+
+static void startFlusher()
+{
+	pthread_t thread_id;
+	if (pthread_create(&thread_id, NULL, &flushLoop, NULL))
+	{
+		// without a flusher, log synchronously
+		started = 0;
+		return;
+	}
+	pthread_detach(thread_id);
+	started = 1;
+}
+
+static void beforeFork()
+{
+	pthread_mutex_lock(&drainLock);
+	drain();
+}
+
+static void afterForkParent()
+{
+	pthread_mutex_unlock(&drainLock);
+}
+
+/**
+ * The child only keeps the forking thread. Anything queued by the parent's
+ * other threads after the drain in beforeFork() belongs to the parent,
+ * so skip it, hand every other ring back and start a fresh flusher.
+ * */
+static void afterForkChild()
+{
+	pthread_mutex_init(&drainLock, NULL);
+	for (struct LogRing *ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+	{
+		atomic_store(&ring->tail, atomic_load(&ring->head));
+		atomic_store(&ring->dropped, 0);
+		if (ring != threadRing)
+		{
+			atomic_store(&ring->inUse, 0);
+		}
+	}
+	startFlusher();
+}
+
+/**
+ * Returns the level for "error", "warn", "info" or "debug", -1 if unknown
+ * */
+int logParseLevel(const char *name)
+{
+	for (int i = LOG_LEVEL_ERROR; i <= LOG_LEVEL_DEBUG; i++)
+	{
+		if (strcasecmp(name, levelNames[i]) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Sets the runtime level and starts the background flusher.
+ * Processes forked afterwards get their own flusher automatically.
+ * */
+void logInit(int level)
+{
+	logLevel = level;
+	if (started)
+	{
+		return;
+	}
+	pthread_atfork(beforeFork, afterForkParent, afterForkChild);
+	atexit(logFlush);
+	startFlusher();
+}
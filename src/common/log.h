@@ -0,0 +1,37 @@
+#ifndef LOG_H
+#define LOG_H
+
+enum LogLevel
+{
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_WARN,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_DEBUG
+};
+
+// messages above this level are compiled out entirely (set with -DLOG_COMPILE_LEVEL=n)
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// messages above this level are skipped at run time
+extern int logLevel;
+
+void logInit(int level);
+int logParseLevel(const char *name);
+void logWrite(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void logFlush();
+
+#define LOG_AT(level, ...)                                            \
+	do                                                                \
+	{                                                                 \
+		if ((level) <= LOG_COMPILE_LEVEL && (level) <= logLevel)      \
+			logWrite((level), __VA_ARGS__);                           \
+	} while (0)
+
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "net.h"
+
+uint64_t netNowMsec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+}
+
+/**
+ * Makes blocking reads and writes on fd give up after timeout milliseconds, 0 waits forever
+ * */
+int netSetTimeout(int fd, int timeout)
+{
+	struct timeval tv = {.tv_sec = timeout / 1000, .tv_usec = timeout % 1000 * 1000};
+	return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0 &&
+				   setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0
+			   ? 0
+			   : -1;
+}
+
+/**
+ * Connects fd to addr, giving up after timeout milliseconds instead of
+ * waiting for the kernel's much longer SYN retries. fd is left blocking.
+ * Returns 0 on success, -1 on failure with errno telling why
+ * */
+int netConnectTimeout(int fd, const struct sockaddr_in *addr, int timeout)
+{
+	struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+	int flags = fcntl(fd, F_GETFL), error = 0;
+	socklen_t errorLength = sizeof(error);
+
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
+		return -1;
+	if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) != 0 &&
+		(errno != EINPROGRESS || poll(&pfd, 1, timeout) != 1 ||
+		 getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) != 0 || error != 0))
+	{
+		if (error != 0)
+			errno = error;
+		else if (errno == EINPROGRESS)
+			errno = ETIMEDOUT;
+		return -1;
+	}
+	return fcntl(fd, F_SETFL, flags);
+}
+
+/**
+ * Completes the TLS handshake of a client connection within timeout milliseconds.
+ * The socket should have a timeout of its own, so a silent peer shows up as TLS_WANT_POLLIN.
+ * Returns 0 on success, -1 on failure
+ * */
+int netClientHandshake(struct tls *ctx, int timeout)
+{
+	uint64_t started = netNowMsec();
+	int ret;
+
+	while ((ret = tls_handshake(ctx)) == TLS_WANT_POLLIN || ret == TLS_WANT_POLLOUT)
+	{
+		if (netNowMsec() - started >= (uint64_t)timeout)
+			return -1;
+	}
+	return ret;
+}
+
+/**
+ * Completes the TLS handshake with a client on fd within timeout milliseconds,
+ * so a client that stalls in the handshake only holds up its own connection,
+ * then makes later reads and writes give up after idleTimeout milliseconds (0 waits forever).
+ * Returns 0 on success, NET_TIMED_OUT if the client took too long and -1 on any other
+ * failure, with *error describing it
+ * */
+int netAcceptHandshake(struct tls *cctx, int fd, int timeout, int idleTimeout, const char **error)
+{
+	uint64_t started = netNowMsec();
+	int ret;
+
+	if (netSetTimeout(fd, timeout) != 0)
+	{
+		*error = strerror(errno);
+		return -1;
+	}
+	// the socket's timeout makes a silent client show up as TLS_WANT_POLLIN
+	while ((ret = tls_handshake(cctx)) == TLS_WANT_POLLIN || ret == TLS_WANT_POLLOUT)
+	{
+		if (netNowMsec() - started >= (uint64_t)timeout)
+		{
+			*error = "timed out";
+			return NET_TIMED_OUT;
+		}
+	}
+	if (ret != 0)
+	{
+		*error = tls_error(cctx) != NULL ? tls_error(cctx) : "connection closed";
+		return -1;
+	}
+	if (netSetTimeout(fd, idleTimeout) != 0)
+	{
+		*error = strerror(errno);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Reads exactly length bytes
+ * Returns 0 on success, -1 if the connection failed or timeout passed without data
+ * */
+int netReadFull(struct tls *ctx, char *buffer, size_t length, int timeout)
+{
+	size_t received = 0;
+	ssize_t n;
+	uint64_t started = netNowMsec();
+
+	while (received < length)
+	{
+		n = tls_read(ctx, buffer + received, length - received);
+		// the socket's receive timeout makes a silent peer show up as TLS_WANT_POLLIN
+		if ((n == TLS_WANT_POLLIN || n == TLS_WANT_POLLOUT) && netNowMsec() - started < (uint64_t)timeout)
+			continue;
+		if (n <= 0)
+			return -1;
+		received += n;
+	}
+	return 0;
+}
+
+/**
+ * Writes exactly length bytes
+ * Returns 0 on success, -1 if the connection failed or timeout passed without progress
+ * */
+int netWriteFull(struct tls *ctx, const char *buffer, size_t length, int timeout)
+{
+	size_t sent = 0;
+	ssize_t n;
+	uint64_t started = netNowMsec();
+
+	while (sent < length)
+	{
+		n = tls_write(ctx, buffer + sent, length - sent);
+		if ((n == TLS_WANT_POLLIN || n == TLS_WANT_POLLOUT) && netNowMsec() - started < (uint64_t)timeout)
+			continue;
+		if (n <= 0)
+			return -1;
+		sent += n;
+	}
+	return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef NET_H
+#define NET_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tls.h>
+
+/**
+ * Socket and TLS helpers shared by the proxy, the server and the client library.
+ * Timeouts are in milliseconds. The helpers only report what went wrong;
+ * counting it is up to the caller.
+ * */
+#define NET_TIMED_OUT -2 // the peer did not complete the handshake in time
+
+uint64_t netNowMsec();
+int netSetTimeout(int fd, int timeout);
+int netConnectTimeout(int fd, const struct sockaddr_in *addr, int timeout);
+int netClientHandshake(struct tls *ctx, int timeout);
+int netAcceptHandshake(struct tls *cctx, int fd, int timeout, int idleTimeout, const char **error);
+int netReadFull(struct tls *ctx, char *buffer, size_t length, int timeout);
+int netWriteFull(struct tls *ctx, const char *buffer, size_t length, int timeout);
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Proxy to server messages, each sent in a single write.
+ *
+ * Request: "<fileName>\n<version>\n<codecs>"
+ *     version is hex; 0 asks for the file unconditionally, anything else
+ *     only if the server's copy differs.
+ *     codecs is a hex mask of CODEC_BIT()s the proxy can store (see compress.h), may be left out.
+ * Replies: "OK <version> <ttl>\n<fileName>: <content>"
+ *          "OKZ <version> <ttl> <codec> <length>\n" followed by length bytes:
+ *              the "<fileName>: <content>" line compressed with codec
+ *          "NOTMODIFIED <version> <ttl>"   the proxy's copy is current for ttl more seconds
+ *          "File does not exist."
+ * All but OKZ are NUL terminated strings.
+ * Several files can be asked for at once with "MGET <count> <codecs>\n" followed by count
+ * lines "<version> <fileName>\n" and a NUL. The reply is "MGET <count>\n" followed, for each
+ * file in order, by "<length>\n" and the length bytes a request for just that file would get.
+ * The connection then stays open for the next multi-get.
+ *
+ * Proxy to client: the client sends a file name and reads a reply of exactly 1024 bytes.
+ * A client may first send "ENCODINGS <codecs>". The proxy answers, in 1024 bytes,
+ * "ENCODINGS <codecs>" with the codecs it will use, and from then on every reply on the
+ * connection is framed as "<codec> <length>\n" followed by length bytes of reply text,
+ * compressed unless codec is CODEC_NONE.
+ * An overloaded proxy answers "Proxy busy." without serving the request, and a client sending
+ * requests faster than its rate limit gets "Rate limit exceeded."; either may be retried later.
+ * The header of a reply for a hot file is "<codec> <length> <replicas>\n": for a while the
+ * client may send "REPLICA <fileName>" to any of the first <replicas> proxies in rendezvous
+ * order, which then serve it from their own cache instead of forwarding it to the owner.
+ *
+ * Proxy to proxy: a proxy asked for a file it does not own (see whichProxy()) sends
+ * "FORWARD <codecs> <fileName>" to the owner on a pooled connection, codecs being the ones
+ * its client accepts. The owner serves it like a client request, always with a framed reply,
+ * which is relayed to the client unchanged. A forwarded request is never forwarded again.
+ * Proxies connect to each other with the proxies' own certificate as client certificate,
+ * and "FORWARD" is only understood on such connections.
+ * */
+#define ORIGIN_NOT_FOUND_REPLY "File does not exist."
+#define ORIGIN_REPLY_SIZE (1024 + 64) // a files.txt line plus the reply header
+#define ORIGIN_MULTI_GET "MGET"
+#define ORIGIN_BATCH_MAX 64 // files in one multi-get
+#define ORIGIN_BATCH_REQUEST_SIZE (ORIGIN_BATCH_MAX * (1024 + 20) + 32)
+#define CLIENT_ENCODINGS "ENCODINGS"
+#define CLIENT_FRAME_HEADER_SIZE 32
+#define CLIENT_REPLICA "REPLICA"
+#define CLIENT_BUSY_REPLY "Proxy busy."
+#define CLIENT_RATE_LIMITED_REPLY "Rate limit exceeded."
+#define PEER_FORWARD "FORWARD"
+
+enum OriginStatus
+{
+	ORIGIN_OK,
+	ORIGIN_NOT_MODIFIED,
+	ORIGIN_NOT_FOUND,
+	ORIGIN_INVALID
+};
+
+struct OriginReply
+{
+	enum OriginStatus status;
+	uint64_t version;
+	int ttl;		  // seconds the object may be served without asking again
+	const char *file; // "<fileName>: <content>", only set for ORIGIN_OK
+	size_t length;	  // of file
+	int codec;		  // file is compressed unless this is CODEC_NONE
+};
+
+static inline int protocolFormatRequest(char *buffer, size_t size, const char *fileName, uint64_t version, unsigned codecs)
+{
+	return snprintf(buffer, size, "%s\n%" PRIx64 "\n%x", fileName, version, codecs);
+}
+
+/**
+ * Splits a request in place: request is left holding just the file name.
+ * */
+static inline void protocolParseRequest(char *request, uint64_t *version, unsigned *codecs)
+{
+	char *separator = strchr(request, '\n');
+	*version = 0;
+	*codecs = 0;
+	if (separator != NULL)
+	{
+		*separator = '\0';
+		*version = strtoull(separator + 1, &separator, 16);
+		if (*separator == '\n')
+			*codecs = strtoul(separator + 1, NULL, 16);
+	}
+}
+
+/**
+ * Parses the first length bytes of reply, which must be followed by a NUL
+ * */
+static inline void protocolParseReply(const char *reply, size_t length, struct OriginReply *parsed)
+{
+	int consumed = 0;
+	size_t compressed;
+
+	memset(parsed, 0, sizeof(*parsed));
+	if (strcmp(reply, ORIGIN_NOT_FOUND_REPLY) == 0)
+	{
+		parsed->status = ORIGIN_NOT_FOUND;
+	}
+	else if (sscanf(reply, "OK %" SCNx64 " %d\n%n", &parsed->version, &parsed->ttl, &consumed) == 2 && consumed > 0)
+	{
+		parsed->status = ORIGIN_OK;
+		parsed->file = reply + consumed;
+		parsed->length = strlen(parsed->file);
+	}
+	else if (sscanf(reply, "OKZ %" SCNx64 " %d %d %zu\n%n", &parsed->version, &parsed->ttl, &parsed->codec, &compressed, &consumed) == 4 &&
+			 consumed > 0 && consumed + compressed <= length)
+	{
+		parsed->status = ORIGIN_OK;
+		parsed->file = reply + consumed;
+		parsed->length = compressed;
+	}
+	else if (sscanf(reply, "NOTMODIFIED %" SCNx64 " %d", &parsed->version, &parsed->ttl) == 2)
+	{
+		parsed->status = ORIGIN_NOT_MODIFIED;
+	}
+	else
+	{
+		parsed->status = ORIGIN_INVALID;
+	}
+}
+
+#endif
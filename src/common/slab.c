@@ -0,0 +1,114 @@
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include "slab.h"
+#include "stats.h"
+
+#define SLAB_NUM_CLASSES 8 // 32, 64, ... 4096
+
+struct FreeChunk
+{
+	struct FreeChunk *next;
+};
+
+/**
+ * Chunks of one size. New pages are only carved up when the free list is empty.
+ * */
+struct SlabClass
+{
+	pthread_mutex_t lock;
+	struct FreeChunk *freeList;
+	char *page;		 // page being carved up
+	size_t pageUsed; // bytes of page already handed out
+};
+
+static struct SlabClass classes[SLAB_NUM_CLASSES] = {
+	[0 ... SLAB_NUM_CLASSES - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
+
+static int sizeClass(size_t size)
+{
+	int c = 0;
+	while ((size_t)SLAB_MIN_SIZE << c < size)
+	{
+		c++;
+	}
+	return c;
+}
+
+/**
+ * Returns at least size bytes, NULL if memory could not be allocated
+ * */
+void *slabAlloc(size_t size)
+{
+	if (size > SLAB_MAX_SIZE)
+	{
+		return malloc(size);
+	}
+
+	int c = sizeClass(size);
+	size_t chunkSize = (size_t)SLAB_MIN_SIZE << c;
+	struct SlabClass *slabClass = &classes[c];
+	void *chunk = NULL;
+
+	pthread_mutex_lock(&slabClass->lock);
+	if (slabClass->freeList != NULL)
+	{
+		chunk = slabClass->freeList;
+		slabClass->freeList = slabClass->freeList->next;
+	}
+	else
+	{
+		if (slabClass->page == NULL || slabClass->pageUsed + chunkSize > SLAB_PAGE_SIZE)
+		{
+			// whatever is left of the old page is too small for this class and stays unused
+			if ((slabClass->page = malloc(SLAB_PAGE_SIZE)) != NULL)
+			{
+				slabClass->pageUsed = 0;
+				statsGaugeAdd(GAUGE_SLAB_RESERVED_BYTES, SLAB_PAGE_SIZE);
+			}
+		}
+		if (slabClass->page != NULL)
+		{
+			chunk = slabClass->page + slabClass->pageUsed;
+			slabClass->pageUsed += chunkSize;
+		}
+	}
+	pthread_mutex_unlock(&slabClass->lock);
+
+	if (chunk != NULL)
+	{
+		statsGaugeAdd(GAUGE_SLAB_USED_BYTES, chunkSize);
+		statsGaugeAdd(GAUGE_SLAB_REQUESTED_BYTES, size);
+	}
+	return chunk;
+}
+
+/**
+ * Returns a chunk from slabAlloc(size) to its class
+ * */
+void slabFree(void *ptr, size_t size)
+{
+	if (ptr == NULL)
+	{
+		return;
+	}
+	if (size > SLAB_MAX_SIZE)
+	{
+		free(ptr);
+		return;
+	}
+
+	int c = sizeClass(size);
+	struct SlabClass *slabClass = &classes[c];
+	struct FreeChunk *chunk = ptr;
+
+	pthread_mutex_lock(&slabClass->lock);
+	chunk->next = slabClass->freeList;
+	slabClass->freeList = chunk;
+	pthread_mutex_unlock(&slabClass->lock);
+
+	statsGaugeAdd(GAUGE_SLAB_USED_BYTES, -(int64_t)(SLAB_MIN_SIZE << c));
+	statsGaugeAdd(GAUGE_SLAB_REQUESTED_BYTES, -(int64_t)size);
+}
@@ -0,0 +1,21 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+/**
+ * Size-class allocator for small objects that come and go at a high rate:
+ * cache entries, per-connection state, negative cache names.
+ * Sizes are rounded up to a power of two between SLAB_MIN_SIZE and SLAB_MAX_SIZE
+ * and carved out of SLAB_PAGE_SIZE pages; anything larger goes to malloc().
+ * Freed chunks go back on their class's free list, pages are never returned.
+ * The caller passes the size it allocated to slabFree(), so chunks carry no header.
+ * */
+#define SLAB_MIN_SIZE 32
+#define SLAB_MAX_SIZE 4096
+#define SLAB_PAGE_SIZE (64 * 1024)
+
+void *slabAlloc(size_t size);
+void slabFree(void *ptr, size_t size);
+
+#endif
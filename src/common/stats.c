@@ -0,0 +1,373 @@
+#include <arpa/inet.h>
+
+#include <netinet/in.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <pthread.h>
+
+#include "stats.h"
+
+#define STAT_MAX_SLOTS 256
+
+struct StatRegion
+{
+	_Atomic int numSlots; // slots ever claimed, the ones the admin thread sums
+	_Atomic int inUse[STAT_MAX_SLOTS]; // claimed by a live thread
+	int role;
+	int id;
+	struct StatSlot slots[STAT_MAX_SLOTS];
+};
+
+struct StatDescription
+{
+	const char *name;
+	const char *help;
+	int roles;
+};
+
+static const struct StatDescription counterDescriptions[STAT_NUM_COUNTERS] = {
+	[STAT_REQUESTS] = {"tlscache_requests_total", "Requests received.", ROLE_PROXY | ROLE_SERVER},
+	[STAT_CACHE_HITS] = {"tlscache_cache_hits_total", "Requests answered from the cache.", ROLE_PROXY},
+	[STAT_CACHE_MISSES] = {"tlscache_cache_misses_total", "Requests fetched from the origin server.", ROLE_PROXY},
+	[STAT_BLOOM_POSITIVES] = {"tlscache_bloom_positives_total", "Requests the membership filter flagged as possibly blacklisted.", ROLE_PROXY},
+	[STAT_BLOOM_FALSE_POSITIVES] = {"tlscache_bloom_false_positives_total", "Membership filter positives not confirmed by the blacklist.", ROLE_PROXY},
+	[STAT_DENIED] = {"tlscache_denied_total", "Requests denied by the confirmed blacklist.", ROLE_PROXY},
+	[STAT_PATTERN_DENIED] = {"tlscache_pattern_denied_total", "Requests denied by a blacklist pattern.", ROLE_PROXY},
+	[STAT_BLACKLIST_RELOADS] = {"tlscache_blacklist_reloads_total", "Times the blacklist was reloaded without a restart.", ROLE_PROXY},
+	[STAT_FORWARDED] = {"tlscache_forwarded_total", "Requests for files owned by another proxy, forwarded to it.", ROLE_PROXY},
+	[STAT_FORWARD_ERRORS] = {"tlscache_forward_errors_total", "Forwarded requests the owning proxy did not answer.", ROLE_PROXY},
+	[STAT_MISROUTED] = {"tlscache_misrouted_total", "Forwarded requests for files this proxy does not own either, refused.", ROLE_PROXY},
+	[STAT_FAILOVER_SERVED] = {"tlscache_failover_served_total", "Requests served in place of an owning proxy that could not be reached.", ROLE_PROXY},
+	[STAT_HOT_REPLIES] = {"tlscache_hot_replies_total", "Replies telling the client the file is hot and may be fetched from its replicas.", ROLE_PROXY},
+	[STAT_REPLICA_SERVED] = {"tlscache_replica_served_total", "Requests for a hot file owned by another proxy, served from this proxy's replica.", ROLE_PROXY},
+	[STAT_SHED_CONNECTIONS] = {"tlscache_shed_connections_total", "Connections closed on accept because too many were open.", ROLE_PROXY},
+	[STAT_SHED_REQUESTS] = {"tlscache_shed_requests_total", "Requests answered busy because too many were waiting for the cache.", ROLE_PROXY},
+	[STAT_DEADLINE_EXCEEDED] = {"tlscache_deadline_exceeded_total", "Requests answered busy because they waited for the cache past their deadline.", ROLE_PROXY},
+	[STAT_RATE_LIMITED] = {"tlscache_rate_limited_total", "Requests refused because their client was over its rate limit.", ROLE_PROXY},
+	[STAT_ORIGIN_BATCHES] = {"tlscache_origin_batches_total", "Multi-get requests between proxy and server.", ROLE_PROXY | ROLE_SERVER},
+	[STAT_ORIGIN_BATCHED_FILES] = {"tlscache_origin_batched_files_total", "Files asked for in multi-get requests, duplicates included.", ROLE_PROXY | ROLE_SERVER},
+	[STAT_ORIGIN_FAILOVERS] = {"tlscache_origin_failovers_total", "Files fetched from another server because the one that owns them could not be reached.", ROLE_PROXY},
+	[STAT_CATALOG_HITS] = {"tlscache_catalog_hits_total", "Files found in the server's in-memory catalog.", ROLE_SERVER},
+	[STAT_CATALOG_MISSES] = {"tlscache_catalog_misses_total", "Files looked up in files.txt because the catalog did not have them.", ROLE_SERVER},
+	[STAT_STORE_FD_HITS] = {"tlscache_store_fd_hits_total", "Files in the storage directory read through a descriptor kept open.", ROLE_SERVER},
+	[STAT_STORE_FD_MISSES] = {"tlscache_store_fd_misses_total", "Files in the storage directory that had to be opened.", ROLE_SERVER},
+	[STAT_STORE_TOO_LARGE] = {"tlscache_store_too_large_total", "Files in the storage directory refused because they do not fit in a reply.", ROLE_SERVER},
+	[STAT_NEGATIVE_HITS] = {"tlscache_negative_cache_hits_total", "Requests for missing objects answered from the negative cache.", ROLE_PROXY},
+	[STAT_CACHE_EVICTIONS] = {"tlscache_cache_evictions_total", "Objects evicted from the cache.", ROLE_PROXY},
+	[STAT_CACHE_DEMOTIONS] = {"tlscache_cache_demotions_total", "Objects moved from RAM to the cold tier.", ROLE_PROXY},
+	[STAT_CACHE_PROMOTIONS] = {"tlscache_cache_promotions_total", "Objects moved from the cold tier back to RAM.", ROLE_PROXY},
+	[STAT_REVALIDATIONS] = {"tlscache_revalidations_total", "Expired objects checked with the origin server.", ROLE_PROXY},
+	[STAT_NOT_MODIFIED] = {"tlscache_not_modified_total", "Revalidations answered with not modified.", ROLE_PROXY | ROLE_SERVER},
+	[STAT_STALE_HITS] = {"tlscache_stale_hits_total", "Expired objects served while they were refreshed.", ROLE_PROXY},
+	[STAT_BACKGROUND_REFRESHES] = {"tlscache_background_refreshes_total", "Objects refreshed from the origin server in the background.", ROLE_PROXY},
+	[STAT_COMPRESSED_REPLIES] = {"tlscache_compressed_replies_total", "Objects sent compressed.", ROLE_PROXY | ROLE_SERVER},
+	[STAT_COMPRESSION_SAVED_BYTES] = {"tlscache_compression_saved_bytes_total", "Bytes compression kept off the wire.", ROLE_SERVER},
+	[STAT_ORIGIN_ERRORS] = {"tlscache_origin_errors_total", "Origin fetches that failed.", ROLE_PROXY},
+	[STAT_OBJECTS_SERVED] = {"tlscache_objects_served_total", "Objects found and sent.", ROLE_SERVER},
+	[STAT_OBJECTS_MISSING] = {"tlscache_objects_missing_total", "Requests for objects that do not exist.", ROLE_SERVER},
+	[STAT_CONNECTIONS] = {"tlscache_connections_total", "Connections accepted.", ROLE_PROXY | ROLE_SERVER},
+	[STAT_HANDSHAKE_FAILURES] = {"tlscache_handshake_failures_total", "TLS handshakes that failed.", ROLE_PROXY | ROLE_SERVER},
+	[STAT_HANDSHAKE_TIMEOUTS] = {"tlscache_handshake_timeouts_total", "TLS handshakes given up because the peer did not complete them in time.", ROLE_PROXY | ROLE_SERVER},
+};
+
+static const struct StatDescription gaugeDescriptions[STAT_NUM_GAUGES] = {
+	[GAUGE_CACHE_BYTES] = {"tlscache_cache_bytes", "Bytes held by cached objects.", ROLE_PROXY},
+	[GAUGE_CACHE_ENTRIES] = {"tlscache_cache_entries", "Objects held in the cache.", ROLE_PROXY},
+	[GAUGE_ACTIVE_CONNECTIONS] = {"tlscache_active_connections", "Connections currently open.", ROLE_PROXY | ROLE_SERVER},
+	[GAUGE_COLD_BYTES] = {"tlscache_cold_cache_bytes", "Bytes held by objects in the cold tier.", ROLE_PROXY},
+	[GAUGE_COLD_ENTRIES] = {"tlscache_cold_cache_entries", "Objects held in the cold tier.", ROLE_PROXY},
+	[GAUGE_SLAB_RESERVED_BYTES] = {"tlscache_slab_reserved_bytes", "Bytes of slab pages taken from the system.", ROLE_PROXY},
+	[GAUGE_SLAB_USED_BYTES] = {"tlscache_slab_used_bytes", "Bytes of slab chunks handed out, rounded up to their size class.", ROLE_PROXY},
+	[GAUGE_SLAB_REQUESTED_BYTES] = {"tlscache_slab_requested_bytes", "Bytes asked for in slab allocations.", ROLE_PROXY},
+	[GAUGE_ARENA_RESERVED_BYTES] = {"tlscache_arena_reserved_bytes", "Bytes of arena chunks taken from the system.", ROLE_PROXY},
+	[GAUGE_BLACKLIST_ENTRIES] = {"tlscache_blacklist_entries", "Names in the blacklist currently in force.", ROLE_PROXY},
+	[GAUGE_BLACKLIST_PATTERNS] = {"tlscache_blacklist_patterns", "Patterns in the blacklist currently in force.", ROLE_PROXY},
+	[GAUGE_BLACKLIST_FILTER_BYTES] = {"tlscache_blacklist_filter_bytes", "Bytes of the membership filter in front of the blacklist.", ROLE_PROXY},
+	[GAUGE_RATE_LIMIT] = {"tlscache_rate_limit", "Requests per second allowed per client address, 0 when unlimited.", ROLE_PROXY},
+	[GAUGE_RATE_BURST] = {"tlscache_rate_burst", "Requests a client address may make at once after being idle.", ROLE_PROXY},
+	[GAUGE_CATALOG_ENTRIES] = {"tlscache_catalog_entries", "Files preloaded into the server's catalog.", ROLE_SERVER},
+	[GAUGE_CATALOG_BYTES] = {"tlscache_catalog_bytes", "Bytes taken by the preloaded catalog.", ROLE_SERVER},
+};
+
+static const uint64_t latencyBounds[STAT_NUM_BUCKETS] = {
+	500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000};
+
+// used until statsInit() runs (and by programs that never call it)
+static struct StatSlot fallbackSlot;
+static struct StatRegion *region = NULL;
+
+__thread struct StatSlot *statsThreadSlot = NULL;
+static pthread_key_t slotKey;
+static pthread_once_t slotKeyOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Gives a slot back when its thread exits. Its counts stay in it and keep being summed,
+ * the next thread to claim it adds to them.
+ * */
+static void releaseSlot(void *slot)
+{
+	struct StatSlot *statSlot = slot;
+
+	if (region != NULL && statSlot >= region->slots && statSlot < region->slots + STAT_MAX_SLOTS)
+	{
+		atomic_store(&region->inUse[statSlot - region->slots], 0);
+	}
+}
+
+static void makeSlotKey()
+{
+	pthread_key_create(&slotKey, releaseSlot);
+}
+
+// the main thread does not run key destructors, so its slot goes back when the process exits
+static void releaseMainSlot()
+{
+	pthread_once(&slotKeyOnce, makeSlotKey);
+	if (pthread_getspecific(slotKey) != NULL)
+	{
+		releaseSlot(pthread_getspecific(slotKey));
+		pthread_setspecific(slotKey, NULL);
+	}
+	statsThreadSlot = NULL;
+}
+
+// a forked child must not share its parent's slot
+static void forgetSlot()
+{
+	statsThreadSlot = NULL;
+	pthread_once(&slotKeyOnce, makeSlotKey);
+	pthread_setspecific(slotKey, NULL);
+}
+
+/**
+ * Maps the counter slots. The mapping is shared so that processes
+ * forked after this call (the server forks per connection) report into it,
+ * each into a slot of its own.
+ * */
+void statsInit(int role, int id)
+{
+	static int registered = 0;
+
+	region = mmap(NULL, sizeof(struct StatRegion), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED)
+	{
+		err(1, "[-]Could not map statistics");
+	}
+	region->role = role;
+	region->id = id;
+	atomic_store(&region->numSlots, 0);
+	statsThreadSlot = NULL;
+	if (!registered)
+	{
+		registered = 1;
+		pthread_atfork(NULL, NULL, forgetSlot);
+		atexit(releaseMainSlot);
+	}
+	statsClaimSlot();
+}
+
+/**
+ * Gives the calling thread a slot no live thread uses.
+ * Once all slots are taken threads share the first one, which stays correct
+ * because every update is an atomic add.
+ * */
+struct StatSlot *statsClaimSlot()
+{
+	int index, claimed, expected;
+
+	if (region == NULL)
+	{
+		return &fallbackSlot;
+	}
+	for (index = 0; index < STAT_MAX_SLOTS; index++)
+	{
+		expected = 0;
+		if (atomic_compare_exchange_strong(&region->inUse[index], &expected, 1))
+			break;
+	}
+	if (index == STAT_MAX_SLOTS)
+	{
+		// shared, so never given back
+		statsThreadSlot = &region->slots[0];
+		return statsThreadSlot;
+	}
+	claimed = atomic_load(&region->numSlots);
+	while (claimed <= index && !atomic_compare_exchange_weak(&region->numSlots, &claimed, index + 1))
+		;
+	statsThreadSlot = &region->slots[index];
+	pthread_once(&slotKeyOnce, makeSlotKey);
+	pthread_setspecific(slotKey, statsThreadSlot);
+	return statsThreadSlot;
+}
+
+uint64_t statsNowUsec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Records one origin fetch latency in the histogram
+ * */
+void statsObserveLatency(uint64_t usec)
+{
+	struct StatSlot *slot = statsSlot();
+	int bucket = 0;
+	while (bucket < STAT_NUM_BUCKETS && usec > latencyBounds[bucket])
+	{
+		bucket++;
+	}
+	atomic_fetch_add_explicit(&slot->latencyBuckets[bucket], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&slot->latencySumUsec, usec, memory_order_relaxed);
+}
+
+static int numClaimedSlots()
+{
+	int n = atomic_load(&region->numSlots);
+	return n > STAT_MAX_SLOTS ? STAT_MAX_SLOTS : n;
+}
+
+/**
+ * Writes every metric for this role into buffer in the Prometheus text format.
+ * Returns the number of bytes written.
+ * */
+int statsRender(char *buffer, size_t size)
+{
+	size_t len = 0;
+	int slots = numClaimedSlots();
+
+#define APPEND(...)                                                       \
+	do                                                                    \
+	{                                                                     \
+		if (len < size)                                                   \
+		{                                                                 \
+			int n = snprintf(buffer + len, size - len, __VA_ARGS__);      \
+			len = (n < 0 || len + n >= size) ? size - 1 : len + n;        \
+		}                                                                 \
+	} while (0)
+
+	APPEND("# HELP tlscache_info Role of this process.\n# TYPE tlscache_info gauge\n");
+	APPEND("tlscache_info{role=\"%s\",id=\"%d\"} 1\n", region->role == ROLE_PROXY ? "proxy" : "server", region->id);
+
+	for (int c = 0; c < STAT_NUM_COUNTERS; c++)
+	{
+		if (!(counterDescriptions[c].roles & region->role))
+			continue;
+		uint64_t total = 0;
+		for (int s = 0; s < slots; s++)
+			total += atomic_load_explicit(&region->slots[s].counters[c], memory_order_relaxed);
+		APPEND("# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counterDescriptions[c].name, counterDescriptions[c].help,
+			   counterDescriptions[c].name, counterDescriptions[c].name, (unsigned long long)total);
+	}
+
+	for (int g = 0; g < STAT_NUM_GAUGES; g++)
+	{
+		if (!(gaugeDescriptions[g].roles & region->role))
+			continue;
+		int64_t total = 0;
+		for (int s = 0; s < slots; s++)
+			total += atomic_load_explicit(&region->slots[s].gauges[g], memory_order_relaxed);
+		APPEND("# HELP %s %s\n# TYPE %s gauge\n%s %lld\n", gaugeDescriptions[g].name, gaugeDescriptions[g].help,
+			   gaugeDescriptions[g].name, gaugeDescriptions[g].name, (long long)total);
+	}
+
+	if (region->role == ROLE_PROXY)
+	{
+		uint64_t cumulative = 0, sum = 0;
+		APPEND("# HELP tlscache_origin_fetch_seconds Latency of fetches from the origin server.\n");
+		APPEND("# TYPE tlscache_origin_fetch_seconds histogram\n");
+		for (int b = 0; b <= STAT_NUM_BUCKETS; b++)
+		{
+			for (int s = 0; s < slots; s++)
+				cumulative += atomic_load_explicit(&region->slots[s].latencyBuckets[b], memory_order_relaxed);
+			if (b < STAT_NUM_BUCKETS)
+				APPEND("tlscache_origin_fetch_seconds_bucket{le=\"%g\"} %llu\n", latencyBounds[b] / 1e6, (unsigned long long)cumulative);
+			else
+				APPEND("tlscache_origin_fetch_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+		}
+		for (int s = 0; s < slots; s++)
+			sum += atomic_load_explicit(&region->slots[s].latencySumUsec, memory_order_relaxed);
+		APPEND("tlscache_origin_fetch_seconds_sum %g\n", sum / 1e6);
+		APPEND("tlscache_origin_fetch_seconds_count %llu\n", (unsigned long long)cumulative);
+	}
+#undef APPEND
+	return len;
+}
+
+/**
+ * Answers every connection on the admin port with the current metrics
+ * as a plain HTTP response, then closes it.
+ * */
+static void *adminLoop(void *arg)
+{
+	int sockfd = *(int *)arg;
+	static char metrics[65536];
+	char request[1024];
+
+	while (1)
+	{
+		int adminSocket = accept(sockfd, NULL, NULL);
+		if (adminSocket < 0)
+		{
+			continue;
+		}
+		// we answer the same way whatever was asked, just drain the request line
+		recv(adminSocket, request, sizeof(request), 0);
+
+		int len = statsRender(metrics, sizeof(metrics));
+		char header[128];
+		int headerLen = snprintf(header, sizeof(header),
+								 "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n", len);
+		send(adminSocket, header, headerLen, MSG_NOSIGNAL);
+		send(adminSocket, metrics, len, MSG_NOSIGNAL);
+		close(adminSocket);
+	}
+	return NULL;
+}
+
+/**
+ * Starts the admin endpoint: a plaintext port on 127.0.0.1 served by its own thread.
+ * Returns 0 on success, -1 if the port could not be opened.
+ * */
+int statsStartAdmin(int port)
+{
+	static int sockfd;
+	struct sockaddr_in adminAddr;
+	int one = 1;
+	pthread_t thread_id;
+
+	if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	{
+		return -1;
+	}
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&adminAddr, '\0', sizeof(adminAddr));
+	adminAddr.sin_family = AF_INET;
+	adminAddr.sin_port = htons(port);
+	adminAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+	if (bind(sockfd, (struct sockaddr *)&adminAddr, sizeof(adminAddr)) < 0 || listen(sockfd, 10) < 0)
+	{
+		close(sockfd);
+		return -1;
+	}
+
+	if (pthread_create(&thread_id, NULL, &adminLoop, &sockfd))
+	{
+		close(sockfd);
+		return -1;
+	}
+	pthread_detach(thread_id);
+	return 0;
+}
@@ -0,0 +1,145 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Counters shared by the proxy and the server.
+ * Each counter is only rendered for the roles listed in its table entry (see stats.c).
+ * */
+enum StatCounter
+{
+	STAT_REQUESTS,
+	STAT_CACHE_HITS,
+	STAT_CACHE_MISSES,
+	STAT_BLOOM_POSITIVES,
+	STAT_BLOOM_FALSE_POSITIVES,
+	STAT_DENIED,
+	STAT_PATTERN_DENIED,
+	STAT_BLACKLIST_RELOADS,
+	STAT_FORWARDED,
+	STAT_FORWARD_ERRORS,
+	STAT_MISROUTED,
+	STAT_FAILOVER_SERVED,
+	STAT_HOT_REPLIES,
+	STAT_REPLICA_SERVED,
+	STAT_SHED_CONNECTIONS,
+	STAT_SHED_REQUESTS,
+	STAT_DEADLINE_EXCEEDED,
+	STAT_RATE_LIMITED,
+	STAT_ORIGIN_BATCHES,
+	STAT_ORIGIN_BATCHED_FILES,
+	STAT_ORIGIN_FAILOVERS,
+	STAT_CATALOG_HITS,
+	STAT_CATALOG_MISSES,
+	STAT_STORE_FD_HITS,
+	STAT_STORE_FD_MISSES,
+	STAT_STORE_TOO_LARGE,
+	STAT_NEGATIVE_HITS,
+	STAT_CACHE_EVICTIONS,
+	STAT_CACHE_DEMOTIONS,
+	STAT_CACHE_PROMOTIONS,
+	STAT_REVALIDATIONS,
+	STAT_NOT_MODIFIED,
+	STAT_STALE_HITS,
+	STAT_BACKGROUND_REFRESHES,
+	STAT_COMPRESSED_REPLIES,
+	STAT_COMPRESSION_SAVED_BYTES,
+	STAT_ORIGIN_ERRORS,
+	STAT_OBJECTS_SERVED,
+	STAT_OBJECTS_MISSING,
+	STAT_CONNECTIONS,
+	STAT_HANDSHAKE_FAILURES,
+	STAT_HANDSHAKE_TIMEOUTS,
+	STAT_NUM_COUNTERS
+};
+
+/**
+ * Gauges are kept as per-thread deltas and summed when collected,
+ * so one thread may increment a gauge that another thread decrements.
+ * */
+enum StatGauge
+{
+	GAUGE_CACHE_BYTES,
+	GAUGE_CACHE_ENTRIES,
+	GAUGE_ACTIVE_CONNECTIONS,
+	GAUGE_COLD_BYTES,
+	GAUGE_COLD_ENTRIES,
+	GAUGE_SLAB_RESERVED_BYTES,
+	GAUGE_SLAB_USED_BYTES,
+	GAUGE_SLAB_REQUESTED_BYTES,
+	GAUGE_ARENA_RESERVED_BYTES,
+	GAUGE_BLACKLIST_ENTRIES,
+	GAUGE_BLACKLIST_PATTERNS,
+	GAUGE_BLACKLIST_FILTER_BYTES,
+	GAUGE_RATE_LIMIT,
+	GAUGE_RATE_BURST,
+	GAUGE_CATALOG_ENTRIES,
+	GAUGE_CATALOG_BYTES,
+	STAT_NUM_GAUGES
+};
+
+enum StatRole
+{
+	ROLE_PROXY = 1,
+	ROLE_SERVER = 2
+};
+
+// upper bounds (in microseconds) of the origin fetch latency histogram buckets
+#define STAT_NUM_BUCKETS 12
+
+/**
+ * One slot per thread. Only the owning thread writes to it, the admin thread sums all slots.
+ * Aligned to a cache line so that threads never share one.
+ * */
+struct StatSlot
+{
+	_Atomic uint64_t counters[STAT_NUM_COUNTERS];
+	_Atomic int64_t gauges[STAT_NUM_GAUGES];
+	_Atomic uint64_t latencyBuckets[STAT_NUM_BUCKETS + 1]; // last bucket is +Inf
+	_Atomic uint64_t latencySumUsec;
+} __attribute__((aligned(64)));
+
+extern __thread struct StatSlot *statsThreadSlot;
+
+void statsInit(int role, int id);
+int statsStartAdmin(int port);
+struct StatSlot *statsClaimSlot();
+void statsObserveLatency(uint64_t usec);
+uint64_t statsNowUsec();
+int statsRender(char *buffer, size_t size);
+
+/**
+ * Returns the calling thread's slot, claiming one on first use.
+ * */
+static inline struct StatSlot *statsSlot()
+{
+	if (statsThreadSlot == NULL)
+	{
+		return statsClaimSlot();
+	}
+	return statsThreadSlot;
+}
+
+/**
+ * Hot path helpers. Relaxed atomics on the calling thread's own slot:
+ * no locks and no cache line shared with other writers.
+ * */
+static inline void statsInc(enum StatCounter counter)
+{
+	atomic_fetch_add_explicit(&statsSlot()->counters[counter], 1, memory_order_relaxed);
+}
+
+static inline void statsAdd(enum StatCounter counter, uint64_t value)
+{
+	atomic_fetch_add_explicit(&statsSlot()->counters[counter], value, memory_order_relaxed);
+}
+
+static inline void statsGaugeAdd(enum StatGauge gauge, int64_t delta)
+{
+	atomic_fetch_add_explicit(&statsSlot()->gauges[gauge], delta, memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "compress.h"
+#include "hash.h"
+#include "log.h"
+#include "slab.h"
+#include "stats.h"
+
+#define entryName(entry) ((entry)->data)
+#define entryContent(entry) ((entry)->data + (entry)->nameLength + 1)
+
+static size_t entrySize(size_t nameLength, size_t contentLength)
+{
+	return sizeof(struct CacheEntry) + nameLength + contentLength + 2;
+}
+
+/**
+ * Sets up an empty RAM tier holding at most capacity files.
+ * Returns 0 on success, -1 if memory could not be allocated
+ * */
+int cacheInit(struct Cache *cache, int capacity)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->capacity = capacity;
+	cache->numBuckets = capacity;
+	cache->buckets = calloc(cache->numBuckets, sizeof(struct CacheEntry *));
+	cache->lru = calloc(1, sizeof(struct CacheEntry));
+	if (cache->buckets == NULL || cache->lru == NULL)
+	{
+		return -1;
+	}
+	cache->lru->prev = cache->lru->next = cache->lru;
+	return 0;
+}
+
+static struct CacheEntry **findSlot(struct Cache *cache, const char *fileName)
+{
+	struct CacheEntry **slot = &cache->buckets[hashString(fileName) % cache->numBuckets];
+	while (*slot != NULL && strcmp(entryName(*slot), fileName) != 0)
+	{
+		slot = &(*slot)->hashNext;
+	}
+	return slot;
+}
+
+static void unlinkLru(struct CacheEntry *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+static void pushFront(struct Cache *cache, struct CacheEntry *entry)
+{
+	entry->prev = cache->lru;
+	entry->next = cache->lru->next;
+	cache->lru->next->prev = entry;
+	cache->lru->next = entry;
+}
+
+/**
+ * Unlinks the entry in *slot and gives its memory back
+ * */
+static void removeEntry(struct Cache *cache, struct CacheEntry **slot)
+{
+	struct CacheEntry *entry = *slot;
+	size_t size = entrySize(entry->nameLength, entry->contentLength);
+
+	*slot = entry->hashNext;
+	unlinkLru(entry);
+	cache->numEntries--;
+	statsGaugeAdd(GAUGE_CACHE_ENTRIES, -1);
+	statsGaugeAdd(GAUGE_CACHE_BYTES, -(int64_t)size);
+	slabFree(entry, size);
+}
+
+/**
+ * Removes the least recently used file from RAM.
+ * It is demoted to the cold tier if there is one, otherwise it is gone.
+ * */
+static void evictOldest(struct Cache *cache)
+{
+	struct CacheEntry *victim = cache->lru->prev;
+
+	if (cache->cold != NULL && coldStore(cache->cold, entryName(victim), entryContent(victim), victim->contentLength, victim->codec,
+														victim->version, victim->expires) == 0)
+	{
+		statsInc(STAT_CACHE_DEMOTIONS);
+	}
+	else
+	{
+		statsInc(STAT_CACHE_EVICTIONS);
+	}
+	removeEntry(cache, findSlot(cache, entryName(victim)));
+}
+
+/**
+ * Puts the file at the front of the RAM tier, replacing an older copy,
+ * and makes room by evicting if the tier is full
+ * */
+static void insertFile(struct Cache *cache, const char *fileName, const char *content, size_t contentLength, int codec,
+					   uint64_t version, time_t expires)
+{
+	struct CacheEntry **slot = findSlot(cache, fileName);
+	size_t nameLength = strlen(fileName);
+	size_t size = entrySize(nameLength, contentLength);
+	struct CacheEntry *entry;
+
+	if (*slot != NULL)
+	{
+		removeEntry(cache, slot);
+	}
+	else if (cache->numEntries >= cache->capacity)
+	{
+		evictOldest(cache);
+	}
+	if ((entry = slabAlloc(size)) == NULL)
+	{
+		return;
+	}
+	entry->version = version;
+	entry->expires = expires;
+	entry->hits = 0;
+	entry->refreshing = 0;
+	entry->codec = codec;
+	entry->nameLength = nameLength;
+	entry->contentLength = contentLength;
+	memcpy(entryName(entry), fileName, nameLength + 1);
+	memcpy(entryContent(entry), content, contentLength);
+	entryContent(entry)[contentLength] = '\0';
+
+	// the chain may have changed
+	slot = findSlot(cache, fileName);
+	entry->hashNext = NULL;
+	*slot = entry;
+	pushFront(cache, entry);
+	cache->numEntries++;
+	cache->version++;
+	statsGaugeAdd(GAUGE_CACHE_ENTRIES, 1);
+	statsGaugeAdd(GAUGE_CACHE_BYTES, size);
+}
+
+/**
+ * Adds file to the cache
+ * file is the server's reply "fileName: content", valid for ttl seconds.
+ * If codec is not CODEC_NONE it is the length bytes the server compressed that line into, and is kept that way.
+ * */
+void addToCache(struct Cache *cache, const char *file, size_t length, int codec, const char *fileName, uint64_t version, int ttl)
+{
+	if (codec == CODEC_NONE)
+	{
+		file += strlen(fileName) + 2;
+		length = strlen(file);
+	}
+	insertFile(cache, fileName, file, length, codec, version, time(NULL) + ttl);
+}
+
+/**
+ * Returns the entry for fileName, promoting it back to RAM if it is in the cold tier,
+ * NULL if it is in neither
+ * */
+static struct CacheEntry *lookupEntry(struct Cache *cache, const char *fileName)
+{
+	struct CacheEntry *entry = *findSlot(cache, fileName);
+	struct File file;
+
+	if (entry == NULL && cache->cold != NULL && coldTake(cache->cold, fileName, &file) == 0)
+	{
+		LOG_INFO("[!]%s found in cold cache. Promoting it to memory.\n", fileName);
+		statsInc(STAT_CACHE_PROMOTIONS);
+		insertFile(cache, file.fileName, file.content, file.contentLength, file.codec, file.version, file.expires);
+		entry = *findSlot(cache, fileName);
+	}
+	return entry;
+}
+
+/**
+ * Checks to see if the fileName is in the proxy's cache.
+ * A file found in the cold tier is promoted back to RAM.
+ * *version is set to the cached version if the file is in the cache
+ * Returns CACHE_FRESH if the file is in the cache and can be served as is
+ * Returns CACHE_REFRESH if it can be served but the caller should refresh it in the background:
+ *   it expired less than staleSeconds ago, or it is hot and expires within refreshAhead seconds
+ * Returns CACHE_EXPIRED if it is in the cache but must be revalidated first
+ * Returns CACHE_MISS if the file is not in cacne
+ * */
+int isInCache(struct Cache *cache, const char *fileName, uint64_t *version)
+{
+	struct CacheEntry *entry = lookupEntry(cache, fileName);
+
+	if (entry == NULL)
+	{
+		return CACHE_MISS;
+	}
+	*version = entry->version;
+	time_t now = time(NULL);
+	if (entry->expires > now)
+	{
+		LOG_INFO("[!]%s found in cache. Returning without contacting server.\n", fileName);
+		if (++entry->hits >= CACHE_HOT_HITS && entry->expires - now <= cache->refreshAhead && !entry->refreshing)
+		{
+			entry->refreshing = 1;
+			return CACHE_REFRESH;
+		}
+		return CACHE_FRESH;
+	}
+	if (now - entry->expires < cache->staleSeconds)
+	{
+		LOG_INFO("[!]%s found in cache but expired. Returning it while it is refreshed.\n", fileName);
+		statsInc(STAT_STALE_HITS);
+		if (!entry->refreshing)
+		{
+			entry->refreshing = 1;
+			return CACHE_REFRESH;
+		}
+		return CACHE_FRESH;
+	}
+	LOG_INFO("[!]%s found in cache but expired. Revalidating with server.\n", fileName);
+	return CACHE_EXPIRED;
+}
+
+/**
+ * Keeps serving the cached copy of fileName for ttl more seconds,
+ * after the server confirmed it is current. A copy evicted to the cold tier meanwhile is promoted.
+ * Returns 0 on success, -1 if the file is not in the cache
+ * */
+int cacheRefresh(struct Cache *cache, const char *fileName, int ttl)
+{
+	struct CacheEntry *entry = lookupEntry(cache, fileName);
+	if (entry == NULL)
+	{
+		return -1;
+	}
+	entry->expires = time(NULL) + ttl;
+	entry->hits = 0;
+	entry->refreshing = 0;
+	cache->version++;
+	return 0;
+}
+
+/**
+ * Drops fileName from RAM, e.g. after the server deleted it
+ * */
+void cacheRemove(struct Cache *cache, const char *fileName)
+{
+	struct CacheEntry **slot = findSlot(cache, fileName);
+	if (*slot != NULL)
+	{
+		removeEntry(cache, slot);
+		cache->version++;
+	}
+}
+
+/**
+ * Allows fileName to be queued for refresh again, e.g. after a refresh failed
+ * */
+void cacheEndRefresh(struct Cache *cache, const char *fileName)
+{
+	struct CacheEntry *entry = *findSlot(cache, fileName);
+	if (entry != NULL)
+	{
+		entry->refreshing = 0;
+	}
+}
+
+/**
+ *  Returns file from cache into buffer
+ *  fileName: fileContent
+ *  A compressed entry is copied as is if its codec is in codecs, and *codec is set to it;
+ *  otherwise buffer gets the NUL terminated text and *codec is CODEC_NONE.
+ *  Returns the length put in buffer, -1 if the file is not in the cache or does not fit
+ * */
+ssize_t getFromCache(struct Cache *cache, const char *fileName, char *buffer, size_t size, unsigned codecs, int *codec)
+{
+	struct CacheEntry *entry = *findSlot(cache, fileName);
+	ssize_t length;
+
+	*codec = CODEC_NONE;
+	if (entry == NULL)
+	{
+		return -1;
+	}
+	// if we have the correct file'
+	unlinkLru(entry);
+	pushFront(cache, entry);
+	if (entry->codec == CODEC_NONE)
+	{
+		length = snprintf(buffer, size, "%s: %s", entryName(entry), entryContent(entry));
+		return (size_t)length < size ? length : -1;
+	}
+	if (codecs & CODEC_BIT(entry->codec))
+	{
+		if (entry->contentLength > size)
+			return -1;
+		memcpy(buffer, entryContent(entry), entry->contentLength);
+		*codec = entry->codec;
+		return entry->contentLength;
+	}
+	if ((length = codecDecompress(entry->codec, entryContent(entry), entry->contentLength, buffer, size - 1)) < 0)
+	{
+		LOG_WARN("[-]Cached copy of '%s' does not decompress\n", fileName);
+		return -1;
+	}
+	buffer[length] = '\0';
+	return length;
+}
+
+/**
+ * Copies every file in RAM into a new array, least recently used first.
+ * Returns the number of files, -1 if memory could not be allocated
+ * */
+int cacheCopyEntries(struct Cache *cache, struct File **files)
+{
+	int n = 0;
+	if ((*files = calloc(cache->numEntries + 1, sizeof(struct File))) == NULL)
+	{
+		return -1;
+	}
+	for (struct CacheEntry *entry = cache->lru->prev; entry != cache->lru; entry = entry->prev, n++)
+	{
+		memcpy((*files)[n].fileName, entryName(entry), entry->nameLength);
+		memcpy((*files)[n].content, entryContent(entry), entry->contentLength);
+		(*files)[n].version = entry->version;
+		(*files)[n].expires = entry->expires;
+		(*files)[n].codec = entry->codec;
+		(*files)[n].contentLength = entry->contentLength;
+	}
+	return n;
+}
+
+/**
+ * Inserts files copied by cacheCopyEntries(), restoring their LRU order
+ * */
+void cacheRestore(struct Cache *cache, const struct File *files, int numFiles)
+{
+	for (int i = 0; i < numFiles; i++)
+	{
+		insertFile(cache, files[i].fileName, files[i].content, files[i].contentLength, files[i].codec, files[i].version,
+				   files[i].expires);
+	}
+}
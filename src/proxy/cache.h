@@ -0,0 +1,110 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+struct File
+{
+	char fileName[1024];
+	char content[1024]; // the content, or the whole "fileName: content" line compressed with codec
+	uint64_t version;	// as tagged by the server
+	int64_t expires;	// wall clock time after which the server must be asked again
+	uint32_t codec;
+	uint32_t contentLength;
+};
+
+// isInCache() results
+#define CACHE_MISS 0
+#define CACHE_FRESH 1
+#define CACHE_EXPIRED 2 // must be revalidated before it is served
+#define CACHE_REFRESH 3 // serve it, and refresh it in the background
+
+// hits within one TTL that make an entry worth refreshing before it expires
+#define CACHE_HOT_HITS 3
+
+/**
+ * RAM tier entry. Entries are chained per hash bucket and kept on an LRU list,
+ * most recently used right after the list head.
+ * Sized to the object: data holds the name and the content, each NUL terminated.
+ * When codec is not CODEC_NONE the content is the server's whole "name: content" line,
+ * compressed, and is served as is to clients that accept the codec.
+ * */
+struct CacheEntry
+{
+	struct CacheEntry *hashNext;
+	struct CacheEntry *prev;
+	struct CacheEntry *next;
+	uint64_t version;
+	time_t expires;
+	unsigned int hits; // since the entry was last fetched or revalidated
+	int refreshing;	   // a background refresh is queued or running
+	int codec;
+	size_t nameLength;
+	size_t contentLength;
+	char data[];
+};
+
+/**
+ * Cold tier entry: where a demoted object lives in the cold file.
+ * Entries are also listed per segment so a reclaimed segment can drop them.
+ * */
+struct ColdEntry
+{
+	char *fileName;
+	size_t offset; // of the record in the cold file
+	int segment;
+	struct ColdEntry *hashNext;
+	struct ColdEntry *segmentPrev;
+	struct ColdEntry *segmentNext;
+};
+
+/**
+ * Objects evicted from RAM, stored in a preallocated file that is mapped into memory.
+ * The file is split into fixed-size segments written as an append-only log;
+ * when the log wraps around the oldest segment is reclaimed with everything in it.
+ * */
+struct ColdTier
+{
+	int fd;
+	char *map;
+	size_t size;
+	int numSegments;
+	int current;	   // segment being appended to
+	uint64_t sequence; // of the current segment, orders segments when the file is scanned at startup
+	struct ColdEntry **buckets;
+	size_t numBuckets;
+	struct ColdEntry **segmentEntries;
+	int numEntries;
+};
+
+struct Cache
+{
+	struct CacheEntry **buckets;
+	size_t numBuckets;
+	struct CacheEntry *lru; // list head
+	int numEntries;
+	int capacity;
+	unsigned long version;	// bumped on every change, so snapshots are skipped when nothing changed
+	int staleSeconds;		// how long after expiry an entry may still be served while it is refreshed
+	int refreshAhead;		// seconds before expiry that hot entries are refreshed
+	struct ColdTier *cold; // NULL when there is no cold tier
+};
+
+int cacheInit(struct Cache *cache, int capacity);
+void addToCache(struct Cache *cache, const char *file, size_t length, int codec, const char *fileName, uint64_t version, int ttl);
+int isInCache(struct Cache *cache, const char *fileName, uint64_t *version);
+int cacheRefresh(struct Cache *cache, const char *fileName, int ttl);
+void cacheRemove(struct Cache *cache, const char *fileName);
+void cacheEndRefresh(struct Cache *cache, const char *fileName);
+ssize_t getFromCache(struct Cache *cache, const char *fileName, char *buffer, size_t size, unsigned codecs, int *codec);
+int cacheCopyEntries(struct Cache *cache, struct File **files);
+void cacheRestore(struct Cache *cache, const struct File *files, int numFiles);
+
+struct ColdTier *coldOpen(const char *path, size_t size);
+int coldStore(struct ColdTier *cold, const char *fileName, const char *content, size_t contentLength, int codec, uint64_t version, time_t expires);
+int coldTake(struct ColdTier *cold, const char *fileName, struct File *file);
+
+#endif
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE // qsort_r
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "hash.h"
+#include "log.h"
+#include "slab.h"
+#include "stats.h"
+
+#define COLD_SEGMENT_SIZE (1 << 20)
+#define COLD_SEGMENT_MAGIC 0x33444c4f43534c54ULL // "TLSCOLD3", change whenever struct ColdRecord changes
+#define COLD_RECORD_MAGIC 0x434f4c44			  // "COLD"
+
+struct SegmentHeader
+{
+	uint64_t magic;
+	uint64_t sequence;
+	uint64_t used; // bytes of records written after this header
+};
+
+/**
+ * Each record is this header, the name and the content, padded to 8 bytes.
+ * A record is never rewritten except to clear live when its object is promoted.
+ * */
+struct ColdRecord
+{
+	uint32_t magic;
+	uint16_t live;
+	uint16_t codec; // of the content
+	uint32_t nameLength;
+	uint32_t contentLength;
+	uint64_t version;
+	int64_t expires;
+	uint64_t checksum; // of codec, version, expiry, name and content
+};
+
+static uint64_t recordChecksum(const struct ColdRecord *record)
+{
+	uint64_t h = hashBytes(HASH_SEED, &record->codec, sizeof(record->codec));
+	h = hashBytes(h, &record->version, sizeof(record->version));
+	h = hashBytes(h, &record->expires, sizeof(record->expires));
+	return hashBytes(h, record + 1, record->nameLength + record->contentLength);
+}
+
+static size_t recordSize(size_t nameLength, size_t contentLength)
+{
+	return (sizeof(struct ColdRecord) + nameLength + contentLength + 7) & ~(size_t)7;
+}
+
+static struct SegmentHeader *segmentHeader(struct ColdTier *cold, int segment)
+{
+	return (struct SegmentHeader *)(cold->map + (size_t)segment * COLD_SEGMENT_SIZE);
+}
+
+static struct ColdEntry **findColdSlot(struct ColdTier *cold, const char *fileName)
+{
+	struct ColdEntry **slot = &cold->buckets[hashString(fileName) % cold->numBuckets];
+	while (*slot != NULL && strcmp((*slot)->fileName, fileName) != 0)
+	{
+		slot = &(*slot)->hashNext;
+	}
+	return slot;
+}
+
+/**
+ * Drops an index entry. The record stays on disk until its segment is reclaimed.
+ * */
+static void removeColdEntry(struct ColdTier *cold, struct ColdEntry **slot)
+{
+	struct ColdEntry *entry = *slot;
+	struct ColdRecord *record = (struct ColdRecord *)(cold->map + entry->offset);
+
+	*slot = entry->hashNext;
+	if (entry->segmentPrev != NULL)
+		entry->segmentPrev->segmentNext = entry->segmentNext;
+	else
+		cold->segmentEntries[entry->segment] = entry->segmentNext;
+	if (entry->segmentNext != NULL)
+		entry->segmentNext->segmentPrev = entry->segmentPrev;
+
+	cold->numEntries--;
+	statsGaugeAdd(GAUGE_COLD_ENTRIES, -1);
+	statsGaugeAdd(GAUGE_COLD_BYTES, -(int64_t)recordSize(record->nameLength, record->contentLength));
+	slabFree(entry->fileName, strlen(entry->fileName) + 1);
+	slabFree(entry, sizeof(struct ColdEntry));
+}
+
+/**
+ * Indexes the record at offset, replacing an older record for the same name
+ * */
+static void addColdEntry(struct ColdTier *cold, const char *fileName, size_t offset)
+{
+	struct ColdEntry **slot = findColdSlot(cold, fileName);
+	struct ColdRecord *record = (struct ColdRecord *)(cold->map + offset);
+	size_t nameLength = strlen(fileName) + 1;
+	struct ColdEntry *entry;
+
+	if (*slot != NULL)
+	{
+		((struct ColdRecord *)(cold->map + (*slot)->offset))->live = 0;
+		removeColdEntry(cold, slot);
+		slot = findColdSlot(cold, fileName);
+	}
+	if ((entry = slabAlloc(sizeof(struct ColdEntry))) == NULL || (entry->fileName = slabAlloc(nameLength)) == NULL)
+	{
+		slabFree(entry, sizeof(struct ColdEntry));
+		record->live = 0;
+		return;
+	}
+	memcpy(entry->fileName, fileName, nameLength);
+	entry->offset = offset;
+	entry->hashNext = NULL;
+	entry->segmentPrev = NULL;
+	entry->segment = offset / COLD_SEGMENT_SIZE;
+	entry->segmentNext = cold->segmentEntries[entry->segment];
+	if (entry->segmentNext != NULL)
+		entry->segmentNext->segmentPrev = entry;
+	cold->segmentEntries[entry->segment] = entry;
+	*slot = entry;
+
+	cold->numEntries++;
+	statsGaugeAdd(GAUGE_COLD_ENTRIES, 1);
+	statsGaugeAdd(GAUGE_COLD_BYTES, recordSize(record->nameLength, record->contentLength));
+}
+
+/**
+ * Empties a segment so the log can be written into it again.
+ * Everything still stored there leaves the cache for good.
+ * */
+static void reclaimSegment(struct ColdTier *cold, int segment)
+{
+	while (cold->segmentEntries[segment] != NULL)
+	{
+		struct ColdEntry *entry = cold->segmentEntries[segment];
+		removeColdEntry(cold, findColdSlot(cold, entry->fileName));
+		statsInc(STAT_CACHE_EVICTIONS);
+	}
+	struct SegmentHeader *header = segmentHeader(cold, segment);
+	header->magic = COLD_SEGMENT_MAGIC;
+	header->sequence = ++cold->sequence;
+	header->used = 0;
+}
+
+/**
+ * Returns 1 if the record at offset is intact
+ * */
+static int validRecord(struct ColdTier *cold, size_t offset, size_t limit)
+{
+	struct ColdRecord *record = (struct ColdRecord *)(cold->map + offset);
+	if (offset + sizeof(struct ColdRecord) > limit || record->magic != COLD_RECORD_MAGIC ||
+		offset + recordSize(record->nameLength, record->contentLength) > limit ||
+		record->nameLength >= sizeof(((struct File *)0)->fileName) ||
+		record->contentLength >= sizeof(((struct File *)0)->content))
+	{
+		return 0;
+	}
+	return recordChecksum(record) == record->checksum;
+}
+
+/**
+ * Appends a file to the log, reclaiming the oldest segment when the current one is full.
+ * Returns 0 on success, -1 if it cannot be stored
+ * */
+int coldStore(struct ColdTier *cold, const char *fileName, const char *content, size_t contentLength, int codec, uint64_t version,
+			  time_t expires)
+{
+	size_t nameLength = strlen(fileName);
+	size_t size = recordSize(nameLength, contentLength);
+	struct SegmentHeader *header = segmentHeader(cold, cold->current);
+
+	if (size > COLD_SEGMENT_SIZE - sizeof(struct SegmentHeader))
+	{
+		return -1;
+	}
+	if (sizeof(struct SegmentHeader) + header->used + size > COLD_SEGMENT_SIZE)
+	{
+		cold->current = (cold->current + 1) % cold->numSegments;
+		reclaimSegment(cold, cold->current);
+		header = segmentHeader(cold, cold->current);
+	}
+
+	size_t offset = (size_t)cold->current * COLD_SEGMENT_SIZE + sizeof(struct SegmentHeader) + header->used;
+	struct ColdRecord *record = (struct ColdRecord *)(cold->map + offset);
+	char *data = (char *)(record + 1);
+	memcpy(data, fileName, nameLength);
+	memcpy(data + nameLength, content, contentLength);
+	record->magic = COLD_RECORD_MAGIC;
+	record->live = 1;
+	record->codec = codec;
+	record->nameLength = nameLength;
+	record->contentLength = contentLength;
+	record->version = version;
+	record->expires = expires;
+	record->checksum = recordChecksum(record);
+	// only count the record as written once it is complete
+	header->used += size;
+
+	addColdEntry(cold, fileName, offset);
+	return 0;
+}
+
+/**
+ * Moves fileName out of the cold tier into file.
+ * Returns 0 if it was there and intact, -1 otherwise
+ * */
+int coldTake(struct ColdTier *cold, const char *fileName, struct File *file)
+{
+	struct ColdEntry **slot = findColdSlot(cold, fileName);
+	if (*slot == NULL)
+	{
+		return -1;
+	}
+
+	size_t offset = (*slot)->offset;
+	struct ColdRecord *record = (struct ColdRecord *)(cold->map + offset);
+	int ok = validRecord(cold, offset, (size_t)((*slot)->segment + 1) * COLD_SEGMENT_SIZE);
+	if (ok)
+	{
+		const char *data = (const char *)(record + 1);
+		memset(file, 0, sizeof(struct File));
+		memcpy(file->fileName, data, record->nameLength);
+		memcpy(file->content, data + record->nameLength, record->contentLength);
+		file->version = record->version;
+		file->expires = record->expires;
+		file->codec = record->codec;
+		file->contentLength = record->contentLength;
+	}
+	else
+	{
+		LOG_WARN("[-]Cold cache record for '%s' is corrupt, dropping it\n", fileName);
+	}
+	record->live = 0;
+	removeColdEntry(cold, slot);
+	return ok ? 0 : -1;
+}
+
+static int compareSequence(const void *a, const void *b, void *arg)
+{
+	struct ColdTier *cold = arg;
+	uint64_t x = segmentHeader(cold, *(const int *)a)->sequence;
+	uint64_t y = segmentHeader(cold, *(const int *)b)->sequence;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Rebuilds the index from the log, oldest segment first so newer records win
+ * Returns 0 on success, -1 if there is no memory to order the segments
+ * */
+static int scanSegments(struct ColdTier *cold)
+{
+	int *order = malloc(cold->numSegments * sizeof(int));
+	int numValid = 0;
+
+	if (order == NULL)
+	{
+		return -1;
+	}
+	for (int segment = 0; segment < cold->numSegments; segment++)
+	{
+		struct SegmentHeader *header = segmentHeader(cold, segment);
+		if (header->magic == COLD_SEGMENT_MAGIC && header->used <= COLD_SEGMENT_SIZE - sizeof(struct SegmentHeader))
+			order[numValid++] = segment;
+	}
+	qsort_r(order, numValid, sizeof(int), compareSequence, cold);
+
+	for (int i = 0; i < numValid; i++)
+	{
+		int segment = order[i];
+		struct SegmentHeader *header = segmentHeader(cold, segment);
+		size_t start = (size_t)segment * COLD_SEGMENT_SIZE + sizeof(struct SegmentHeader);
+		size_t end = start + header->used;
+		char name[sizeof(((struct File *)0)->fileName)];
+
+		for (size_t offset = start; offset < end;)
+		{
+			struct ColdRecord *record = (struct ColdRecord *)(cold->map + offset);
+			if (!validRecord(cold, offset, end))
+			{
+				// a torn write: nothing after it in this segment can be trusted
+				header->used = offset - start;
+				break;
+			}
+			if (record->live)
+			{
+				memcpy(name, record + 1, record->nameLength);
+				name[record->nameLength] = '\0';
+				addColdEntry(cold, name, offset);
+			}
+			offset += recordSize(record->nameLength, record->contentLength);
+		}
+		cold->current = segment;
+		cold->sequence = header->sequence;
+	}
+	if (numValid == 0)
+	{
+		cold->current = 0;
+		reclaimSegment(cold, 0);
+	}
+	free(order);
+	return 0;
+}
+
+/**
+ * Opens (creating and preallocating if needed) a cold tier of size bytes at path
+ * and indexes whatever a previous run left in it.
+ * Returns NULL if it cannot be used.
+ * */
+struct ColdTier *coldOpen(const char *path, size_t size)
+{
+	struct ColdTier *cold = calloc(1, sizeof(struct ColdTier));
+	struct stat st;
+
+	if (cold == NULL)
+	{
+		return NULL;
+	}
+	cold->numSegments = size / COLD_SEGMENT_SIZE;
+	cold->size = (size_t)cold->numSegments * COLD_SEGMENT_SIZE;
+	if (cold->numSegments < 2)
+	{
+		LOG_WARN("[-]Cold cache needs at least %d bytes\n", 2 * COLD_SEGMENT_SIZE);
+		free(cold);
+		return NULL;
+	}
+
+	if ((cold->fd = open(path, O_RDWR | O_CREAT, 0600)) < 0 || fstat(cold->fd, &st) != 0)
+	{
+		LOG_WARN("[-]Could not open cold cache '%s': %s\n", path, strerror(errno));
+		goto fail;
+	}
+	// a file of another size was laid out differently, start over
+	if (st.st_size != (off_t)cold->size && (ftruncate(cold->fd, 0) != 0 || posix_fallocate(cold->fd, 0, cold->size) != 0))
+	{
+		LOG_WARN("[-]Could not allocate %zu bytes for cold cache '%s'\n", cold->size, path);
+		goto fail;
+	}
+	if ((cold->map = mmap(NULL, cold->size, PROT_READ | PROT_WRITE, MAP_SHARED, cold->fd, 0)) == MAP_FAILED)
+	{
+		LOG_WARN("[-]Could not map cold cache '%s': %s\n", path, strerror(errno));
+		goto fail;
+	}
+
+	cold->numBuckets = cold->size / 1024;
+	cold->buckets = calloc(cold->numBuckets, sizeof(struct ColdEntry *));
+	cold->segmentEntries = calloc(cold->numSegments, sizeof(struct ColdEntry *));
+	if (cold->buckets == NULL || cold->segmentEntries == NULL)
+	{
+		munmap(cold->map, cold->size);
+		goto fail;
+	}
+	if (scanSegments(cold) != 0)
+	{
+		LOG_WARN("[-]Could not index cold cache '%s'\n", path);
+		munmap(cold->map, cold->size);
+		goto fail;
+	}
+	return cold;
+
+fail:
+	free(cold->buckets);
+	free(cold->segmentEntries);
+	if (cold->fd >= 0)
+		close(cold->fd);
+	free(cold);
+	return NULL;
+}
@@ -0,0 +1,472 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+#include "hash.h"
+
+#define CUCKOO_SLOTS 4
+#define CUCKOO_MAX_KICKS 500
+#define CUCKOO_LOAD 0.9 // fill at most this much of a new cuckoo filter
+#define XOR_MAX_ATTEMPTS 64
+
+/**
+ * Adds ASCII value in string to convert to integer value
+ * returns int value of the string
+ * */
+static int stringToInt(const char *object)
+{
+	long k = 0;
+	int i = 0;
+	while (object[i] != '\0')
+	{
+		k += object[i];
+		i++;
+	}
+	return k;
+}
+
+/**
+ *  Adds object to bloom filter using 5 different hash functions.
+ *
+ **/
+void hash(struct BloomFilter *bloomFilter, const char *object)
+{
+
+	int k = stringToInt(object);
+	bloomFilter->bloomFilter[k % (int)bloomFilter->size] = 1;
+	bloomFilter->bloomFilter[k % 677] = 1;
+	bloomFilter->bloomFilter[k % 367] = 1;
+	bloomFilter->bloomFilter[k % 9949] = 1;
+	bloomFilter->bloomFilter[k % 19793] = 1;
+}
+
+/**
+ *  Checks to see if the BloomFilter contains the fileName
+ *  If bloomFilter[index] corresponding to hash(fileName) is 0
+ *  Then the file is NOT in the bloom filter.
+ *
+ *
+ *  Returns 1 if the item is possibly contained, 0 if not
+ * */
+int isInBloomFilter(struct BloomFilter *bloomFilter, const char *fileName)
+{
+
+	int k = stringToInt(fileName);
+	if (bloomFilter->bloomFilter[k % (int)bloomFilter->size] == 0)
+		return 0;
+	if (bloomFilter->bloomFilter[k % 677] == 0)
+		return 0;
+	if (bloomFilter->bloomFilter[k % 367] == 0)
+		return 0;
+	if (bloomFilter->bloomFilter[k % 9949] == 0)
+		return 0;
+	if (bloomFilter->bloomFilter[k % 19793] == 0)
+		return 0;
+
+	// if all bits are 1, then the item is in the bloom filter.
+	return 1;
+}
+
+/**
+ * Scrambles all 64 bits, so any slice of the result can serve as an independent hash
+ * */
+static uint64_t mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint16_t cuckooFingerprint(uint64_t h)
+{
+	uint16_t fingerprint = h >> 48;
+	return fingerprint != 0 ? fingerprint : 1;
+}
+
+// the other bucket a fingerprint may live in, computable from either one
+static size_t cuckooAlternate(const struct CuckooFilter *cuckoo, size_t bucket, uint16_t fingerprint)
+{
+	return (bucket ^ mix(fingerprint)) & (cuckoo->numBuckets - 1);
+}
+
+static int cuckooPlace(struct CuckooFilter *cuckoo, size_t bucket, uint16_t fingerprint)
+{
+	uint16_t *slots = &cuckoo->slots[bucket * CUCKOO_SLOTS];
+	for (int i = 0; i < CUCKOO_SLOTS; i++)
+	{
+		if (slots[i] == 0)
+		{
+			slots[i] = fingerprint;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int cuckooFind(const struct CuckooFilter *cuckoo, size_t bucket, uint16_t fingerprint)
+{
+	const uint16_t *slots = &cuckoo->slots[bucket * CUCKOO_SLOTS];
+	for (int i = 0; i < CUCKOO_SLOTS; i++)
+	{
+		if (slots[i] == fingerprint)
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * Returns 0 on success, -1 if the filter is too full. A fingerprint may have
+ * been evicted by then, so the filter must be rebuilt after a failure.
+ * */
+static int cuckooInsert(struct CuckooFilter *cuckoo, uint64_t h)
+{
+	uint16_t fingerprint = cuckooFingerprint(h);
+	size_t bucket = h & (cuckoo->numBuckets - 1);
+	uint64_t random = h | 1;
+
+	if (cuckooPlace(cuckoo, bucket, fingerprint) ||
+		cuckooPlace(cuckoo, bucket = cuckooAlternate(cuckoo, bucket, fingerprint), fingerprint))
+	{
+		cuckoo->count++;
+		return 0;
+	}
+	for (int kick = 0; kick < CUCKOO_MAX_KICKS; kick++)
+	{
+		// xorshift picks which fingerprint to move
+		random ^= random << 13;
+		random ^= random >> 7;
+		random ^= random << 17;
+		uint16_t *slot = &cuckoo->slots[bucket * CUCKOO_SLOTS + random % CUCKOO_SLOTS];
+		uint16_t evicted = *slot;
+		*slot = fingerprint;
+		fingerprint = evicted;
+		bucket = cuckooAlternate(cuckoo, bucket, fingerprint);
+		if (cuckooPlace(cuckoo, bucket, fingerprint))
+		{
+			cuckoo->count++;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int cuckooBuild(struct CuckooFilter *cuckoo, char **names, size_t numNames, struct Arena *arena)
+{
+	size_t buckets = 16;
+	while (buckets * CUCKOO_SLOTS * CUCKOO_LOAD < numNames)
+		buckets *= 2;
+
+	// an unlucky set can still fail, the next size up will not
+	for (;; buckets *= 2)
+	{
+		memset(cuckoo, 0, sizeof(*cuckoo));
+		cuckoo->numBuckets = buckets;
+		if ((cuckoo->slots = arenaAlloc(arena, buckets * CUCKOO_SLOTS * sizeof(uint16_t))) == NULL)
+		{
+			return -1;
+		}
+		memset(cuckoo->slots, 0, buckets * CUCKOO_SLOTS * sizeof(uint16_t));
+		size_t i = 0;
+		while (i < numNames && cuckooInsert(cuckoo, hashString(names[i])) == 0)
+			i++;
+		if (i == numNames)
+		{
+			return 0;
+		}
+	}
+}
+
+static uint32_t reduce(uint32_t h, uint32_t n)
+{
+	return ((uint64_t)h * n) >> 32;
+}
+
+static uint64_t rotateLeft(uint64_t h, int bits)
+{
+	return (h << bits) | (h >> (64 - bits));
+}
+
+/**
+ * The three slots of a hash, one in each block
+ * */
+static void xorSlots(const struct XorFilter *xor, uint64_t h, uint32_t slots[3])
+{
+	slots[0] = reduce(h, xor->blockLength);
+	slots[1] = reduce(rotateLeft(h, 21), xor->blockLength) + xor->blockLength;
+	slots[2] = reduce(rotateLeft(h, 42), xor->blockLength) + 2 * xor->blockLength;
+}
+
+static uint16_t xorFingerprint(uint64_t h)
+{
+	return h ^ (h >> 32);
+}
+
+struct XorSlot
+{
+	uint64_t hashes; // xor of the hashes still mapped to the slot
+	uint32_t count;
+};
+
+struct XorPeeled
+{
+	uint64_t hash;
+	uint32_t slot;
+};
+
+/**
+ * Builds the filter by peeling: a slot only one remaining key maps to can be
+ * left to that key, so keys are removed one by one and then assigned in reverse.
+ * Retries with a new seed if the keys do not peel completely.
+ * */
+static int xorBuild(struct XorFilter *xor, char **names, size_t numNames, struct Arena *arena)
+{
+	size_t capacity = 32 + 1.23 * numNames;
+	uint64_t *keys = malloc((numNames + 1) * sizeof(uint64_t));
+	struct XorSlot *slots;
+	struct XorPeeled *queue, *stack;
+	size_t peeled = 0;
+	int result = -1;
+
+	xor->blockLength = capacity / 3;
+	capacity = 3 * (size_t)xor->blockLength;
+	slots = malloc(capacity * sizeof(struct XorSlot));
+	queue = malloc(capacity * sizeof(struct XorPeeled));
+	stack = malloc((numNames + 1) * sizeof(struct XorPeeled));
+	xor->fingerprints = arenaAlloc(arena, capacity * sizeof(uint16_t));
+	if (keys == NULL || slots == NULL || queue == NULL || stack == NULL || xor->fingerprints == NULL)
+	{
+		goto done;
+	}
+	for (size_t i = 0; i < numNames; i++)
+	{
+		keys[i] = hashString(names[i]);
+	}
+
+	for (int attempt = 0; attempt < XOR_MAX_ATTEMPTS; attempt++)
+	{
+		size_t queued = 0;
+		uint32_t at[3];
+
+		xor->seed = mix(HASH_SEED + attempt);
+		memset(slots, 0, capacity * sizeof(struct XorSlot));
+		for (size_t i = 0; i < numNames; i++)
+		{
+			uint64_t h = mix(keys[i] + xor->seed);
+			xorSlots(xor, h, at);
+			for (int j = 0; j < 3; j++)
+			{
+				slots[at[j]].hashes ^= h;
+				slots[at[j]].count++;
+			}
+		}
+		for (size_t i = 0; i < capacity; i++)
+		{
+			if (slots[i].count == 1)
+				queue[queued++] = (struct XorPeeled){.slot = i};
+		}
+		for (peeled = 0; queued > 0;)
+		{
+			uint32_t slot = queue[--queued].slot;
+			if (slots[slot].count != 1)
+				continue;
+			uint64_t h = slots[slot].hashes;
+			stack[peeled++] = (struct XorPeeled){.hash = h, .slot = slot};
+			xorSlots(xor, h, at);
+			for (int j = 0; j < 3; j++)
+			{
+				slots[at[j]].hashes ^= h;
+				if (--slots[at[j]].count == 1)
+					queue[queued++] = (struct XorPeeled){.slot = at[j]};
+			}
+		}
+		if (peeled == numNames)
+			break;
+	}
+	if (peeled != numNames)
+	{
+		goto done;
+	}
+
+	memset(xor->fingerprints, 0, capacity * sizeof(uint16_t));
+	while (peeled > 0)
+	{
+		struct XorPeeled *entry = &stack[--peeled];
+		uint32_t at[3];
+		xorSlots(xor, entry->hash, at);
+		// the entry's own slot is still 0, so this leaves the three slots xoring to the fingerprint
+		xor->fingerprints[entry->slot] = xorFingerprint(entry->hash) ^ xor->fingerprints[at[0]] ^
+										 xor->fingerprints[at[1]] ^ xor->fingerprints[at[2]];
+	}
+	result = 0;
+
+done:
+	free(keys);
+	free(slots);
+	free(queue);
+	free(stack);
+	return result;
+}
+
+/**
+ * Returns the FILTER_ constant for a name given on the command line, -1 if unknown
+ * */
+int filterParseKind(const char *name)
+{
+	if (strcmp(name, "bloom") == 0)
+		return FILTER_BLOOM;
+	if (strcmp(name, "cuckoo") == 0)
+		return FILTER_CUCKOO;
+	if (strcmp(name, "xor") == 0)
+		return FILTER_XOR;
+	return -1;
+}
+
+const char *filterKindName(int kind)
+{
+	static const char *names[] = {"bloom", "cuckoo", "xor"};
+	return kind >= FILTER_BLOOM && kind <= FILTER_XOR ? names[kind] : "unknown";
+}
+
+/**
+ * Builds a filter of the given kind holding names, which must be distinct.
+ * Memory comes from arena. Returns 0 on success, -1 on failure
+ * */
+int filterBuild(struct Filter *filter, int kind, char **names, size_t numNames, struct Arena *arena)
+{
+	memset(filter, 0, sizeof(*filter));
+	filter->kind = kind;
+	switch (kind)
+	{
+	case FILTER_BLOOM:
+		filter->bloom.size = BLOOM_FILTER_SIZE;
+		if ((filter->bloom.bloomFilter = arenaAlloc(arena, BLOOM_FILTER_SIZE)) == NULL)
+			return -1;
+		memset(filter->bloom.bloomFilter, 0, BLOOM_FILTER_SIZE);
+		for (size_t i = 0; i < numNames; i++)
+			hash(&filter->bloom, names[i]);
+		return 0;
+	case FILTER_CUCKOO:
+		return cuckooBuild(&filter->cuckoo, names, numNames, arena);
+	case FILTER_XOR:
+		return xorBuild(&filter->xor, names, numNames, arena);
+	}
+	return -1;
+}
+
+/**
+ * Makes filter an independent copy of from, with memory from arena.
+ * Returns 0 on success, -1 if memory could not be allocated
+ * */
+int filterCopy(struct Filter *filter, const struct Filter *from, struct Arena *arena)
+{
+	size_t size = filterBytes(from);
+	void *copy = arenaAlloc(arena, size);
+
+	if (copy == NULL)
+	{
+		return -1;
+	}
+	*filter = *from;
+	switch (from->kind)
+	{
+	case FILTER_BLOOM:
+		filter->bloom.bloomFilter = memcpy(copy, from->bloom.bloomFilter, size);
+		break;
+	case FILTER_CUCKOO:
+		filter->cuckoo.slots = memcpy(copy, from->cuckoo.slots, size);
+		break;
+	case FILTER_XOR:
+		filter->xor.fingerprints = memcpy(copy, from->xor.fingerprints, size);
+		break;
+	}
+	return 0;
+}
+
+/**
+ * Returns 1 if name may be in the filter, 0 if it is certainly not
+ * */
+int filterContains(const struct Filter *filter, const char *name)
+{
+	uint64_t h;
+	switch (filter->kind)
+	{
+	case FILTER_BLOOM:
+		return isInBloomFilter((struct BloomFilter *)&filter->bloom, name);
+	case FILTER_CUCKOO:
+	{
+		h = hashString(name);
+		uint16_t fingerprint = cuckooFingerprint(h);
+		size_t bucket = h & (filter->cuckoo.numBuckets - 1);
+		return cuckooFind(&filter->cuckoo, bucket, fingerprint) >= 0 ||
+			   cuckooFind(&filter->cuckoo, cuckooAlternate(&filter->cuckoo, bucket, fingerprint), fingerprint) >= 0;
+	}
+	case FILTER_XOR:
+	{
+		uint32_t at[3];
+		h = mix(hashString(name) + filter->xor.seed);
+		xorSlots(&filter->xor, h, at);
+		return xorFingerprint(h) == (filter->xor.fingerprints[at[0]] ^ filter->xor.fingerprints[at[1]] ^
+									 filter->xor.fingerprints[at[2]]);
+	}
+	}
+	return 1;
+}
+
+/**
+ * Adds name to a Bloom or cuckoo filter. Xor filters can only be rebuilt.
+ * Returns 0 on success, -1 if the filter has to be rebuilt instead
+ * */
+int filterInsert(struct Filter *filter, const char *name)
+{
+	switch (filter->kind)
+	{
+	case FILTER_BLOOM:
+		hash(&filter->bloom, name);
+		return 0;
+	case FILTER_CUCKOO:
+		return cuckooInsert(&filter->cuckoo, hashString(name));
+	}
+	return -1;
+}
+
+/**
+ * Removes a name that was inserted from a cuckoo filter.
+ * Returns 0 on success, -1 if the filter does not support removal
+ * */
+int filterRemove(struct Filter *filter, const char *name)
+{
+	if (filter->kind != FILTER_CUCKOO)
+	{
+		return -1;
+	}
+	uint64_t h = hashString(name);
+	uint16_t fingerprint = cuckooFingerprint(h);
+	size_t bucket = h & (filter->cuckoo.numBuckets - 1);
+	int slot = cuckooFind(&filter->cuckoo, bucket, fingerprint);
+	if (slot < 0)
+	{
+		bucket = cuckooAlternate(&filter->cuckoo, bucket, fingerprint);
+		if ((slot = cuckooFind(&filter->cuckoo, bucket, fingerprint)) < 0)
+			return -1;
+	}
+	filter->cuckoo.slots[bucket * CUCKOO_SLOTS + slot] = 0;
+	filter->cuckoo.count--;
+	return 0;
+}
+
+size_t filterBytes(const struct Filter *filter)
+{
+	switch (filter->kind)
+	{
+	case FILTER_BLOOM:
+		return filter->bloom.size;
+	case FILTER_CUCKOO:
+		return filter->cuckoo.numBuckets * CUCKOO_SLOTS * sizeof(uint16_t);
+	case FILTER_XOR:
+		return 3 * (size_t)filter->xor.blockLength * sizeof(uint16_t);
+	}
+	return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "arena.h"
+
+/**
+ * Membership filters that screen requests before the exact blacklist is consulted.
+ * A filter never misses a name it holds; a positive only means "maybe".
+ *   FILTER_BLOOM  the original fixed-size Bloom filter, cannot delete
+ *   FILTER_CUCKOO 16-bit fingerprints in 4-way buckets, supports delete
+ *   FILTER_XOR    16-bit xor filter, the smallest, but built once from the whole set
+ * */
+#define FILTER_BLOOM 0
+#define FILTER_CUCKOO 1
+#define FILTER_XOR 2
+
+// stringToInt() of a name that fits in 1024 bytes stays below this, so every index fits
+#define BLOOM_FILTER_SIZE (1 << 17)
+
+struct BloomFilter
+{
+	double size; // number of indices in the bloomfilter
+	u_int8_t *bloomFilter;
+};
+
+struct CuckooFilter
+{
+	uint16_t *slots; // CUCKOO_SLOTS per bucket, 0 is empty
+	size_t numBuckets; // power of two
+	size_t count;
+};
+
+struct XorFilter
+{
+	uint16_t *fingerprints; // three blocks of blockLength
+	uint32_t blockLength;
+	uint64_t seed;
+};
+
+struct Filter
+{
+	int kind;
+	struct BloomFilter bloom;
+	struct CuckooFilter cuckoo;
+	struct XorFilter xor;
+};
+
+void hash(struct BloomFilter *bloomFilter, const char *object);
+int isInBloomFilter(struct BloomFilter *bloomFilter, const char *fileName);
+
+int filterParseKind(const char *name);
+const char *filterKindName(int kind);
+int filterBuild(struct Filter *filter, int kind, char **names, size_t numNames, struct Arena *arena);
+int filterCopy(struct Filter *filter, const struct Filter *from, struct Arena *arena);
+int filterContains(const struct Filter *filter, const char *name);
+int filterInsert(struct Filter *filter, const char *name);
+int filterRemove(struct Filter *filter, const char *name);
+size_t filterBytes(const struct Filter *filter);
+
+#endif
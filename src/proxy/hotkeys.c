@@ -0,0 +1,79 @@
+#include <string.h>
+
+#include "hash.h"
+#include "hotkeys.h"
+
+void hotKeysInit(struct HotKeys *hot, int threshold, int keep, int window)
+{
+	memset(hot, 0, sizeof(*hot));
+	hot->threshold = threshold;
+	hot->keep = keep > 0 ? keep : 1;
+	hot->window = window > 0 ? window : 1;
+	hot->decayed = time(NULL);
+}
+
+/**
+ * Halves every count once per window that passed, so old popularity fades
+ * */
+static void decay(struct HotKeys *hot, time_t now)
+{
+	int windows = (now - hot->decayed) / hot->window;
+	if (windows <= 0)
+	{
+		return;
+	}
+	int shift = windows < 32 ? windows : 31;
+	for (int row = 0; row < HOT_SKETCH_DEPTH; row++)
+	{
+		for (int i = 0; i < HOT_SKETCH_WIDTH; i++)
+			hot->counts[row][i] >>= shift;
+	}
+	hot->decayed += (time_t)windows * hot->window;
+}
+
+/**
+ * Counts a request for fileName.
+ * Returns 1 if fileName is hot, 0 if not
+ * */
+int hotRecord(struct HotKeys *hot, const char *fileName)
+{
+	uint64_t h = hashString(fileName);
+	// each row indexes with its own combination of the two hash halves
+	uint32_t h1 = h, h2 = (h >> 32) | 1, estimate = UINT32_MAX;
+	time_t now = time(NULL);
+	struct HotKey *key = NULL, *victim = &hot->keys[0];
+
+	if (hot->threshold <= 0)
+	{
+		return 0;
+	}
+	decay(hot, now);
+	for (int row = 0; row < HOT_SKETCH_DEPTH; row++)
+	{
+		uint32_t *count = &hot->counts[row][(h1 + row * h2) & (HOT_SKETCH_WIDTH - 1)];
+		if (*count < UINT32_MAX)
+			(*count)++;
+		if (*count < estimate)
+			estimate = *count;
+	}
+
+	for (int i = 0; i < HOT_KEYS; i++)
+	{
+		if (hot->keys[i].hash == h && hot->keys[i].expires > now)
+			key = &hot->keys[i];
+		else if (hot->keys[i].expires < victim->expires)
+			victim = &hot->keys[i];
+	}
+	if (key == NULL && estimate >= (uint32_t)hot->threshold)
+	{
+		// the key closest to cooling down makes room
+		key = victim;
+		key->hash = h;
+		key->expires = 0;
+	}
+	if (key != NULL && estimate >= (uint32_t)(hot->threshold / hot->keep))
+	{
+		key->expires = now + hot->window;
+	}
+	return key != NULL && key->expires > now;
+}
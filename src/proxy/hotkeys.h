@@ -0,0 +1,38 @@
+#ifndef HOTKEYS_H
+#define HOTKEYS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define HOT_SKETCH_DEPTH 4
+#define HOT_SKETCH_WIDTH 1024 // power of two
+#define HOT_KEYS 32			  // files that can be hot at once
+
+/**
+ * Finds the files requested far more often than the rest.
+ * Requests are counted in a count-min sketch, which never undercounts and overcounts
+ * rarely, in fixed memory however many names there are. Counts are halved every window
+ * seconds. A file counted threshold times becomes hot, and stays hot as long as it is
+ * counted threshold / keep times per window, since it is then spread over keep proxies.
+ * Not thread safe.
+ * */
+struct HotKey
+{
+	uint64_t hash; // hashString() of the name
+	time_t expires;
+};
+
+struct HotKeys
+{
+	uint32_t counts[HOT_SKETCH_DEPTH][HOT_SKETCH_WIDTH];
+	struct HotKey keys[HOT_KEYS];
+	time_t decayed; // when counts were last halved
+	int threshold;	// 0 turns detection off
+	int keep;
+	int window;
+};
+
+void hotKeysInit(struct HotKeys *hot, int threshold, int keep, int window);
+int hotRecord(struct HotKeys *hot, const char *fileName);
+
+#endif
@@ -0,0 +1,425 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "hash.h"
+#include "log.h"
+#include "net.h"
+#include "origin.h"
+#include "protocol.h"
+#include "stats.h"
+
+#define ORIGIN_CONNECT_TIMEOUT 1000 // milliseconds for the TCP connect, so a server that is down is skipped quickly
+#define ORIGIN_IO_TIMEOUT 5000 // milliseconds to wait for the server
+#define ORIGIN_BACKOFF 2		// seconds a server that failed is skipped, doubled on every further failure
+#define ORIGIN_MAX_BACKOFF 30
+
+static void disconnect(struct Origin *origin)
+{
+	if (origin->ctx == NULL)
+		return;
+	tls_close(origin->ctx);
+	tls_free(origin->ctx);
+	close(origin->fd);
+	origin->ctx = NULL;
+}
+
+/**
+ * Opens the TLS connection to the server
+ * Returns 0 on success, -1 on failure
+ * */
+static int connectOrigin(struct Origin *origin)
+{
+	struct sockaddr_in server;
+
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(origin->port);
+	server.sin_addr.s_addr = inet_addr(origin->address);
+
+	if ((origin->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	{
+		LOG_WARN("[-]Could not create socket to server %s:%d: %s\n", origin->address, origin->port, strerror(errno));
+		return -1;
+	}
+	if (netConnectTimeout(origin->fd, &server, ORIGIN_CONNECT_TIMEOUT) != 0 ||
+		netSetTimeout(origin->fd, ORIGIN_IO_TIMEOUT) != 0 ||
+		(origin->ctx = tls_client()) == NULL)
+	{
+		LOG_WARN("[-]Could not connect to server %s:%d: %s\n", origin->address, origin->port, strerror(errno));
+		close(origin->fd);
+		return -1;
+	}
+	if (tls_configure(origin->ctx, origin->cfg) != 0 || tls_connect_socket(origin->ctx, origin->fd, "server") != 0)
+	{
+		LOG_WARN("[-]Could not set up TLS to server %s:%d: %s\n", origin->address, origin->port, tls_error(origin->ctx));
+		tls_free(origin->ctx);
+		origin->ctx = NULL;
+		close(origin->fd);
+		return -1;
+	}
+	if (netClientHandshake(origin->ctx, ORIGIN_IO_TIMEOUT) != 0)
+	{
+		LOG_WARN("[-]TLS handshake with server %s:%d failed: %s\n", origin->address, origin->port,
+				 tls_error(origin->ctx) != NULL ? tls_error(origin->ctx) : "timed out");
+		disconnect(origin);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Reads one line of at most size - 1 bytes, a byte at a time so nothing past it is consumed
+ * Returns 0 on success, -1 on failure
+ * */
+static int readLine(struct Origin *origin, char *line, size_t size)
+{
+	size_t length = 0;
+
+	do
+	{
+		if (length == size - 1 || netReadFull(origin->ctx, line + length, 1, ORIGIN_IO_TIMEOUT) != 0)
+			return -1;
+	} while (line[length++] != '\n');
+	line[length] = '\0';
+	return 0;
+}
+
+/**
+ * Sends the multi-get in request and reads one reply for each of the count files into batch,
+ * skipping the duplicates marked in sameAs.
+ * Returns 0 on success, -1 if the connection failed or a reply is corrupt
+ * */
+static int exchange(struct Origin *origin, const char *request, size_t requestLength,
+					struct OriginRequest **batch, const int *sameAs, int count)
+{
+	char line[64];
+	int replies;
+	size_t length;
+
+	if (netWriteFull(origin->ctx, request, requestLength, ORIGIN_IO_TIMEOUT) != 0 || readLine(origin, line, sizeof(line)) != 0 ||
+		sscanf(line, ORIGIN_MULTI_GET " %d", &replies) != 1)
+		return -1;
+	// the server answers every file it was asked for, sent or not
+	for (int i = 0; i < count; i++)
+		replies -= sameAs[i] == i;
+	if (replies != 0)
+		return -1;
+	for (int i = 0; i < count; i++)
+	{
+		if (sameAs[i] != i)
+			continue;
+		if (readLine(origin, line, sizeof(line)) != 0 || sscanf(line, "%zu", &length) != 1 ||
+			length >= batch[i]->size || netReadFull(origin->ctx, batch[i]->reply, length, ORIGIN_IO_TIMEOUT) != 0)
+			return -1;
+		batch[i]->reply[length] = '\0';
+		batch[i]->length = length;
+	}
+	return 0;
+}
+
+/**
+ * Updates the server's health after a batch: skips it for a while after a failure,
+ * longer each time it fails again
+ * */
+static void updateHealth(struct Origin *origin, int failed)
+{
+	int backoff = ORIGIN_BACKOFF;
+
+	pthread_mutex_lock(&origin->lock);
+	if (!failed)
+	{
+		origin->failures = 0;
+		origin->downUntil = 0;
+	}
+	else
+	{
+		for (int i = 0; i < origin->failures && backoff < ORIGIN_MAX_BACKOFF; i++)
+			backoff *= 2;
+		origin->failures++;
+		origin->downUntil = time(NULL) + (backoff < ORIGIN_MAX_BACKOFF ? backoff : ORIGIN_MAX_BACKOFF);
+	}
+	pthread_mutex_unlock(&origin->lock);
+}
+
+/**
+ * Fetches the count requests in batch with one multi-get. A kept open connection
+ * may have been closed by the server while idle, so a failure on one is retried once.
+ * Sets each request's length, -1 for all of them if the server could not be reached.
+ * */
+static void fetchBatch(struct Origin *origin, struct OriginRequest **batch, int count)
+{
+	char *request = origin->request;
+	int sameAs[ORIGIN_BATCH_MAX], unique = 0, requestLength, reused;
+
+	for (int i = 0; i < count; i++)
+	{
+		batch[i]->length = -1;
+		sameAs[i] = i;
+		for (int j = 0; j < i; j++)
+		{
+			if (sameAs[j] == j && batch[j]->version == batch[i]->version && strcmp(batch[j]->fileName, batch[i]->fileName) == 0)
+			{
+				sameAs[i] = j;
+				break;
+			}
+		}
+		unique += sameAs[i] == i;
+	}
+	requestLength = snprintf(request, ORIGIN_BATCH_REQUEST_SIZE, ORIGIN_MULTI_GET " %d %x\n", unique, origin->codecs);
+	for (int i = 0; i < count; i++)
+	{
+		if (sameAs[i] == i)
+			requestLength += snprintf(request + requestLength, ORIGIN_BATCH_REQUEST_SIZE - requestLength, "%" PRIx64 " %s\n",
+									  batch[i]->version, batch[i]->fileName);
+	}
+	// the NUL tells the server where the request ends
+	requestLength++;
+
+	statsInc(STAT_ORIGIN_BATCHES);
+	statsAdd(STAT_ORIGIN_BATCHED_FILES, count);
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		reused = origin->ctx != NULL;
+		if (!reused && connectOrigin(origin) != 0)
+			break;
+		if (exchange(origin, request, requestLength, batch, sameAs, count) == 0)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				if (sameAs[i] != i)
+				{
+					memcpy(batch[i]->reply, batch[sameAs[i]]->reply, batch[sameAs[i]]->length + 1);
+					batch[i]->length = batch[sameAs[i]]->length;
+				}
+			}
+			updateHealth(origin, 0);
+			return;
+		}
+		disconnect(origin);
+		for (int i = 0; i < count; i++)
+			batch[i]->length = -1;
+		if (!reused)
+			break;
+	}
+	LOG_WARN("[-]Could not fetch %d files from server %s:%d\n", count, origin->address, origin->port);
+	updateHealth(origin, 1);
+}
+
+/**
+ * Sends queued requests to the server in batches
+ * */
+static void *batchLoop(void *inputs)
+{
+	struct Origin *origin = (struct Origin *)inputs;
+	struct OriginRequest *batch[ORIGIN_BATCH_MAX];
+	struct timespec deadline;
+	int count;
+
+	pthread_mutex_lock(&origin->lock);
+	while (1)
+	{
+		while (origin->pending == NULL)
+			pthread_cond_wait(&origin->ready, &origin->lock);
+		// give other misses a moment to join, unless the batch is already full
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += origin->window * 1000L;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+		deadline.tv_nsec %= 1000000000L;
+		while (origin->numPending < origin->maxBatch &&
+			   pthread_cond_timedwait(&origin->ready, &origin->lock, &deadline) == 0)
+			;
+
+		for (count = 0; count < origin->maxBatch && origin->pending != NULL; count++)
+		{
+			batch[count] = origin->pending;
+			origin->pending = origin->pending->next;
+			origin->numPending--;
+		}
+		if (origin->pending == NULL)
+			origin->tail = &origin->pending;
+		pthread_mutex_unlock(&origin->lock);
+
+		fetchBatch(origin, batch, count);
+
+		pthread_mutex_lock(&origin->lock);
+		for (int i = 0; i < count; i++)
+			batch[i]->done = 1;
+		pthread_cond_broadcast(&origin->done);
+	}
+	return NULL;
+}
+
+/**
+ * Sets up origin to batch up to maxBatch requests, waiting window microseconds for them,
+ * and starts its thread.
+ * Returns 0 on success, -1 on failure
+ * */
+int originInit(struct Origin *origin, const char *address, int port, unsigned codecs, int maxBatch, int window)
+{
+	pthread_t thread;
+
+	memset(origin, 0, sizeof(*origin));
+	pthread_mutex_init(&origin->lock, NULL);
+	pthread_cond_init(&origin->ready, NULL);
+	pthread_cond_init(&origin->done, NULL);
+	origin->tail = &origin->pending;
+	origin->maxBatch = maxBatch < 1 ? 1 : maxBatch > ORIGIN_BATCH_MAX ? ORIGIN_BATCH_MAX : maxBatch;
+	origin->window = window;
+	snprintf(origin->address, sizeof(origin->address), "%s", address);
+	origin->port = port;
+	origin->codecs = codecs;
+	if ((origin->request = malloc(ORIGIN_BATCH_REQUEST_SIZE)) == NULL || (origin->cfg = tls_config_new()) == NULL || tls_config_set_ca_file(origin->cfg, "../../certificates/root.pem") != 0)
+	{
+		return -1;
+	}
+	tls_config_insecure_noverifyname(origin->cfg);
+	if (pthread_create(&thread, NULL, &batchLoop, origin) != 0)
+	{
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+/**
+ * Asks the server for fileName, only if it changed when version is the version we have cached
+ * (see protocol.h), and waits for the batch it goes out in.
+ * On success returns the length of the server's reply in buffer, which is NUL terminated.
+ * Returns -1 if the server could not be reached, or failed recently.
+ * */
+ssize_t originFetch(struct Origin *origin, const char *fileName, uint64_t version, char *buffer, size_t size)
+{
+	struct OriginRequest request = {.fileName = fileName, .version = version, .reply = buffer, .size = size};
+
+	// names are sent one per line
+	if (strchr(fileName, '\n') != NULL)
+	{
+		return -1;
+	}
+	pthread_mutex_lock(&origin->lock);
+	if (origin->downUntil > time(NULL))
+	{
+		pthread_mutex_unlock(&origin->lock);
+		return -1;
+	}
+	*origin->tail = &request;
+	origin->tail = &request.next;
+	origin->numPending++;
+	pthread_cond_signal(&origin->ready);
+	while (!request.done)
+		pthread_cond_wait(&origin->done, &origin->lock);
+	pthread_mutex_unlock(&origin->lock);
+	return request.length;
+}
+
+/**
+ * Parses a comma separated list of servers, each "address:port" or just "port" for one on
+ * 127.0.0.1, into addresses and ports, which have room for ORIGIN_MAX.
+ * Returns the number of servers, -1 if the list is not valid
+ * */
+int originsParse(const char *list, char addresses[][INET_ADDRSTRLEN], int *ports)
+{
+	struct in_addr parsed;
+	int count = 0;
+	const char *entry = list;
+
+	while (*entry != '\0')
+	{
+		const char *end = strchr(entry, ','), *colon;
+		size_t length = end != NULL ? (size_t)(end - entry) : strlen(entry);
+		char *portEnd;
+		long port;
+
+		if (count == ORIGIN_MAX || length == 0)
+			return -1;
+		colon = memchr(entry, ':', length);
+		if (colon == NULL)
+			snprintf(addresses[count], INET_ADDRSTRLEN, "127.0.0.1");
+		else if ((size_t)(colon - entry) >= INET_ADDRSTRLEN)
+			return -1;
+		else
+		{
+			memcpy(addresses[count], entry, colon - entry);
+			addresses[count][colon - entry] = '\0';
+		}
+		port = strtol(colon != NULL ? colon + 1 : entry, &portEnd, 10);
+		if (portEnd != entry + length || port <= 0 || port > 65535 || inet_pton(AF_INET, addresses[count], &parsed) != 1)
+			return -1;
+		ports[count++] = port;
+		entry += length + (end != NULL);
+	}
+	return count;
+}
+
+/**
+ * Sets up an Origin for each of the numOrigins servers
+ * Returns 0 on success, -1 on failure
+ * */
+int originsInit(struct Origins *origins, char addresses[][INET_ADDRSTRLEN], const int *ports, int numOrigins,
+				unsigned codecs, int maxBatch, int window)
+{
+	origins->numOrigins = 0;
+	for (int i = 0; i < numOrigins && i < ORIGIN_MAX; i++)
+	{
+		if (originInit(&origins->origins[i], addresses[i], ports[i], codecs, maxBatch, window) != 0)
+			return -1;
+		origins->numOrigins++;
+	}
+	return origins->numOrigins > 0 ? 0 : -1;
+}
+
+/**
+ * The rendezvous score of fileName on origin; FNV-1a alone barely mixes the last bytes in
+ * */
+static uint64_t originScore(const struct Origin *origin, uint64_t nameHash)
+{
+	uint64_t h = hashBytes(nameHash, origin->address, strlen(origin->address));
+	h = hashBytes(h, &origin->port, sizeof(origin->port));
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/**
+ * Fetches fileName like originFetch() from the server that owns it, and when that server
+ * cannot be reached from the next ones in the file's ranking, up to ORIGIN_REPLICAS in all.
+ * Returns the length of the reply in buffer, -1 if none of them could be reached
+ * */
+ssize_t originsFetch(struct Origins *origins, const char *fileName, uint64_t version, char *buffer, size_t size)
+{
+	uint64_t nameHash = hashString(fileName), scores[ORIGIN_MAX];
+	int ranks[ORIGIN_MAX];
+	ssize_t length = -1;
+
+	for (int i = 0; i < origins->numOrigins; i++)
+	{
+		// insertion sort, best score first
+		int j = i;
+		scores[i] = originScore(&origins->origins[i], nameHash);
+		for (; j > 0 && scores[ranks[j - 1]] < scores[i]; j--)
+			ranks[j] = ranks[j - 1];
+		ranks[j] = i;
+	}
+	for (int i = 0; i < origins->numOrigins && i < ORIGIN_REPLICAS && length < 0; i++)
+	{
+		struct Origin *origin = &origins->origins[ranks[i]];
+		if ((length = originFetch(origin, fileName, version, buffer, size)) >= 0 && i > 0)
+		{
+			LOG_INFO("[!]Fetched '%s' from server %s:%d in place of its owner\n", fileName, origin->address, origin->port);
+			statsInc(STAT_ORIGIN_FAILOVERS);
+		}
+	}
+	return length;
+}
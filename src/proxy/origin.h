@@ -0,0 +1,76 @@
+#ifndef ORIGIN_H
+#define ORIGIN_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <tls.h>
+
+#define ORIGIN_MAX 16	  // servers a proxy can be given
+#define ORIGIN_REPLICAS 2 // servers a file is asked from, in rendezvous order, before the fetch fails
+
+/**
+ * The proxy's connection to the server. Threads that miss in the cache queue their request
+ * and wait; one thread sends everything queued as a single multi-get (see protocol.h)
+ * over a connection it keeps open, and hands each waiter its reply.
+ * Requests that arrive while a batch is out form the next one, and a batch waits up to
+ * window microseconds for more requests unless it already holds maxBatch.
+ * Requests for the same file in one batch are sent once.
+ * A server that cannot be reached is skipped for a while, longer each time it fails again.
+ * */
+struct OriginRequest
+{
+	const char *fileName;
+	uint64_t version; // of the cached copy, 0 for none
+	char *reply;
+	size_t size;
+	ssize_t length; // of the reply, -1 if the server could not be reached
+	int done;
+	struct OriginRequest *next;
+};
+
+struct Origin
+{
+	pthread_mutex_t lock;
+	pthread_cond_t ready; // requests were queued
+	pthread_cond_t done;  // a batch was answered
+	struct OriginRequest *pending;
+	struct OriginRequest **tail;
+	int numPending;
+	int maxBatch;
+	int window; // microseconds
+	char address[INET_ADDRSTRLEN];
+	int port;
+	int failures;	  // in a row
+	time_t downUntil; // requests fail right away until then
+	unsigned codecs; // the proxy can store objects compressed with these
+	// only used by the batching thread
+	struct tls_config *cfg;
+	struct tls *ctx; // NULL while not connected
+	int fd;
+	char *request; // ORIGIN_BATCH_REQUEST_SIZE bytes
+};
+
+/**
+ * The servers a proxy fetches from. Files are spread over them by rendezvous hashing of the
+ * file name with each server's address, so adding a server only moves the files it takes over.
+ * Each server has an Origin of its own, and a fetch that its server cannot answer is
+ * retried on the next server in the file's ranking, up to ORIGIN_REPLICAS servers.
+ * */
+struct Origins
+{
+	struct Origin origins[ORIGIN_MAX];
+	int numOrigins;
+};
+
+int originInit(struct Origin *origin, const char *address, int port, unsigned codecs, int maxBatch, int window);
+ssize_t originFetch(struct Origin *origin, const char *fileName, uint64_t version, char *buffer, size_t size);
+int originsParse(const char *list, char addresses[][INET_ADDRSTRLEN], int *ports);
+int originsInit(struct Origins *origins, char addresses[][INET_ADDRSTRLEN], const int *ports, int numOrigins,
+				unsigned codecs, int maxBatch, int window);
+ssize_t originsFetch(struct Origins *origins, const char *fileName, uint64_t version, char *buffer, size_t size);
+
+#endif
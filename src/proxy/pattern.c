@@ -0,0 +1,174 @@
+#include <fnmatch.h>
+#include <string.h>
+
+#include "pattern.h"
+
+#define WILDCARDS "*?[\\"
+
+/**
+ * Returns 1 if the blacklist line is a pattern rather than a file name
+ * */
+int patternIsRule(const char *line)
+{
+	return strpbrk(line, WILDCARDS) != NULL;
+}
+
+static size_t edgeBucket(const struct PatternTrie *trie, uint32_t from, unsigned char c)
+{
+	uint64_t key = ((uint64_t)from << 8 | c) * 0x9e3779b97f4a7c15ULL;
+	return (key >> 32) & (trie->numBuckets - 1);
+}
+
+/**
+ * Returns the child of node from along c, 0 if there is none
+ * */
+static uint32_t findChild(const struct PatternTrie *trie, uint32_t from, unsigned char c)
+{
+	for (size_t i = edgeBucket(trie, from, c); trie->edges[i].to != 0; i = (i + 1) & (trie->numBuckets - 1))
+	{
+		if (trie->edges[i].from == from && trie->edges[i].c == c)
+		{
+			return trie->edges[i].to;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Sizes the trie for at most maxChars characters of keys
+ * Returns 0 on success, -1 if memory could not be allocated
+ * */
+static int trieInit(struct PatternTrie *trie, size_t maxChars, struct Arena *arena)
+{
+	// edge table at most half full
+	for (trie->numBuckets = 16; trie->numBuckets < 2 * maxChars; trie->numBuckets *= 2)
+		;
+	trie->numNodes = 1;
+	trie->nodes = arenaAlloc(arena, (maxChars + 1) * sizeof(struct PatternNode));
+	trie->edges = arenaAlloc(arena, trie->numBuckets * sizeof(struct PatternEdge));
+	if (trie->nodes == NULL || trie->edges == NULL)
+	{
+		return -1;
+	}
+	memset(trie->nodes, 0, (maxChars + 1) * sizeof(struct PatternNode));
+	memset(trie->edges, 0, trie->numBuckets * sizeof(struct PatternEdge));
+	return 0;
+}
+
+/**
+ * Adds the length characters of key, backwards if reverse is set.
+ * Returns the node the key ends at
+ * */
+static struct PatternNode *trieInsert(struct PatternTrie *trie, const char *key, size_t length, int reverse)
+{
+	uint32_t node = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		unsigned char c = reverse ? key[length - 1 - i] : key[i];
+		uint32_t child = findChild(trie, node, c);
+		if (child == 0)
+		{
+			size_t bucket = edgeBucket(trie, node, c);
+			while (trie->edges[bucket].to != 0)
+				bucket = (bucket + 1) & (trie->numBuckets - 1);
+			child = trie->numNodes++;
+			trie->edges[bucket] = (struct PatternEdge){.from = node, .to = child, .c = c};
+		}
+		node = child;
+	}
+	return &trie->nodes[node];
+}
+
+/**
+ * Compiles the patterns into set. Strings are referenced, not copied, and must
+ * outlive the set; everything else comes from arena.
+ * Returns 0 on success, -1 if memory could not be allocated
+ * */
+int patternCompile(struct PatternSet *set, char **patterns, int numPatterns, struct Arena *arena)
+{
+	size_t prefixChars = 0, suffixChars = 0;
+
+	memset(set, 0, sizeof(*set));
+	for (int i = 0; i < numPatterns; i++)
+	{
+		if (patterns[i][0] == '*' && !patternIsRule(patterns[i] + 1))
+			suffixChars += strlen(patterns[i]) - 1;
+		else
+			prefixChars += strcspn(patterns[i], WILDCARDS);
+	}
+	if (trieInit(&set->prefixes, prefixChars, arena) != 0 || trieInit(&set->suffixes, suffixChars, arena) != 0)
+	{
+		return -1;
+	}
+
+	for (int i = 0; i < numPatterns; i++)
+	{
+		const char *pattern = patterns[i];
+		if (pattern[0] == '*' && !patternIsRule(pattern + 1))
+		{
+			trieInsert(&set->suffixes, pattern + 1, strlen(pattern + 1), 1)->matchAll = 1;
+			continue;
+		}
+		size_t prefixLength = strcspn(pattern, WILDCARDS);
+		struct PatternNode *node = trieInsert(&set->prefixes, pattern, prefixLength, 0);
+		if (strcmp(pattern + prefixLength, "*") == 0)
+		{
+			node->matchAll = 1;
+			continue;
+		}
+		struct PatternGlob *glob = arenaAlloc(arena, sizeof(struct PatternGlob));
+		if (glob == NULL)
+		{
+			return -1;
+		}
+		glob->tail = pattern + prefixLength;
+		glob->next = node->globs;
+		node->globs = glob;
+	}
+	set->numPatterns = numPatterns;
+	return 0;
+}
+
+/**
+ * Returns 1 if fileName matches any pattern in the set, 0 if not
+ * */
+int patternMatch(const struct PatternSet *set, const char *fileName)
+{
+	size_t length = strlen(fileName);
+	uint32_t node = 0;
+
+	if (set->numPatterns == 0)
+	{
+		return 0;
+	}
+	// suffixes: walk the name backwards until the trie runs out
+	for (size_t i = length; !set->suffixes.nodes[node].matchAll; i--)
+	{
+		if (i == 0 || (node = findChild(&set->suffixes, node, fileName[i - 1])) == 0)
+			break;
+	}
+	if (set->suffixes.nodes[node].matchAll)
+	{
+		return 1;
+	}
+
+	// prefixes: every node passed is a prefix of the name, with rules for the rest of it
+	node = 0;
+	for (size_t i = 0;; i++)
+	{
+		const struct PatternNode *current = &set->prefixes.nodes[node];
+		if (current->matchAll)
+		{
+			return 1;
+		}
+		for (const struct PatternGlob *glob = current->globs; glob != NULL; glob = glob->next)
+		{
+			if (fnmatch(glob->tail, fileName + i, 0) == 0)
+				return 1;
+		}
+		if (i == length || (node = findChild(&set->prefixes, node, fileName[i])) == 0)
+		{
+			return 0;
+		}
+	}
+}
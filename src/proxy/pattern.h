@@ -0,0 +1,59 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+/**
+ * Blacklist rules with wildcards, in fnmatch() syntax. '*' also matches '/',
+ * so a directory name, a slash and a '*' cover the whole directory, and "*.exe" an extension.
+ *
+ * Rules are compiled into two tries whose edges live in one hash table each,
+ * so every character of a file name costs one lookup:
+ *   "*suffix" rules (no other wildcard) go into a trie of reversed suffixes,
+ *   everything else into a trie of the literal text before the first wildcard.
+ *   A node there is marked when a "prefix*" rule ends at it, and keeps the
+ *   remaining pattern of any other rule, checked with fnmatch() when reached.
+ * */
+
+struct PatternGlob
+{
+	const char *tail; // pattern left after the node's prefix, starts with a wildcard
+	struct PatternGlob *next;
+};
+
+struct PatternNode
+{
+	int matchAll; // a rule that is this node's prefix followed by '*' ends here
+	struct PatternGlob *globs;
+};
+
+struct PatternEdge
+{
+	uint32_t from;
+	uint32_t to; // 0 marks an empty bucket, the root is never a target
+	unsigned char c;
+};
+
+struct PatternTrie
+{
+	struct PatternNode *nodes; // nodes[0] is the root
+	uint32_t numNodes;
+	struct PatternEdge *edges;
+	size_t numBuckets; // power of two
+};
+
+struct PatternSet
+{
+	struct PatternTrie prefixes;
+	struct PatternTrie suffixes; // built from reversed suffixes
+	int numPatterns;
+};
+
+int patternIsRule(const char *line);
+int patternCompile(struct PatternSet *set, char **patterns, int numPatterns, struct Arena *arena);
+int patternMatch(const struct PatternSet *set, const char *fileName);
+
+#endif
@@ -0,0 +1,248 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "net.h"
+#include "peer.h"
+#include "protocol.h"
+
+#define PEER_CONNECT_TIMEOUT 500 // milliseconds, for the TCP connect and the TLS handshake
+#define PEER_IO_TIMEOUT 2000	 // milliseconds, shorter than the client's so it does not give up on us first
+#define PEER_BACKOFF 2			 // seconds a failed peer is skipped, doubled on every further failure
+#define PEER_MAX_BACKOFF 30
+
+/**
+ * Sets up a pool for each of the numPeers proxies listening on ports
+ * Returns 0 on success, -1 on failure
+ * */
+int peersInit(struct Peers *peers, const int *ports, int numPeers, int maxIdle)
+{
+	memset(peers, 0, sizeof(*peers));
+	// the certificate tells the other proxies that a forwarded request comes from a proxy
+	if ((peers->cfg = tls_config_new()) == NULL || tls_config_set_ca_file(peers->cfg, "../../certificates/root.pem") != 0 ||
+		tls_config_set_cert_file(peers->cfg, "../../certificates/root.pem") != 0 ||
+		tls_config_set_key_file(peers->cfg, "../../certificates/root/private/ca.key.pem") != 0 ||
+		(peers->pools = calloc(numPeers, sizeof(struct PeerPool))) == NULL)
+	{
+		return -1;
+	}
+	tls_config_insecure_noverifyname(peers->cfg);
+	for (int i = 0; i < numPeers; i++)
+	{
+		pthread_mutex_init(&peers->pools[i].lock, NULL);
+		peers->pools[i].port = ports[i];
+	}
+	peers->numPeers = numPeers;
+	peers->maxIdle = maxIdle;
+	return 0;
+}
+
+static void closePeer(struct PeerConnection *conn)
+{
+	tls_close(conn->ctx);
+	tls_free(conn->ctx);
+	close(conn->fd);
+	free(conn);
+}
+
+/**
+ * Connects to the peer on port and completes the TLS handshake
+ * Returns NULL on failure
+ * */
+static struct PeerConnection *openPeer(struct Peers *peers, int port)
+{
+	struct sockaddr_in peerAddr;
+	struct PeerConnection *conn = calloc(1, sizeof(struct PeerConnection));
+	if (conn == NULL)
+		return NULL;
+
+	memset(&peerAddr, 0, sizeof(peerAddr));
+	peerAddr.sin_family = AF_INET;
+	peerAddr.sin_port = htons(port);
+	peerAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+	if ((conn->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	{
+		free(conn);
+		return NULL;
+	}
+	if (netConnectTimeout(conn->fd, &peerAddr, PEER_CONNECT_TIMEOUT) != 0 ||
+		netSetTimeout(conn->fd, PEER_CONNECT_TIMEOUT) != 0 ||
+		(conn->ctx = tls_client()) == NULL ||
+		tls_configure(conn->ctx, peers->cfg) != 0 ||
+		tls_connect_socket(conn->ctx, conn->fd, "proxy") != 0 ||
+		netClientHandshake(conn->ctx, PEER_CONNECT_TIMEOUT) != 0 ||
+		netSetTimeout(conn->fd, PEER_IO_TIMEOUT) != 0)
+	{
+		tls_free(conn->ctx);
+		close(conn->fd);
+		free(conn);
+		return NULL;
+	}
+	return conn;
+}
+
+/**
+ * Takes an idle connection to the peer from its pool, or opens a new one.
+ * *reused tells the caller whether the connection had been used before.
+ * */
+static struct PeerConnection *acquirePeer(struct Peers *peers, int peer, int *reused)
+{
+	struct PeerPool *pool = &peers->pools[peer];
+	struct PeerConnection *conn;
+
+	pthread_mutex_lock(&pool->lock);
+	if ((conn = pool->idle) != NULL)
+	{
+		pool->idle = conn->next;
+		pool->numIdle--;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	*reused = conn != NULL;
+	if (conn == NULL)
+		conn = openPeer(peers, pool->port);
+	return conn;
+}
+
+/**
+ * Returns a healthy connection to the pool, closes it if the pool is full
+ * */
+static void releasePeer(struct Peers *peers, int peer, struct PeerConnection *conn)
+{
+	struct PeerPool *pool = &peers->pools[peer];
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->numIdle < peers->maxIdle)
+	{
+		conn->next = pool->idle;
+		pool->idle = conn;
+		pool->numIdle++;
+		conn = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (conn != NULL)
+		closePeer(conn);
+}
+
+/**
+ * Updates the peer's health after a request: skips it for a while after a failure,
+ * longer each time it fails again. Its idle connections most likely broke with it.
+ * */
+static void updateHealth(struct Peers *peers, int peer, int failed)
+{
+	struct PeerPool *pool = &peers->pools[peer];
+	struct PeerConnection *idle = NULL;
+	int backoff = PEER_BACKOFF;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!failed)
+	{
+		pool->failures = 0;
+		pool->downUntil = 0;
+	}
+	else
+	{
+		for (int i = 0; i < pool->failures && backoff < PEER_MAX_BACKOFF; i++)
+			backoff *= 2;
+		pool->failures++;
+		pool->downUntil = time(NULL) + (backoff < PEER_MAX_BACKOFF ? backoff : PEER_MAX_BACKOFF);
+		idle = pool->idle;
+		pool->idle = NULL;
+		pool->numIdle = 0;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	while (idle != NULL)
+	{
+		struct PeerConnection *next = idle->next;
+		closePeer(idle);
+		idle = next;
+	}
+}
+
+static int isHealthy(struct Peers *peers, int peer)
+{
+	struct PeerPool *pool = &peers->pools[peer];
+	int healthy;
+
+	pthread_mutex_lock(&pool->lock);
+	healthy = pool->downUntil <= time(NULL);
+	pthread_mutex_unlock(&pool->lock);
+	return healthy;
+}
+
+/**
+ * Sends one forwarded request and reads the framed reply into buffer
+ * Returns the reply length, -1 if the connection failed or the reply is corrupt
+ * */
+static ssize_t forward(struct PeerConnection *conn, const char *request, size_t requestLength, char *buffer, size_t size,
+					   int *codec, int *replicas)
+{
+	char header[CLIENT_FRAME_HEADER_SIZE];
+	size_t headerLength = 0, length;
+
+	if (netWriteFull(conn->ctx, request, requestLength, PEER_IO_TIMEOUT) != 0)
+		return -1;
+	// the header is short, read it a byte at a time so nothing past it is consumed
+	do
+	{
+		if (headerLength == sizeof(header) - 1 || netReadFull(conn->ctx, header + headerLength, 1, PEER_IO_TIMEOUT) != 0)
+			return -1;
+	} while (header[headerLength++] != '\n');
+	header[headerLength] = '\0';
+	*replicas = 1;
+	if (sscanf(header, "%d %zu %d", codec, &length, replicas) < 2 || length > size || netReadFull(conn->ctx, buffer, length, PEER_IO_TIMEOUT) != 0)
+		return -1;
+	return length;
+}
+
+/**
+ * Asks peer for fileName on behalf of a client that accepts codecs.
+ * A pooled connection may have been closed by the peer while idle,
+ * so a failure on a reused connection is retried once on a fresh one.
+ * Returns the length of the reply in buffer, with *codec set to how it is encoded
+ * and *replicas to the peer's hot file hint (see protocol.h),
+ * or -1 if the peer could not be reached or failed recently.
+ * */
+ssize_t peerForward(struct Peers *peers, int peer, const char *fileName, unsigned codecs, char *buffer, size_t size,
+					int *codec, int *replicas)
+{
+	char request[1024 + 32];
+	int requestLength = snprintf(request, sizeof(request), PEER_FORWARD " %x %s", codecs, fileName);
+	int reused = 0;
+	ssize_t length;
+
+	// the peer reads requests into 1024 bytes
+	if (requestLength >= 1024 || !isHealthy(peers, peer))
+	{
+		return -1;
+	}
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		struct PeerConnection *conn = acquirePeer(peers, peer, &reused);
+		if (conn == NULL)
+			break;
+		if ((length = forward(conn, request, requestLength, buffer, size, codec, replicas)) >= 0)
+		{
+			releasePeer(peers, peer, conn);
+			updateHealth(peers, peer, 0);
+			return length;
+		}
+		closePeer(conn);
+		if (!reused)
+			break;
+	}
+	updateHealth(peers, peer, 1);
+	return -1;
+}
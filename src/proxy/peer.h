@@ -0,0 +1,46 @@
+#ifndef PEER_H
+#define PEER_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include <tls.h>
+
+/**
+ * Connections from this proxy to the other proxies, used to forward requests
+ * for files this proxy does not own to the proxy that does (see protocol.h).
+ * Connections are kept open between requests, up to maxIdle per peer.
+ * A peer that fails to answer in time is skipped for a while.
+ * */
+struct PeerConnection
+{
+	struct tls *ctx;
+	int fd;
+	struct PeerConnection *next;
+};
+
+// idle connections to one peer
+struct PeerPool
+{
+	pthread_mutex_t lock;
+	struct PeerConnection *idle;
+	int numIdle;
+	int port;
+	int failures;	  // in a row
+	time_t downUntil; // requests fail right away until then
+};
+
+struct Peers
+{
+	struct tls_config *cfg;
+	struct PeerPool *pools; // indexed by proxy number
+	int numPeers;
+	int maxIdle;
+};
+
+int peersInit(struct Peers *peers, const int *ports, int numPeers, int maxIdle);
+ssize_t peerForward(struct Peers *peers, int peer, const char *fileName, unsigned codecs, char *buffer, size_t size,
+					int *codec, int *replicas);
+
+#endif
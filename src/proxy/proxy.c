@@ -5,15 +5,21 @@
 #include <err.h>
 #include <errno.h>
 #include <limits.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <sys/sendfile.h>
 #include <sys/prctl.h>
@@ -21,28 +27,152 @@
 #include <pthread.h>
 #include <fcntl.h>
 #include <math.h>
+#include <time.h>
 #include <tls.h> // for TLS
 
-#define PORT 9998
-struct File
+#include "arena.h"
+#include "cache.h"
+#include "compress.h"
+#include "epoch.h"
+#include "filter.h"
+#include "hash.h"
+#include "hotkeys.h"
+#include "log.h"
+#include "net.h"
+#include "origin.h"
+#include "pattern.h"
+#include "peer.h"
+#include "protocol.h"
+#include "ratelimit.h"
+#include "slab.h"
+#include "stats.h"
+#include "trace.h"
+
+#define PORT 9998 // the server's, when no other servers are given
+#define ADMIN_PORT 9980 // proxy N serves its metrics on ADMIN_PORT + N
+#define CACHE_CAPACITY 1024 // files held in RAM
+#define STALE_SECONDS 30 // how long after expiry an entry is still served while it is refreshed
+#define REFRESH_AHEAD 5	 // seconds before expiry that hot entries are refreshed
+#define REFRESH_QUEUE_SIZE 64
+#define NEGATIVE_CACHE_SIZE 1024
+#define NEGATIVE_CACHE_TTL 30 // seconds
+#define PEER_MAX_IDLE 4		  // idle connections kept open to each other proxy
+#define SNAPSHOT_INTERVAL 60	 // seconds between cache snapshots, 0 disables them
+#define SNAPSHOT_VERSION 3		 // bump whenever struct File or the layout below changes
+#define BLACKLIST_DIR "../../src/proxy"
+#define BLACKLIST_NAME "blacklisted.txt"
+#define BLACKLIST_PATH BLACKLIST_DIR "/" BLACKLIST_NAME
+// proxies that hold a file's blacklist entry and may serve it: its owner, the one that
+// stands in for it when it is down, and one more that shares the load while the file is hot
+#define BLACKLIST_REPLICAS 3
+#define HOT_THRESHOLD 100 // requests per HOT_WINDOW that make a file hot, 0 disables replication
+#define HOT_WINDOW 10	  // seconds
+#define LISTEN_BACKLOG 128
+#define HANDSHAKE_TIMEOUT 2000 // milliseconds a client has to complete the TLS handshake
+#define BATCH_SIZE 32	 // cache misses sent to the server in one request
+#define BATCH_WINDOW 200 // microseconds a batch waits for more misses
+#define MAX_CONNECTIONS 256	 // open client connections, more are closed right after accept
+#define MAX_QUEUED 64		 // requests waiting for the cache, more are answered busy
+#define REQUEST_DEADLINE 1000 // milliseconds a request may wait for the cache, below the peers' I/O timeout
+
+/**
+ * Bounds on the work a proxy takes on, so that overload is answered with CLIENT_BUSY_REPLY
+ * (see protocol.h) instead of with ever longer waits.
+ * */
+struct Limits
+{
+	atomic_int connections; // client connections open
+	atomic_int queued;		// requests waiting for lock
+	int maxConnections;
+	int maxQueued;
+	int deadline; // milliseconds
+};
+
+/**
+ * One version of this proxy's blacklist: the exact set of names, the membership filter built from it,
+ * and the wildcard patterns, which every proxy loads since they can match names owned by any of them.
+ * A published version is never changed. A reload builds a new one and swaps it in,
+ * see reloadBlacklist(). Everything but the struct itself lives in arena.
+ * */
+struct Blacklist
+{
+	struct Filter filter;
+	char **names; // open addressing hash set, numBuckets is a power of two
+	size_t numBuckets;
+	int numEntries;
+	uint64_t hash; // identifies the names the filter was built from
+	struct PatternSet patterns;
+	struct Arena arena;
+};
+
+/**
+ * Remembers names the server reported as missing.
+ * Direct mapped by hash: a new name simply replaces whatever occupied its slot,
+ * so the table never grows past size entries.
+ * */
+struct NegativeEntry
+{
+	char *fileName;
+	time_t expires;
+};
+
+struct NegativeCache
+{
+	struct NegativeEntry *entries;
+	int size;
+	int ttl; // seconds an entry stays valid
+};
+
+/**
+ * Files waiting to be refreshed in the background.
+ * Filled by handleClient(), drained by refreshLoop(), protected by lock.
+ * */
+struct RefreshRequest
 {
 	char fileName[1024];
-	char content[1024];
+	uint64_t version; // of the cached copy
 };
 
-struct BloomFilter
+struct RefreshQueue
 {
-	double size; // number of indices in the bloomfilter
-	u_int8_t *bloomFilter;
+	struct RefreshRequest *requests;
+	int size;
+	int head;
+	int count;
+	pthread_cond_t ready;
 };
 
 struct Proxy
 {
-	struct BloomFilter *bloomFilter;
-	char *blackListed[30000];
-	int numBlacklist;
-	struct File *cache;
-	int numCache;
+	_Atomic(struct Blacklist *) blacklist; // only dereferenced between epochEnter() and epochExit()
+	struct Cache cache;
+	struct NegativeCache negativeCache;
+	struct RefreshQueue refreshQueue;
+	unsigned codecs; // the server may send, and the cache keep, objects compressed with these
+	int filterKind;	 // FILTER_ kind of the blacklist's membership filter
+	char **proxyNames; // whichProxy() picks the owner of a file among these
+	struct Peers peers; // forwards requests for files owned by other proxies
+	struct HotKeys hotKeys; // protected by lock
+	struct Limits limits;
+	struct RateLimiter rateLimiter; // requests per second per client address
+	struct Origins origins;			// batch cache misses to the servers
+	struct Trace trace;				// requests recorded for tools/cachesim, when started with -T
+};
+
+/**
+ * On-disk cache snapshot, written as this header followed by
+ * numEntries struct File records and then bloomSize bytes of Bloom filter.
+ * Only the Bloom filter is kept; the other kinds are cheap to rebuild, and bloomSize is 0 then.
+ * */
+struct SnapshotHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t proxyNum;
+	uint64_t numEntries;
+	uint64_t bloomSize;
+	uint64_t blacklistHash;
+	uint64_t checksum; // hashBytes() of everything after the header
 };
 
 /**
@@ -85,29 +215,93 @@ int whichProxy(char **proxies, const char *fileName)
 }
 
 /**
- * Adds file to the cache
- * 
+ * Orders all proxies by their rendezvous score for fileName, best first.
+ * ranks[0] is whichProxy(); ranks[1] serves the file when ranks[0] is down.
+ * */
+void rankProxies(char **proxies, const char *fileName, int ranks[5])
+{
+	int score[5];
+	for (int i = 0; i < 5; i++)
+	{
+		score[i] = (stringToInt(fileName) + stringToInt(proxies[i])) % 17;
+		// insertion sort, ties keep the lower index first like whichProxy()
+		int j = i;
+		for (; j > 0 && score[ranks[j - 1]] < score[i]; j--)
+			ranks[j] = ranks[j - 1];
+		ranks[j] = i;
+	}
+}
+
+/**
+ * Returns 1 if proxyNum owns fileName or may serve it in the owner's place, 0 if not
  * */
-void addToCache(struct Proxy *proxy, const char *file, const char *fileName)
+int isReplica(char **proxies, const char *fileName, int proxyNum)
 {
-	strcpy(memset(proxy->cache[proxy->numCache].fileName, 0, sizeof(fileName) + 1), fileName);
-	strcpy(memset(proxy->cache[proxy->numCache].content, 0, sizeof(file) + 1), file + strlen(fileName) + 2);
-	proxy->numCache++;
+	int ranks[5];
+	rankProxies(proxies, fileName, ranks);
+	for (int i = 0; i < BLACKLIST_REPLICAS; i++)
+	{
+		if (ranks[i] == proxyNum)
+			return 1;
+	}
+	return 0;
+}
+
+static time_t nowSeconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+/**
+ * Records that the server does not have fileName
+ * */
+void addToNegativeCache(struct NegativeCache *negativeCache, const char *fileName)
+{
+	struct NegativeEntry *entry = &negativeCache->entries[hashString(fileName) % negativeCache->size];
+	if (entry->fileName != NULL)
+	{
+		slabFree(entry->fileName, strlen(entry->fileName) + 1);
+	}
+	if ((entry->fileName = slabAlloc(strlen(fileName) + 1)) == NULL)
+	{
+		return;
+	}
+	strcpy(entry->fileName, fileName);
+	entry->expires = nowSeconds() + negativeCache->ttl;
+}
+
+/**
+ * Returns 1 if the server reported fileName missing less than ttl seconds ago
+ * Returns 0 otherwise
+ * */
+int isInNegativeCache(struct NegativeCache *negativeCache, const char *fileName)
+{
+	struct NegativeEntry *entry = &negativeCache->entries[hashString(fileName) % negativeCache->size];
+	if (entry->fileName == NULL || strcmp(entry->fileName, fileName) != 0)
+	{
+		return 0;
+	}
+	if (entry->expires <= nowSeconds())
+	{
+		slabFree(entry->fileName, strlen(entry->fileName) + 1);
+		entry->fileName = NULL;
+		return 0;
+	}
+	return 1;
 }
 
 /**
- * Checks to see if the fileName is in the proxy's cache
- * Returns 1 if the file is in the cache
- * Returns 0 if the file is not in cacne
+ *  Checks to see if the file is in the black list.
+ *  Use this function after filterContains() returns 1 to rule out a false positive.
  * */
-int isInCache(struct Proxy *proxy, const char *fileName)
+int isInBlackList(struct Blacklist *blacklist, const char fileName[])
 {
-	int i;
-	for (i = 0; i < proxy->numCache; i++)
+	size_t mask = blacklist->numBuckets - 1;
+	for (size_t i = hashString(fileName) & mask; blacklist->names[i] != NULL; i = (i + 1) & mask)
 	{
-		// printf("%s", proxy->cache[i].fileName);
-		printf("[!]%s found in cache. Returning without contacting server.\n", fileName);
-		if (strcmp(proxy->cache[i].fileName, fileName) == 0)
+		if (strcmp(blacklist->names[i], fileName) == 0)
 		{
 			return 1;
 		}
@@ -115,87 +309,267 @@ int isInCache(struct Proxy *proxy, const char *fileName)
 	return 0;
 }
 
+static void freeBlacklist(struct Blacklist *blacklist)
+{
+	arenaFree(&blacklist->arena);
+	free(blacklist);
+}
+
 /**
- *  Returns file from cache into buffer
- *  fileName: fileContent
+ * Appends a copy of string to a growing array
+ * Returns 0 on success, -1 if memory could not be allocated
  * */
-void getFromCache(struct Proxy *proxy, const char *fileName, char *buffer)
+static int appendLine(struct Arena *arena, char ***lines, size_t *numLines, size_t *capacity, const char *string)
 {
-	int i;
-	for (i = 0; i < proxy->numCache; i++)
+	char **grown;
+	if (*numLines == *capacity)
 	{
-		if (strcmp(proxy->cache[i].fileName, fileName) == 0)
+		*capacity = *capacity == 0 ? 64 : 2 * *capacity;
+		if ((grown = realloc(*lines, *capacity * sizeof(char *))) == NULL)
 		{
-			// if we have the correct file'
-			strcpy(buffer, proxy->cache[i].fileName);
-			strcat(buffer, ": ");
-			strcat(buffer, proxy->cache[i].content);
+			return -1;
 		}
+		*lines = grown;
 	}
+	return ((*lines)[(*numLines)++] = arenaStrdup(arena, string)) != NULL ? 0 : -1;
 }
+
 /**
- *  Adds object to bloom filter using 5 different hash functions.
- * 
- **/
-void hash(struct BloomFilter *bloomFilter, const char *object)
-{
-
-	int k = stringToInt(object);
-	bloomFilter->bloomFilter[k % (int)bloomFilter->size] = 1;
-	bloomFilter->bloomFilter[k % 677] = 1;
-	bloomFilter->bloomFilter[k % 367] = 1;
-	bloomFilter->bloomFilter[k % 9949] = 1;
-	bloomFilter->bloomFilter[k % 19793] = 1;
+ * Reads the names in the blacklist file that proxyNum owns or stands in for (see isReplica()),
+ * and every pattern.
+ * The membership filter is left empty, see buildFilter().
+ * Returns NULL if the file cannot be read or memory runs out
+ * */
+struct Blacklist *readBlacklist(char **proxyNames, int proxyNum)
+{
+	struct Blacklist *blacklist = calloc(1, sizeof(struct Blacklist));
+	char **names = NULL, **patterns = NULL, line[1024];
+	size_t numNames = 0, capacity = 0, numPatterns = 0, patternCapacity = 0;
+	int ok = 1;
+	FILE *fp;
+
+	if (blacklist == NULL || (fp = fopen(BLACKLIST_PATH, "r")) == NULL)
+	{
+		free(blacklist);
+		return NULL;
+	}
+	blacklist->hash = HASH_SEED;
+	while (ok && fgets(line, sizeof(line), fp) != NULL)
+	{
+		line[strcspn(line, "\n")] = '\0'; // eat the newline fgets() stores
+		if (line[0] == '\0')
+		{
+			continue;
+		}
+		if (patternIsRule(line))
+		{
+			LOG_DEBUG("\tADDING: pattern '%s' to PROXY %d blacklist\n", line, proxyNum);
+			ok = appendLine(&blacklist->arena, &patterns, &numPatterns, &patternCapacity, line) == 0;
+			continue;
+		}
+		// add file to blacklist if this proxy may serve it
+		if (!isReplica(proxyNames, line, proxyNum))
+		{
+			continue;
+		}
+		LOG_DEBUG("\tADDING: '%s' to PROXY %d blacklist\n", line, proxyNum);
+		ok = appendLine(&blacklist->arena, &names, &numNames, &capacity, line) == 0;
+		blacklist->hash = hashBytes(blacklist->hash, line, strlen(line) + 1);
+	}
+	fclose(fp);
+
+	// at most half full, so lookups stay short
+	for (blacklist->numBuckets = 16; blacklist->numBuckets < 2 * numNames; blacklist->numBuckets *= 2)
+		;
+	if (!ok || (blacklist->names = arenaAlloc(&blacklist->arena, blacklist->numBuckets * sizeof(char *))) == NULL ||
+		patternCompile(&blacklist->patterns, patterns, numPatterns, &blacklist->arena) != 0)
+	{
+		free(names);
+		free(patterns);
+		freeBlacklist(blacklist);
+		return NULL;
+	}
+	free(patterns);
+	memset(blacklist->names, 0, blacklist->numBuckets * sizeof(char *));
+	for (size_t n = 0; n < numNames; n++)
+	{
+		if (!isInBlackList(blacklist, names[n]))
+		{
+			size_t mask = blacklist->numBuckets - 1, i = hashString(names[n]) & mask;
+			while (blacklist->names[i] != NULL)
+				i = (i + 1) & mask;
+			blacklist->names[i] = names[n];
+			blacklist->numEntries++;
+		}
+	}
+	free(names);
+	return blacklist;
 }
 
 /**
- *  Checks to see if the BloomFilter contains the fileName
- *  If bloomFilter[index] corresponding to hash(fileName) is 0
- *  Then the file is NOT in the bloom filter.
- *  
- * 
- *  Returns 1 if the item is possibly contained, 0 if not
+ * Builds the membership filter of the given FILTER_ kind from the blacklisted names
+ * Returns 0 on success, -1 if memory could not be allocated
  * */
-int isInBloomFilter(struct BloomFilter *bloomFilter, const char *fileName)
+int buildFilter(struct Blacklist *blacklist, int kind)
 {
+	char **names = malloc((blacklist->numEntries + 1) * sizeof(char *));
+	size_t numNames = 0;
+	int result;
 
-	int k = stringToInt(fileName);
-	if (bloomFilter->bloomFilter[k % (int)bloomFilter->size] == 0)
-		return 0;
-	if (bloomFilter->bloomFilter[k % 677] == 0)
-		return 0;
-	if (bloomFilter->bloomFilter[k % 367] == 0)
-		return 0;
-	if (bloomFilter->bloomFilter[k % 9949] == 0)
-		return 0;
-	if (bloomFilter->bloomFilter[k % 19793] == 0)
-		return 0;
-
-	// if all bits are 1, then the item is in the bloom filter.
-	return 1;
+	if (names == NULL)
+	{
+		return -1;
+	}
+	for (size_t i = 0; i < blacklist->numBuckets; i++)
+	{
+		if (blacklist->names[i] != NULL)
+		{
+			names[numNames++] = blacklist->names[i];
+		}
+	}
+	result = filterBuild(&blacklist->filter, kind, names, numNames, &blacklist->arena);
+	free(names);
+	return result;
 }
 
 /**
- *  Checks to see if the file is in the black list.
- *  Use this function after isInBloomFilter() returns 0.
+ * Builds a cuckoo filter for blacklist by copying the one of old and applying
+ * the difference, which is cheaper than rehashing every name when few changed.
+ * Returns 0 on success, -1 if the copy filled up and the filter has to be built from scratch
  * */
-int isInBlackList(struct Proxy *proxy, const char fileName[])
+static int updateFilter(struct Blacklist *blacklist, struct Blacklist *old)
 {
-	int i;
-	for (i = 0; i < proxy->numBlacklist; i++)
+	if (filterCopy(&blacklist->filter, &old->filter, &blacklist->arena) != 0)
 	{
-		if (strcmp(proxy->blackListed[i], fileName) == 0)
+		return -1;
+	}
+	for (size_t i = 0; i < old->numBuckets; i++)
+	{
+		if (old->names[i] != NULL && !isInBlackList(blacklist, old->names[i]))
 		{
-			return 1;
+			filterRemove(&blacklist->filter, old->names[i]);
 		}
 	}
+	for (size_t i = 0; i < blacklist->numBuckets; i++)
+	{
+		if (blacklist->names[i] != NULL && !isInBlackList(old, blacklist->names[i]) &&
+			filterInsert(&blacklist->filter, blacklist->names[i]) != 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Rereads the blacklist and swaps it in. Requests being checked against the old version
+ * finish with it, and it is freed once no request can still be using it.
+ * Only one thread may reload. Returns 0 on success, -1 if the old version stays in place
+ * */
+int reloadBlacklist(struct Proxy *proxy, char **proxyNames, int proxyNum)
+{
+	struct Blacklist *blacklist = readBlacklist(proxyNames, proxyNum);
+	if (blacklist == NULL)
+	{
+		return -1;
+	}
+	// only the reloading thread swaps the blacklist, so the current one cannot be freed under us
+	struct Blacklist *current = atomic_load(&proxy->blacklist);
+	if ((proxy->filterKind != FILTER_CUCKOO || updateFilter(blacklist, current) != 0) &&
+		buildFilter(blacklist, proxy->filterKind) != 0)
+	{
+		freeBlacklist(blacklist);
+		return -1;
+	}
+	struct Blacklist *old = atomic_exchange(&proxy->blacklist, blacklist);
+	epochSynchronize();
+	statsGaugeAdd(GAUGE_BLACKLIST_ENTRIES, blacklist->numEntries - old->numEntries);
+	statsGaugeAdd(GAUGE_BLACKLIST_PATTERNS, blacklist->patterns.numPatterns - old->patterns.numPatterns);
+	statsGaugeAdd(GAUGE_BLACKLIST_FILTER_BYTES, (int64_t)filterBytes(&blacklist->filter) - (int64_t)filterBytes(&old->filter));
+	statsInc(STAT_BLACKLIST_RELOADS);
+	freeBlacklist(old);
 	return 0;
 }
 
+struct blacklist_data
+{
+	struct Proxy *proxy;
+	int proxyNum;
+	char **proxyNames;
+};
+
+/**
+ * Reloads the blacklist whenever its file is written or replaced, or on SIGHUP.
+ * SIGHUP is blocked in every thread, so only this one ever takes it.
+ * */
+void *blacklistLoop(void *inputs)
+{
+	struct blacklist_data *blacklist_data = (struct blacklist_data *)inputs;
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct signalfd_siginfo info;
+	struct pollfd fds[2];
+	sigset_t hangup;
+	ssize_t length;
+
+	sigemptyset(&hangup);
+	sigaddset(&hangup, SIGHUP);
+	fds[0].fd = signalfd(-1, &hangup, SFD_CLOEXEC);
+	// watch the directory: editors often replace the file instead of writing it
+	if ((fds[1].fd = inotify_init1(IN_CLOEXEC)) >= 0 &&
+		inotify_add_watch(fds[1].fd, BLACKLIST_DIR, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		close(fds[1].fd);
+		fds[1].fd = -1;
+	}
+	if (fds[1].fd < 0)
+	{
+		LOG_WARN("[-]Proxy %d: Cannot watch '%s': %s. Send SIGHUP to reload the blacklist.\n", blacklist_data->proxyNum, BLACKLIST_PATH, strerror(errno));
+	}
+	fds[0].events = fds[1].events = POLLIN;
+
+	while (1)
+	{
+		int reload = 0;
+		if (poll(fds, 2, -1) < 0)
+		{
+			continue;
+		}
+		if ((fds[0].revents & POLLIN) && read(fds[0].fd, &info, sizeof(info)) == sizeof(info))
+		{
+			reload = 1;
+		}
+		if ((fds[1].revents & POLLIN) && (length = read(fds[1].fd, events, sizeof(events))) > 0)
+		{
+			const struct inotify_event *event;
+			for (char *p = events; p < events + length; p += sizeof(struct inotify_event) + event->len)
+			{
+				event = (const struct inotify_event *)p;
+				reload |= event->len > 0 && strcmp(event->name, BLACKLIST_NAME) == 0;
+			}
+		}
+		if (!reload)
+		{
+			continue;
+		}
+		uint64_t reloadStart = statsNowUsec();
+		if (reloadBlacklist(blacklist_data->proxy, blacklist_data->proxyNames, blacklist_data->proxyNum) == 0)
+		{
+			struct Blacklist *blacklist = atomic_load(&blacklist_data->proxy->blacklist);
+			LOG_INFO("[+]Proxy %d: Reloaded blacklist, %d entries and %d patterns in %.2f ms\n", blacklist_data->proxyNum,
+					 blacklist->numEntries, blacklist->patterns.numPatterns, (statsNowUsec() - reloadStart) / 1000.0);
+		}
+		else
+		{
+			LOG_WARN("[-]Proxy %d: Could not reload '%s'. Keeping the current blacklist.\n", blacklist_data->proxyNum, BLACKLIST_PATH);
+		}
+	}
+	return NULL;
+}
+
 static void usage()
 {
 	extern char *__progname;
-	fprintf(stderr, "usage: %s\n", __progname);
+	fprintf(stderr, "usage: %s [-l error|warn|info|debug] [-n negative-entries] [-N negative-ttl] [-c cache-entries] [-d cold-megabytes] [-w stale-seconds] [-R refresh-ahead] [-s snapshot-dir] [-S snapshot-interval] [-F bloom|cuckoo|xor] [-H hot-threshold] [-m max-connections] [-q max-queued] [-D deadline-ms] [-r rate] [-b burst] [-B batch-size] [-W batch-window-us] [-O [address:]port,...] [-T] [-z]\n", __progname);
 	exit(1);
 }
 
@@ -210,182 +584,669 @@ struct thread_data
 	struct Proxy *proxy;
 	int newSocket;
 	struct sockaddr_in newAddr;
-	struct sockaddr_in server;
-	int serverSock;
-	int serverPort;
 	struct tls *cctx;
-	struct tls *pctx;
-	struct tls_config *pcfg;
 	int proxyNum;
 };
 
 pthread_mutex_t lock;
 
-void *handleClient(void *inputs)
+/**
+ * Returns 1 if the client of cctx, after its handshake, is another proxy, 0 if not.
+ * Proxies present the self-signed root certificate the proxies serve with, and only a holder
+ * of its key can present a verified certificate whose issuer is its own subject.
+ * */
+static int isPeerConnection(struct tls *cctx)
+{
+	const char *subject, *issuer;
+
+	if (tls_peer_cert_provided(cctx) != 1 || (subject = tls_peer_cert_subject(cctx)) == NULL ||
+		(issuer = tls_peer_cert_issuer(cctx)) == NULL)
+	{
+		return 0;
+	}
+	return strcmp(subject, issuer) == 0;
+}
+
+/**
+ * Requests fileName from the server that owns it, only if it changed when version is the version
+ * we have cached (see protocol.h). The request goes out in a batch with other threads' misses,
+ * see originsFetch().
+ * On success returns the length of the server's reply in buffer, which is NUL terminated.
+ * Returns -1 if the server could not be reached.
+ * */
+ssize_t fetchFromServer(struct thread_data *thread_data, const char *fileName, uint64_t version, char *buffer, size_t size)
+{
+	uint64_t fetchStart = statsNowUsec();
+	ssize_t replyLength = originsFetch(&thread_data->proxy->origins, fileName, version, buffer, size);
+
+	if (replyLength < 0)
+	{
+		LOG_WARN("[-]Proxy %d: Could not fetch '%s' from server\n", thread_data->proxyNum, fileName);
+		statsInc(STAT_ORIGIN_ERRORS);
+		return -1;
+	}
+	statsObserveLatency(statsNowUsec() - fetchStart);
+	LOG_DEBUG("[+]Proxy %d: Received %zd bytes from server.\n", thread_data->proxyNum, replyLength);
+	return replyLength;
+}
+
+/**
+ * Updates the cache, or the negative cache, with the server's reply to a request for fileName.
+ * fetched is what fetchFromServer() returned. Must be called with lock held.
+ * Returns the reply's status, ORIGIN_INVALID if there is no usable reply
+ * */
+enum OriginStatus storeOriginReply(struct Proxy *proxy, int proxyNum, const char *fileName, ssize_t fetched, const char *originReply)
+{
+	struct OriginReply reply;
+
+	if (fetched < 0)
+	{
+		return ORIGIN_INVALID;
+	}
+	protocolParseReply(originReply, fetched, &reply);
+	if (reply.status == ORIGIN_OK && reply.codec != CODEC_NONE && !(proxy->codecs & CODEC_BIT(reply.codec)))
+	{
+		reply.status = ORIGIN_INVALID;
+	}
+	switch (reply.status)
+	{
+	case ORIGIN_NOT_FOUND:
+		// remember the miss so repeated requests do not go back to the server
+		cacheRemove(&proxy->cache, fileName);
+		addToNegativeCache(&proxy->negativeCache, fileName);
+		LOG_INFO("Proxy %d: File does not exist.\n", proxyNum);
+		break;
+	case ORIGIN_NOT_MODIFIED:
+		if (cacheRefresh(&proxy->cache, fileName, reply.ttl) != 0)
+		{
+			return ORIGIN_INVALID;
+		}
+		LOG_INFO("[+]Proxy %d: '%s' not modified, cached for %d more seconds\n", proxyNum, fileName, reply.ttl);
+		statsInc(STAT_NOT_MODIFIED);
+		break;
+	case ORIGIN_OK:
+		// 3a. store the file in the cache
+		LOG_DEBUG("[+]Proxy %d: Adding file to cache...\n", proxyNum);
+		addToCache(&proxy->cache, reply.file, reply.length, reply.codec, fileName, reply.version, reply.ttl);
+		LOG_INFO("[+]Proxy %d: Finished adding to cache. Cache size: %d\n", proxyNum, proxy->cache.numEntries);
+		break;
+	default:
+		LOG_WARN("[-]Proxy %d: Unexpected reply from server for '%s'\n", proxyNum, fileName);
+	}
+	return reply.status;
+}
+
+/**
+ * Queues fileName to be refreshed by refreshLoop(). Must be called with lock held.
+ * */
+void queueRefresh(struct Proxy *proxy, const char *fileName, uint64_t version)
+{
+	struct RefreshQueue *queue = &proxy->refreshQueue;
+
+	if (queue->count == queue->size)
+	{
+		// a later request will queue it again
+		cacheEndRefresh(&proxy->cache, fileName);
+		return;
+	}
+	struct RefreshRequest *request = &queue->requests[(queue->head + queue->count) % queue->size];
+	strncpy(request->fileName, fileName, sizeof(request->fileName) - 1);
+	request->fileName[sizeof(request->fileName) - 1] = '\0';
+	request->version = version;
+	queue->count++;
+	pthread_cond_signal(&queue->ready);
+}
+
+/**
+ * Refreshes queued files from the server.
+ * lock is not held while waiting for the server, so clients keep being served from the cache.
+ * */
+void *refreshLoop(void *inputs)
 {
-	char buffer[1024];
 	struct thread_data *thread_data = (struct thread_data *)inputs;
-	ssize_t msgLength;
+	struct RefreshQueue *queue = &thread_data->proxy->refreshQueue;
+	struct RefreshRequest request;
+	char originReply[ORIGIN_REPLY_SIZE];
+	ssize_t fetched;
+
+	pthread_mutex_lock(&lock);
 	while (1)
 	{
-		if ((msgLength = tls_read(thread_data->cctx, buffer, sizeof(buffer))) < 0)
-		{ // check to see if client closed connection
-			printf("[-]Proxy %d: Disconnected from %s:%d\n\n",  thread_data->proxyNum, inet_ntoa(thread_data->newAddr.sin_addr), ntohs(thread_data->newAddr.sin_port));
-			break;
+		while (queue->count == 0)
+		{
+			pthread_cond_wait(&queue->ready, &lock);
+		}
+		request = queue->requests[queue->head];
+		queue->head = (queue->head + 1) % queue->size;
+		queue->count--;
+		pthread_mutex_unlock(&lock);
+
+		LOG_DEBUG("[+]Proxy %d: Refreshing '%s' in the background\n", thread_data->proxyNum, request.fileName);
+		fetched = fetchFromServer(thread_data, request.fileName, request.version, originReply, sizeof(originReply));
+
+		pthread_mutex_lock(&lock);
+		statsInc(STAT_BACKGROUND_REFRESHES);
+		storeOriginReply(thread_data->proxy, thread_data->proxyNum, request.fileName, fetched, originReply);
+		cacheEndRefresh(&thread_data->proxy->cache, request.fileName);
+	}
+	return NULL;
+}
+
+/**
+ * Puts the cached copy of fileName in buffer, compressed if its codec is in codecs.
+ * Must be called with lock held.
+ * Returns the reply length, with *codec set to how it is encoded
+ * */
+static size_t replyFromCache(struct Proxy *proxy, const char *fileName, char *buffer, size_t size, unsigned codecs, int *codec)
+{
+	ssize_t length = getFromCache(&proxy->cache, fileName, buffer, size, codecs, codec);
+	if (length < 0)
+	{
+		strncpy(buffer, "Server unavailable.", size);
+		length = strlen(buffer);
+	}
+	return length;
+}
+
+/**
+ * Takes lock for a request that arrived at started, unless too many requests are already
+ * waiting for it or it cannot be had before the request's deadline.
+ * Returns 0 with lock held, -1 if the request should be answered busy
+ * */
+static int admitRequest(struct Limits *limits, const struct timespec *started)
+{
+	struct timespec deadline = *started;
+	int ret;
+
+	if (atomic_fetch_add(&limits->queued, 1) >= limits->maxQueued)
+	{
+		atomic_fetch_sub(&limits->queued, 1);
+		statsInc(STAT_SHED_REQUESTS);
+		return -1;
+	}
+	deadline.tv_sec += limits->deadline / 1000;
+	deadline.tv_nsec += limits->deadline % 1000 * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	ret = pthread_mutex_timedlock(&lock, &deadline);
+	atomic_fetch_sub(&limits->queued, 1);
+	if (ret != 0)
+	{
+		statsInc(STAT_DEADLINE_EXCEEDED);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Gets the reply for a file owned by another proxy from that proxy, so that each file
+ * is only checked against the blacklist, and cached, by its owner.
+ * If the owner cannot be reached the next proxy in rendezvous order stands in for it,
+ * which may be this one. A forwarded request is never forwarded again.
+ * Returns 0 with the reply in buffer, *replyLength long and encoded with *codec,
+ * and *replicas set to the owner's hot file hint, or -1 if this proxy has to serve the file itself.
+ * */
+static int forwardToOwner(struct thread_data *thread_data, const char *fileName, int forwarded,
+						  unsigned codecs, char *buffer, size_t size, int *codec, size_t *replyLength, int *replicas)
+{
+	char **proxyNames = thread_data->proxy->proxyNames;
+	int ranks[5];
+	ssize_t length = -1;
+
+	rankProxies(proxyNames, fileName, ranks);
+	memset(buffer, 0, size);
+	if (forwarded)
+	{
+		// sent here because the owner is down, and we hold its blacklist entries too
+		if (isReplica(proxyNames, fileName, thread_data->proxyNum))
+		{
+			statsInc(STAT_FAILOVER_SERVED);
+			return -1;
 		}
-		else // sending the file back to the user.
+		// the proxies disagree about the owner, e.g. while they run different proxy lists
+		LOG_WARN("[-]Proxy %d: Refusing '%s', forwarded here but owned by proxy %d\n", thread_data->proxyNum, fileName, ranks[0]);
+		statsInc(STAT_MISROUTED);
+	}
+	for (int i = 0; !forwarded && length < 0 && i < BLACKLIST_REPLICAS; i++)
+	{
+		if (ranks[i] == thread_data->proxyNum)
 		{
-			int fd;
-			char fileName[1024], c;
+			LOG_INFO("[+]Proxy %d: Owner of '%s' is down. Serving it in its place\n", thread_data->proxyNum, fileName);
+			statsInc(STAT_FAILOVER_SERVED);
+			return -1;
+		}
+		LOG_INFO("[+]Proxy %d: '%s' belongs to proxy %d. Forwarding the request\n", thread_data->proxyNum, fileName, ranks[i]);
+		statsInc(STAT_FORWARDED);
+		if ((length = peerForward(&thread_data->proxy->peers, ranks[i], fileName, codecs, buffer, size - 1, codec, replicas)) < 0)
+		{
+			LOG_WARN("[-]Proxy %d: Could not forward '%s' to proxy %d\n", thread_data->proxyNum, fileName, ranks[i]);
+			statsInc(STAT_FORWARD_ERRORS);
+		}
+	}
+	if (length < 0)
+	{
+		*codec = CODEC_NONE;
+		strncpy(buffer, "Server unavailable.", size);
+		length = strlen(buffer);
+	}
+	*replyLength = length;
+	return 0;
+}
+
+/**
+ * Serves requests on one client connection until the client closes it.
+ * Every request gets exactly one reply of sizeof(buffer) bytes, so a client
+ * can send its next file name as soon as it has read the previous reply.
+ * Once the client negotiated encodings the replies are framed instead (see protocol.h).
+ * Requests for files another proxy owns are forwarded to it, see forwardToOwner().
+ * */
+void *handleClient(void *inputs)
+{
+	char buffer[1024], originReply[ORIGIN_REPLY_SIZE], frame[CLIENT_FRAME_HEADER_SIZE + sizeof(buffer)];
+	enum OriginStatus status;
+	uint64_t version;
+	int cached, codec, framed = 0;
+	unsigned codecs = 0;
+	size_t replyLength;
+	struct thread_data *thread_data = (struct thread_data *)inputs;
+	ssize_t msgLength;
+	const char *error = NULL;
+	int fromPeer = 0, ret;
+
+	statsInc(STAT_CONNECTIONS);
+	statsGaugeAdd(GAUGE_ACTIVE_CONNECTIONS, 1);
+	// pooled client connections may sit idle between requests, so only the handshake is timed
+	if ((ret = netAcceptHandshake(thread_data->cctx, thread_data->newSocket, HANDSHAKE_TIMEOUT, 0, &error)) != 0)
+	{
+		if (ret == NET_TIMED_OUT)
+			statsInc(STAT_HANDSHAKE_TIMEOUTS);
+		LOG_WARN("[-]Proxy %d: TLS handshake with %s:%d failed: %s\n\n", thread_data->proxyNum, inet_ntoa(thread_data->newAddr.sin_addr), ntohs(thread_data->newAddr.sin_port), error);
+		statsInc(STAT_HANDSHAKE_FAILURES);
+	}
+	else
+	{
+		fromPeer = isPeerConnection(thread_data->cctx);
+		while (1)
+		{
+			if ((msgLength = tls_read(thread_data->cctx, buffer, sizeof(buffer) - 1)) <= 0)
+			{ // check to see if client closed connection
+				LOG_INFO("[-]Proxy %d: Disconnected from %s:%d\n\n",  thread_data->proxyNum, inet_ntoa(thread_data->newAddr.sin_addr), ntohs(thread_data->newAddr.sin_port));
+				break;
+			}
+
+			// sending the file back to the user.
+			char fileName[1024];
+			struct timespec started; // the request's deadline counts from here
+			clock_gettime(CLOCK_REALTIME, &started);
+			uint64_t startedUsec = statsNowUsec(); // monotonic, for the traced latency
 			buffer[msgLength] = '\0'; // make sure that we only look at the message we read in
+			if (sscanf(buffer, CLIENT_ENCODINGS " %x", &codecs) == 1)
+			{
+				codecs &= codecsAvailable();
+				framed = 1;
+				LOG_INFO("[+]Proxy %d: Client accepts encodings %x\n", thread_data->proxyNum, codecs);
+				bzero(buffer, sizeof(buffer));
+				snprintf(buffer, sizeof(buffer), CLIENT_ENCODINGS " %x", codecs);
+				tls_write(thread_data->cctx, buffer, sizeof(buffer));
+				continue;
+			}
+			// a request forwarded by another proxy carries the codecs of its client, and is answered framed.
+			// from a client, which could claim anything, the whole message is a file name
+			unsigned requestCodecs = codecs;
+			int requestFramed = framed, forwarded = 0, replica = 0, replicas = 1, offset = 0;
+			enum TraceOutcome outcome = TRACE_REFUSED;
+			if (fromPeer && sscanf(buffer, PEER_FORWARD " %x %n", &requestCodecs, &offset) == 1 && offset > 0)
+			{
+				requestCodecs &= codecsAvailable();
+				requestFramed = forwarded = 1;
+				memmove(buffer, buffer + offset, strlen(buffer + offset) + 1);
+			}
+			// a client spreading a hot file asks for our replica of it
+			else if (strncmp(buffer, CLIENT_REPLICA " ", strlen(CLIENT_REPLICA " ")) == 0)
+			{
+				replica = 1;
+				memmove(buffer, buffer + strlen(CLIENT_REPLICA " "), strlen(buffer + strlen(CLIENT_REPLICA " ")) + 1);
+			}
 			strcpy(fileName, buffer);
-
-			printf("[+]Proxy %d: Client requests: '%s'\n", thread_data->proxyNum, fileName);
-			// 1. Check compute hash bloom filter first with isInBloomFilter() function
-			if (isInBloomFilter(thread_data->proxy->bloomFilter, buffer))
+			codec = CODEC_NONE;
+			// a forwarded request was charged to its client by the proxy that forwarded it
+			int limited = !forwarded && !rateAllow(&thread_data->proxy->rateLimiter, thread_data->newAddr.sin_addr.s_addr);
+			replyLength = 0;
+
+			LOG_INFO("[+]Proxy %d: Client requests: '%s'\n", thread_data->proxyNum, fileName);
+			statsInc(STAT_REQUESTS);
+			// 1. Check the membership filter first with filterContains()
+			int blacklisted = 0;
+			// the blacklist may be swapped while we look at it, see reloadBlacklist()
+			epochEnter();
+			struct Blacklist *blacklist = atomic_load(&thread_data->proxy->blacklist);
+			if (filterContains(&blacklist->filter, fileName))
+			{
+				// 1a. if filterContains() == 1, the item may be blacklisted. Confirm with isInBlackList()
+				statsInc(STAT_BLOOM_POSITIVES);
+				if ((blacklisted = isInBlackList(blacklist, fileName)) == 0)
+				{
+					statsInc(STAT_BLOOM_FALSE_POSITIVES);
+				}
+			}
+			// 1c. patterns cover names the exact list cannot, e.g. whole directories
+			if (!blacklisted && (blacklisted = patternMatch(&blacklist->patterns, fileName)))
 			{
-				// 1a. if isInBloomFilter() == 1, then respond "Request Denied" becuase item is blacklisted
-				tls_write(thread_data->cctx, "Access Denied.", sizeof(buffer));
+				statsInc(STAT_PATTERN_DENIED);
+			}
+			epochExit();
+			if (limited)
+			{
+				LOG_INFO("[!]Proxy %d: %s is over its rate limit\n", thread_data->proxyNum, inet_ntoa(thread_data->newAddr.sin_addr));
+				statsInc(STAT_RATE_LIMITED);
+				strncpy(buffer, CLIENT_RATE_LIMITED_REPLY, sizeof(buffer));
+			}
+			// 1b. if isInBlackList() == 1, respond "Access Denied". filterContains() == 0 means the item is definitely not blacklisted
+			else if (blacklisted)
+			{
+				LOG_INFO("[!]Proxy %d: File in blacklist. Denying access\n",  thread_data->proxyNum);
+				statsInc(STAT_DENIED);
+				outcome = TRACE_DENIED;
+				strncpy(buffer, "Access Denied.", sizeof(buffer));
+			}
+			// 1d. the owner's blacklist and cache decide everything else about the file
+			else if (whichProxy(thread_data->proxy->proxyNames, fileName) != thread_data->proxyNum &&
+					 !(replica && isReplica(thread_data->proxy->proxyNames, fileName, thread_data->proxyNum)) &&
+					 forwardToOwner(thread_data, fileName, forwarded, requestCodecs, buffer, sizeof(buffer), &codec, &replyLength, &replicas) == 0)
+			{
+				// answered by the owner, or by the proxy standing in for it
+				outcome = TRACE_FORWARDED;
+			}
+			// mutex so that we don't have multiple threads checking if the same file is not yet in the cache
+			else if (admitRequest(&thread_data->proxy->limits, &started) != 0)
+			{
+				LOG_INFO("[!]Proxy %d: Too busy to serve '%s'\n", thread_data->proxyNum, fileName);
+				strncpy(buffer, CLIENT_BUSY_REPLY, sizeof(buffer));
 			}
 			else
 			{
-				// 1b. is isInBloomFilter() == 0, then run isInBlacklist(). If == 1, then respond "Request Denied"
-				if (isInBlackList(thread_data->proxy, buffer))
+				if (replica)
 				{
-					printf("[!]Proxy %d: File in blacklist. Denying access\n",  thread_data->proxyNum);
-					tls_write(thread_data->cctx, "Access Denied.", sizeof(buffer));
-					bzero(buffer, sizeof(buffer));
-					bzero(fileName, sizeof(fileName));
-					free(thread_data->cctx);
-					close(thread_data->newSocket);
-					break;
+					statsInc(STAT_REPLICA_SERVED);
+				}
+				// tell the client it may spread requests for a hot file over its replicas
+				if (hotRecord(&thread_data->proxy->hotKeys, fileName))
+				{
+					replicas = BLACKLIST_REPLICAS;
+				}
+				// 2. check whether the server recently told us the file does not exist
+				if (isInNegativeCache(&thread_data->proxy->negativeCache, fileName))
+				{
+					LOG_INFO("[!]Proxy %d: '%s' is known not to exist. Returning without contacting server.\n", thread_data->proxyNum, fileName);
+					statsInc(STAT_NEGATIVE_HITS);
+					outcome = TRACE_NEGATIVE;
+					strncpy(buffer, "Access Denied. File does not exist.", sizeof(buffer));
+				}
+				// 2a. check the cache files to see if file is stored and can be served
+				else if ((cached = isInCache(&thread_data->proxy->cache, fileName, &version)) == CACHE_FRESH || cached == CACHE_REFRESH)
+				{
+					statsInc(STAT_CACHE_HITS);
+					outcome = TRACE_HIT;
+					replyLength = replyFromCache(thread_data->proxy, fileName, buffer, sizeof(buffer), requestCodecs, &codec);
+					if (cached == CACHE_REFRESH)
+					{
+						queueRefresh(thread_data->proxy, fileName, version);
+					}
 				}
 				else
 				{
-					// mutex so that we don't have multiple threads checking if the same file is not yet in the cache
-					pthread_mutex_lock(&lock);
-					// 2. check the cache files to see if file is stored
-					if (!isInCache(thread_data->proxy, buffer))
+					if (cached == CACHE_EXPIRED)
+					{
+						statsInc(STAT_REVALIDATIONS);
+					}
+					else
 					{
-						printf("[+]Proxy %d File not in cache. Initiating handshake with server\n",  thread_data->proxyNum);
-						// 3. TLS connection/handshake with server and request file
-						memset(&thread_data->server, 0, sizeof(thread_data->server));
-						thread_data->server.sin_family = AF_INET;
-						thread_data->server.sin_port = htons(thread_data->serverPort);
-						thread_data->server.sin_addr.s_addr = inet_addr("127.0.0.1");
-						if (thread_data->server.sin_addr.s_addr == INADDR_NONE)
-						{
-							fprintf(stderr, "Invalid IP address 127.0.0.1 \n");
-							usage();
-						}
-
-						/* ok now get a socket. we don't care where... */
-						if ((thread_data->serverSock = socket(AF_INET, SOCK_STREAM, 0)) == -1)
-							err(1, "socket failed");
-
-						/* connect the socket to the server described in "server_sa" */
-						if (connect(thread_data->serverSock, (struct sockaddr *)&thread_data->server, sizeof(thread_data->server)) == -1)
-						{
-							err(1, "connect failed");
-						}
-
-						printf("[+]Proxy %d: Running TLS Configuration for proxy client\n",  thread_data->proxyNum);
-
-						/* Calling TLS                                               */
-						/* Sets all necessary certificates                           */
-						/* Verifies TLS handshake before proceeding to write or read */
-
-						if ((tls_init()) != 0)
-						{
-							err(1, "[-]TLS could not be initialized");
-						}
-
-						if ((thread_data->pcfg = tls_config_new()) == NULL) //Initiates client TLS config.
-						{
-							err(1, "[-]TLS Config could not finish");
-						}
-
-						printf("[+]Proxy %d: TLS config created.\n",  thread_data->proxyNum);
-
-						if (tls_config_set_ca_file(thread_data->pcfg, "../../certificates/root.pem") != 0) //Sets client root certificate.
-						{
-							err(1, "[-]Could not set client root certificate");
-						}
-
-						printf("[+]Proxy %d:TLS certificate set.\n", thread_data->proxyNum); //Set proxy root certificate
-						tls_config_insecure_noverifyname(thread_data->pcfg);
-
-						if ((thread_data->pctx = tls_client()) == NULL)
-						{
-							err(1, "[-]Could not create client TLS context");
-						}
-
-						printf("[+]Proxy %d:TLS client created.\n", thread_data->proxyNum); // Create proxy client to send data and connect to server socket
-
-						if (tls_configure(thread_data->pctx, thread_data->pcfg) != 0)
-						{
-							err(1, "[-]Could not create client TLS configuration");
-						}
-						
-						printf("[+]Proxy %d: TLS client instance created.\n", thread_data->proxyNum);
-
-						/* connect to server via tls connection */
-
-						if ((tls_connect_socket(thread_data->pctx, thread_data->serverSock, "server")) != 0)
-						{
-							errx(1, "[-]tls_connect_socket: %s", tls_error(thread_data->pctx));
-						}
-						printf("[+]Connected to server socket and initializing TLS handshake...\n");
-
-						if (tls_handshake(thread_data->pctx) != 0) // Establish handshake with the server.
-						{
-							errx(1, "[-]tls_handshake could not be established");
-						}
-						printf("[+]Proxy %d: TLS Handshake complete.\n", thread_data->proxyNum);
-						
-						/* Once handhsake is established then we can write via TLS */
-						tls_write(thread_data->pctx, buffer, sizeof(buffer));
-
-						int serverMsgLength = 0;
-						if ((serverMsgLength = tls_read(thread_data->pctx, buffer, sizeof(buffer))) <= 0)
-						{
-							printf("[-]Proxy %d:Disconnected from %s:%d\n\n", thread_data->proxyNum, inet_ntoa(thread_data->newAddr.sin_addr), ntohs(thread_data->newAddr.sin_port));
-							break;
-						}
-						else
-						{
-							printf("[+]Proxy %d: Received '%s' from server.\n",  thread_data->proxyNum, buffer);
-							if (strcmp(buffer, "File does not exist.") == 0)
-							{
-								strncpy(buffer, "Access Denied. File does not exist.", sizeof(buffer));
-								tls_write(thread_data->cctx, buffer, sizeof(buffer));
-								printf("Proxy %d: File does not exist.\n", thread_data->proxyNum);
-								bzero(buffer, sizeof(buffer));
-								bzero(fileName, sizeof(fileName));
-								break;
-							}
-						}
-						// 3a. store the file in the cache
-						printf("[+]Proxy %d: Adding file to cache...\n",  thread_data->proxyNum);
-						addToCache(thread_data->proxy, buffer, fileName);
-						printf("[+]Proxy %d: Finished adding to cache. Cache size: %d\n", thread_data->proxyNum, thread_data->proxy->numCache);
+						LOG_INFO("[+]Proxy %d File not in cache. Initiating handshake with server\n",  thread_data->proxyNum);
+						statsInc(STAT_CACHE_MISSES);
+						version = 0;
 					}
-					// unlock mutex
+					// 3. request the file from the server, unless our copy is still current.
+					// other requests are served meanwhile, and misses of several may go out in one batch
 					pthread_mutex_unlock(&lock);
-					// 4. send file to client over
-					getFromCache(thread_data->proxy, fileName, buffer);
-					tls_write(thread_data->cctx, buffer, sizeof(buffer));
-					printf("[+]Proxy %d: Finished sending file to client\n",  thread_data->proxyNum);
-					bzero(buffer, sizeof(buffer));
-					bzero(fileName, sizeof(fileName));
-					free(thread_data->cctx);
-					close(thread_data->newSocket); 
+					ssize_t fetched = fetchFromServer(thread_data, fileName, version, originReply, sizeof(originReply));
+					pthread_mutex_lock(&lock);
+					status = storeOriginReply(thread_data->proxy, thread_data->proxyNum, fileName, fetched, originReply);
+					if (status == ORIGIN_INVALID && fetched >= 0 && version != 0)
+					{
+						// our copy was dropped from both tiers before the server's answer came back
+						LOG_INFO("[!]Proxy %d: '%s' left the cache while it was revalidated. Fetching it again.\n", thread_data->proxyNum, fileName);
+						pthread_mutex_unlock(&lock);
+						fetched = fetchFromServer(thread_data, fileName, 0, originReply, sizeof(originReply));
+						pthread_mutex_lock(&lock);
+						status = storeOriginReply(thread_data->proxy, thread_data->proxyNum, fileName, fetched, originReply);
+					}
+					if (status == ORIGIN_NOT_FOUND)
+					{
+						outcome = TRACE_NOT_FOUND;
+						strncpy(buffer, "Access Denied. File does not exist.", sizeof(buffer));
+					}
+					else if (status == ORIGIN_OK || status == ORIGIN_NOT_MODIFIED)
+					{
+						outcome = cached == CACHE_EXPIRED ? TRACE_REVALIDATED : TRACE_MISS;
+						replyLength = replyFromCache(thread_data->proxy, fileName, buffer, sizeof(buffer), requestCodecs, &codec);
+					}
+					else if (cached == CACHE_EXPIRED)
+					{
+						// an expired copy beats no copy while the server is down
+						LOG_WARN("[-]Proxy %d: Could not revalidate '%s'. Serving the expired copy.\n", thread_data->proxyNum, fileName);
+						outcome = TRACE_REVALIDATED;
+						replyLength = replyFromCache(thread_data->proxy, fileName, buffer, sizeof(buffer), requestCodecs, &codec);
+					}
+					else
+					{
+						outcome = TRACE_ERROR;
+						strncpy(buffer, "Server unavailable.", sizeof(buffer));
+					}
 				}
-				// 5. close connection
+				// unlock mutex
+				pthread_mutex_unlock(&lock);
+			}
+			// 4. send the reply to client over
+			if (!requestFramed)
+			{
+				tls_write(thread_data->cctx, buffer, sizeof(buffer));
 			}
+			else
+			{
+				if (codec == CODEC_NONE)
+					replyLength = strlen(buffer);
+				else
+					statsInc(STAT_COMPRESSED_REPLIES);
+				int headerLength;
+				if (replicas > 1)
+				{
+					statsInc(STAT_HOT_REPLIES);
+					headerLength = snprintf(frame, CLIENT_FRAME_HEADER_SIZE, "%d %zu %d\n", codec, replyLength, replicas);
+				}
+				else
+					headerLength = snprintf(frame, CLIENT_FRAME_HEADER_SIZE, "%d %zu\n", codec, replyLength);
+				memcpy(frame + headerLength, buffer, replyLength);
+				tls_write(thread_data->cctx, frame, headerLength + replyLength);
+			}
+			LOG_INFO("[+]Proxy %d: Finished sending reply to client\n",  thread_data->proxyNum);
+			if (thread_data->proxy->trace.fd >= 0)
+			{
+				struct TraceRecord record = {
+					.timestamp = (uint64_t)started.tv_sec * 1000000 + started.tv_nsec / 1000,
+					.key = hashString(fileName),
+					.nameSum = stringToInt(fileName),
+					.size = codec == CODEC_NONE ? strlen(buffer) : replyLength,
+					.latency = statsNowUsec() - startedUsec,
+					.outcome = outcome};
+				traceRecord(&thread_data->proxy->trace, &record);
+			}
+			bzero(buffer, sizeof(buffer));
+			bzero(fileName, sizeof(fileName));
+		}
+		tls_close(thread_data->cctx);
+	}
+	// 5. close connection
+	tls_free(thread_data->cctx);
+	close(thread_data->newSocket);
+	statsGaugeAdd(GAUGE_ACTIVE_CONNECTIONS, -1);
+	atomic_fetch_sub(&thread_data->proxy->limits.connections, 1);
+	slabFree(thread_data, sizeof(struct thread_data));
+	return NULL;
+}
+
+/**
+ * Writes the cache and, if the blacklist uses one, the Bloom filter to path.
+ * The file is written next to path and renamed over it, so a crash never leaves a torn snapshot.
+ * Returns 0 on success, -1 on failure
+ * */
+int saveSnapshot(struct Proxy *proxy, int proxyNum, const char *path)
+{
+	struct SnapshotHeader header = {.magic = "TLSCACHE", .version = SNAPSHOT_VERSION, .proxyNum = proxyNum};
+	char tmpPath[PATH_MAX];
+	FILE *fp;
+
+	// copy under the lock, write without it
+	pthread_mutex_lock(&lock);
+	struct File *entries;
+	int numEntries = cacheCopyEntries(&proxy->cache, &entries);
+	pthread_mutex_unlock(&lock);
+	if (numEntries < 0)
+	{
+		return -1;
+	}
+	header.numEntries = numEntries;
+
+	// keeps the blacklist from being freed while its Bloom filter is written
+	epochEnter();
+	struct Blacklist *blacklist = atomic_load(&proxy->blacklist);
+	header.blacklistHash = blacklist->hash;
+	header.bloomSize = blacklist->filter.kind == FILTER_BLOOM ? filterBytes(&blacklist->filter) : 0;
+	header.checksum = hashBytes(HASH_SEED, entries, header.numEntries * sizeof(struct File));
+	header.checksum = hashBytes(header.checksum, blacklist->filter.bloom.bloomFilter, header.bloomSize);
+
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+	if ((fp = fopen(tmpPath, "w")) == NULL)
+	{
+		epochExit();
+		free(entries);
+		return -1;
+	}
+	int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+			 fwrite(entries, sizeof(struct File), header.numEntries, fp) == header.numEntries &&
+			 fwrite(blacklist->filter.bloom.bloomFilter, 1, header.bloomSize, fp) == header.bloomSize &&
+			 fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	ok = fclose(fp) == 0 && ok;
+	epochExit();
+	free(entries);
+	if (!ok || rename(tmpPath, path) != 0)
+	{
+		unlink(tmpPath);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Restores the cache from a snapshot written by saveSnapshot().
+ * The Bloom filter is restored too if it was built from the blacklist loaded now and one is wanted,
+ * *bloomRestored tells the caller whether it still has to build it.
+ * Called at startup, before the blacklist can be swapped.
+ * Returns the number of entries restored, -1 if there is no valid snapshot.
+ * */
+int loadSnapshot(struct Proxy *proxy, int proxyNum, const char *path, int *bloomRestored)
+{
+	struct stat st;
+	int fd;
+
+	*bloomRestored = 0;
+	if ((fd = open(path, O_RDONLY)) < 0)
+	{
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct SnapshotHeader))
+	{
+		close(fd);
+		return -1;
+	}
+	const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	const struct SnapshotHeader *header = (const struct SnapshotHeader *)map;
+	const char *entries = map + sizeof(struct SnapshotHeader);
+	size_t entriesSize = header->numEntries * sizeof(struct File);
+	int restored = -1;
+
+	if (memcmp(header->magic, "TLSCACHE", sizeof(header->magic)) != 0 || header->version != SNAPSHOT_VERSION ||
+		header->proxyNum != (uint32_t)proxyNum || (header->bloomSize != BLOOM_FILTER_SIZE && header->bloomSize != 0) ||
+		// a count that cannot fit in the file would wrap entriesSize and pass the size check
+		header->numEntries > ((size_t)st.st_size - sizeof(struct SnapshotHeader)) / sizeof(struct File) ||
+		(size_t)st.st_size != sizeof(struct SnapshotHeader) + entriesSize + header->bloomSize)
+	{
+		LOG_WARN("[-]Proxy %d: Ignoring snapshot '%s' written by another version or proxy\n", proxyNum, path);
+	}
+	else if (hashBytes(HASH_SEED, entries, entriesSize + header->bloomSize) != header->checksum)
+	{
+		LOG_WARN("[-]Proxy %d: Ignoring snapshot '%s' with a bad checksum\n", proxyNum, path);
+	}
+	else
+	{
+		// oldest first, so anything past the capacity goes to the cold tier
+		cacheRestore(&proxy->cache, (const struct File *)entries, header->numEntries);
+		struct Blacklist *blacklist = atomic_load(&proxy->blacklist);
+		if (header->blacklistHash == blacklist->hash && header->bloomSize != 0 && proxy->filterKind == FILTER_BLOOM &&
+			filterBuild(&blacklist->filter, FILTER_BLOOM, NULL, 0, &blacklist->arena) == 0)
+		{
+			memcpy(blacklist->filter.bloom.bloomFilter, entries + entriesSize, header->bloomSize);
+			*bloomRestored = 1;
 		}
+		restored = header->numEntries;
 	}
-	// here?
+	munmap((void *)map, st.st_size);
+	return restored;
+}
+
+struct snapshot_data
+{
+	struct Proxy *proxy;
+	int proxyNum;
+	int interval;
+	char path[PATH_MAX];
+};
+
+/**
+ * Saves a snapshot every interval seconds, if the cache changed since the last one
+ * */
+void *snapshotLoop(void *inputs)
+{
+	struct snapshot_data *snapshot_data = (struct snapshot_data *)inputs;
+	unsigned long savedVersion = snapshot_data->proxy->cache.version;
+
+	while (1)
+	{
+		sleep(snapshot_data->interval);
+		pthread_mutex_lock(&lock);
+		unsigned long version = snapshot_data->proxy->cache.version;
+		pthread_mutex_unlock(&lock);
+		if (version == savedVersion)
+		{
+			continue;
+		}
+		if (saveSnapshot(snapshot_data->proxy, snapshot_data->proxyNum, snapshot_data->path) != 0)
+		{
+			LOG_WARN("[-]Proxy %d: Could not write snapshot '%s': %s\n", snapshot_data->proxyNum, snapshot_data->path, strerror(errno));
+			continue;
+		}
+		savedVersion = version;
+		LOG_DEBUG("[+]Proxy %d: Cache snapshot written to '%s'\n", snapshot_data->proxyNum, snapshot_data->path);
+	}
+	return NULL;
 }
 
 // your application name -port portnumber
@@ -399,7 +1260,6 @@ int main(int argc, char *argv[])
 	u_long p;
 	u_short port;
 	struct Proxy proxy;
-	struct BloomFilter bloomFilter;
 
 	// for any new connections
 	int newSocket;
@@ -408,11 +1268,10 @@ int main(int argc, char *argv[])
 	pid_t childpid;
 	pid_t pid;
 
-	// server
-	struct sockaddr_in server;
-	int serverSock;
+	// servers
 	pid_t serverPID;
-	int serverPort;
+	char serverAddresses[ORIGIN_MAX][INET_ADDRSTRLEN] = {"127.0.0.1"};
+	int serverPorts[ORIGIN_MAX] = {PORT}, numServers = 1;
 
 	/* TLS Proxy Configuration */
 	struct tls_config *cfg = NULL;
@@ -420,6 +1279,111 @@ int main(int argc, char *argv[])
 	struct tls *cctx = NULL;
 	uint8_t *mem;
 	size_t mem_len;
+	int ch, level = LOG_LEVEL_INFO;
+	int negativeSize = NEGATIVE_CACHE_SIZE, negativeTtl = NEGATIVE_CACHE_TTL;
+	int snapshotInterval = SNAPSHOT_INTERVAL;
+	const char *snapshotDir = ".";
+	int cacheCapacity = CACHE_CAPACITY, coldMegabytes = 0;
+	int staleSeconds = STALE_SECONDS, refreshAhead = REFRESH_AHEAD;
+	int compress = 0, trace = 0, filterKind = FILTER_BLOOM, hotThreshold = HOT_THRESHOLD;
+	int maxConnections = MAX_CONNECTIONS, maxQueued = MAX_QUEUED, deadline = REQUEST_DEADLINE;
+	int rate = 0, burst = 0, batchSize = BATCH_SIZE, batchWindow = BATCH_WINDOW;
+
+	while ((ch = getopt(argc, argv, "b:B:c:d:D:F:H:l:m:n:N:O:q:r:R:s:S:Tw:W:z")) != -1)
+	{
+		switch (ch)
+		{
+		case 'b':
+			if ((burst = atoi(optarg)) < 0)
+				usage();
+			break;
+		case 'B':
+			if ((batchSize = atoi(optarg)) <= 0 || batchSize > ORIGIN_BATCH_MAX)
+				usage();
+			break;
+		case 'c':
+			if ((cacheCapacity = atoi(optarg)) <= 0)
+				usage();
+			break;
+		case 'd':
+			if ((coldMegabytes = atoi(optarg)) < 0)
+				usage();
+			break;
+		case 'D':
+			if ((deadline = atoi(optarg)) <= 0)
+				usage();
+			break;
+		case 'F':
+			if ((filterKind = filterParseKind(optarg)) < 0)
+				usage();
+			break;
+		case 'H':
+			if ((hotThreshold = atoi(optarg)) < 0)
+				usage();
+			break;
+		case 'l':
+			if ((level = logParseLevel(optarg)) < 0)
+				usage();
+			break;
+		case 'm':
+			if ((maxConnections = atoi(optarg)) <= 0)
+				usage();
+			break;
+		case 'n':
+			if ((negativeSize = atoi(optarg)) <= 0)
+				usage();
+			break;
+		case 'N':
+			if ((negativeTtl = atoi(optarg)) < 0)
+				usage();
+			break;
+		case 'O':
+			if ((numServers = originsParse(optarg, serverAddresses, serverPorts)) <= 0)
+				usage();
+			break;
+		case 'q':
+			if ((maxQueued = atoi(optarg)) <= 0)
+				usage();
+			break;
+		case 'r':
+			if ((rate = atoi(optarg)) < 0)
+				usage();
+			break;
+		case 'R':
+			if ((refreshAhead = atoi(optarg)) < 0)
+				usage();
+			break;
+		case 's':
+			snapshotDir = optarg;
+			break;
+		case 'w':
+			if ((staleSeconds = atoi(optarg)) < 0)
+				usage();
+			break;
+		case 'W':
+			if ((batchWindow = atoi(optarg)) < 0)
+				usage();
+			break;
+		case 'T':
+			trace = 1;
+			break;
+		case 'S':
+			if ((snapshotInterval = atoi(optarg)) < 0)
+				usage();
+			break;
+		case 'z':
+			compress = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	// only the blacklist watcher of each proxy takes SIGHUP, see blacklistLoop()
+	sigset_t hangup;
+	sigemptyset(&hangup);
+	sigaddset(&hangup, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &hangup, NULL);
+	logInit(level);
 
 	//Init TLS
 	if (tls_init() != 0)
@@ -434,47 +1398,47 @@ int main(int argc, char *argv[])
 		err(1, "tls_config_new:");
 	}
 
-	printf("[+]TLS config created.\n");
+	LOG_DEBUG("[+]TLS config created.\n");
 
 	if (tls_config_set_ca_file(cfg, "../../certificates/root.pem") != 0) // Set the certificate file
 	{
 		err(1, "tls_config_set_ca_file error");
 	}
 
-	printf("[+]TLS proxy root certificate set.\n");
+	LOG_DEBUG("[+]TLS proxy root certificate set.\n");
 
 	if (tls_config_set_cert_file(cfg, "../../certificates/root.pem") != 0) //Set server certificate
 	{
 		err(1, "tls_config_set_cert_file error");
 	}
 
-	printf("[+]TLS proxy server certificate set.\n");
+	LOG_DEBUG("[+]TLS proxy server certificate set.\n");
 
 	if (tls_config_set_key_file(cfg, "../../certificates/root/private/ca.key.pem") != 0) //Set server private key
 	{
 		err(1, "tls_config_set_key_file error");
 	}
 
-	printf("[+]TLS proxy server private key set.\n");
+	LOG_DEBUG("[+]TLS proxy server private key set.\n");
+
+	// other proxies identify themselves with the proxies' certificate, clients send none
+	tls_config_verify_client_optional(cfg);
 
 	if ((ctx = tls_server()) == NULL)
 	{
 		err(1, "tls_server error");
 	}
 
-	printf("[+]TLS proxy context created.\n");
+	LOG_DEBUG("[+]TLS proxy context created.\n");
 
 	if (tls_configure(ctx, cfg) != 0)
 	{
 		err(1, "tls_configure: %s", tls_error(ctx));
 	}
-	printf("[+]TLS proxy instance created.\n");
+	LOG_DEBUG("[+]TLS proxy instance created.\n");
 
 	errno = 0;
 
-	/* now safe to do this */
-	serverPort = PORT;
-
 	char *proxyNames[5] = {"ProxyOne", "ProxyTwo", "ProxyThree", "ProxyFour", "ProxyFive"}; // hold the port names of each proxy
 	int proxyPorts[5] = {9990, 9991, 9992, 9993, 9994};										// hold the port numbers of each proxy
 	pid_t forkVal;
@@ -484,15 +1448,85 @@ int main(int argc, char *argv[])
 		if ((forkVal = fork()) == 0)
 		{
 			port = proxyPorts[proxyNum]; // set specified proxy portnumber
-			// initialize the proxy w/ blacklist & bloomfilter
-			proxy.cache = malloc(30000 * sizeof(struct File *));
-			proxy.numCache = 0;
+			// initialize the proxy w/ blacklist & membership filter
+			statsInit(ROLE_PROXY, proxyNum);
+			if (statsStartAdmin(ADMIN_PORT + proxyNum) != 0)
+			{
+				LOG_WARN("[-]Proxy %d: Could not open admin port %d. Metrics disabled.\n", proxyNum, ADMIN_PORT + proxyNum);
+			}
+
+			if (cacheInit(&proxy.cache, cacheCapacity) != 0)
+			{
+				LOG_ERROR("[-]Proxy %d: Could not allocate the cache. Terminating program.\n", proxyNum);
+				exit(1);
+			}
+			proxy.cache.staleSeconds = staleSeconds;
+			proxy.cache.refreshAhead = refreshAhead;
+			if (coldMegabytes > 0)
+			{
+				// objects evicted from RAM are kept here, and what a previous run left is still usable
+				char coldPath[PATH_MAX];
+				snprintf(coldPath, sizeof(coldPath), "%s/proxy%d.cold", snapshotDir, proxyNum);
+				if ((proxy.cache.cold = coldOpen(coldPath, (size_t)coldMegabytes << 20)) == NULL)
+				{
+					LOG_WARN("[-]Proxy %d: Cold cache disabled.\n", proxyNum);
+				}
+				else
+				{
+					LOG_INFO("[+]Proxy %d: Cold cache '%s' holds %d files\n", proxyNum, coldPath, proxy.cache.cold->numEntries);
+				}
+			}
+			proxy.trace.fd = -1;
+			if (trace)
+			{
+				char tracePath[PATH_MAX];
+				snprintf(tracePath, sizeof(tracePath), "%s/proxy%d.trace", snapshotDir, proxyNum);
+				if (traceOpen(&proxy.trace, tracePath, proxyNum) != 0)
+				{
+					LOG_WARN("[-]Proxy %d: Could not open trace '%s'. Tracing disabled.\n", proxyNum, tracePath);
+				}
+				else
+				{
+					LOG_INFO("[+]Proxy %d: Tracing requests to '%s'\n", proxyNum, tracePath);
+				}
+			}
+			proxy.negativeCache.size = negativeSize;
+			proxy.negativeCache.ttl = negativeTtl;
+			if ((proxy.negativeCache.entries = calloc(negativeSize, sizeof(struct NegativeEntry))) == NULL)
+			{
+				LOG_ERROR("[-]Proxy %d: Could not allocate the negative cache\n", proxyNum);
+				exit(1);
+			}
+			proxy.codecs = compress ? codecsAvailable() : 0;
+			proxy.filterKind = filterKind;
+			proxy.proxyNames = proxyNames;
+			hotKeysInit(&proxy.hotKeys, hotThreshold, BLACKLIST_REPLICAS, HOT_WINDOW);
+			atomic_init(&proxy.limits.connections, 0);
+			atomic_init(&proxy.limits.queued, 0);
+			proxy.limits.maxConnections = maxConnections;
+			proxy.limits.maxQueued = maxQueued;
+			proxy.limits.deadline = deadline;
+			if (rateInit(&proxy.rateLimiter, rate, burst) != 0)
+			{
+				LOG_ERROR("[-]Proxy %d: Could not allocate the rate limiter\n", proxyNum);
+				exit(1);
+			}
+			statsGaugeAdd(GAUGE_RATE_LIMIT, proxy.rateLimiter.rate);
+			statsGaugeAdd(GAUGE_RATE_BURST, proxy.rateLimiter.burst);
+			if (peersInit(&proxy.peers, proxyPorts, 5, PEER_MAX_IDLE) != 0)
+			{
+				LOG_ERROR("[-]Proxy %d: Could not set up connections to the other proxies. Terminating program.\n", proxyNum);
+				exit(1);
+			}
+			proxy.refreshQueue.size = REFRESH_QUEUE_SIZE;
+			proxy.refreshQueue.head = proxy.refreshQueue.count = 0;
+			if ((proxy.refreshQueue.requests = calloc(REFRESH_QUEUE_SIZE, sizeof(struct RefreshRequest))) == NULL)
+			{
+				LOG_ERROR("[-]Proxy %d: Could not allocate the refresh queue\n", proxyNum);
+				exit(1);
+			}
+			pthread_cond_init(&proxy.refreshQueue.ready, NULL);
 
-			proxy.bloomFilter = &bloomFilter;
-			bloomFilter.size = pow(2, 32) - 1; // to hold 30000 obj
-			bloomFilter.bloomFilter = malloc(bloomFilter.size * sizeof(u_int8_t));
-			proxy.numBlacklist = 0; // holds the number of blacklisted items
-			memset(bloomFilter.bloomFilter, 0, sizeof(bloomFilter.bloomFilter));
 
 			// if kill parent
 			int r = prctl(PR_SET_PDEATHSIG, SIGTERM);
@@ -501,45 +1535,73 @@ int main(int argc, char *argv[])
 				perror(0);
 				exit(1);
 			}
-			printf("[+]Reading black-listed objects from 'blacklisted.txt' and adding to black list on Proxy %d\n", proxyNum);
+			LOG_INFO("[+]Reading black-listed objects from 'blacklisted.txt' and adding to black list on Proxy %d\n", proxyNum);
 
-			FILE *fp;
-			char blackListFile[1024];
-			size_t fileLen = 0;
-			ssize_t read;
-			int i = 0;
-			if ((fp = fopen("../../src/proxy/blacklisted.txt", "r")) == NULL)
+			struct Blacklist *blacklist;
+			if ((blacklist = readBlacklist(proxyNames, proxyNum)) == NULL)
 			{
-				printf("[-]Failed to open the 'blacklisted.txt' file! Terminating program.\n");
+				LOG_ERROR("[-]Failed to open the 'blacklisted.txt' file! Terminating program.\n");
 				exit(1);
 			}
-			while (fgets(blackListFile, sizeof(blackListFile), fp) != NULL)
+			atomic_init(&proxy.blacklist, blacklist);
+			statsGaugeAdd(GAUGE_BLACKLIST_ENTRIES, blacklist->numEntries);
+			statsGaugeAdd(GAUGE_BLACKLIST_PATTERNS, blacklist->patterns.numPatterns);
+
+			// come back warm: restore the cache (and the Bloom filter, if the blacklist is unchanged) from the last snapshot
+			struct snapshot_data *snapshot_data = malloc(sizeof(struct snapshot_data));
+			int bloomRestored = 0, restored;
+			snapshot_data->proxy = &proxy;
+			snapshot_data->proxyNum = proxyNum;
+			snapshot_data->interval = snapshotInterval;
+			snprintf(snapshot_data->path, sizeof(snapshot_data->path), "%s/proxy%d.snapshot", snapshotDir, proxyNum);
+			uint64_t loadStart = statsNowUsec();
+			if ((restored = loadSnapshot(&proxy, proxyNum, snapshot_data->path, &bloomRestored)) >= 0)
 			{
-				if (blackListFile[strlen(blackListFile) - 1] == '\n')
+				LOG_INFO("[+]Proxy %d: Restored %d cached files from '%s' in %.2f ms\n", proxyNum, restored, snapshot_data->path, (statsNowUsec() - loadStart) / 1000.0);
+			}
+			if (!bloomRestored && buildFilter(blacklist, proxy.filterKind) != 0)
+			{
+				LOG_ERROR("[-]Proxy %d: Could not build the %s filter. Terminating program.\n", proxyNum, filterKindName(proxy.filterKind));
+				exit(1);
+			}
+			statsGaugeAdd(GAUGE_BLACKLIST_FILTER_BYTES, filterBytes(&blacklist->filter));
+			if (snapshotInterval > 0)
+			{
+				pthread_t snapshot_thread;
+				if (pthread_create(&snapshot_thread, NULL, &snapshotLoop, snapshot_data))
 				{
-					blackListFile[strlen(blackListFile) - 1] = '\0'; // eat the newline fgets() stores
+					LOG_WARN("[-]Proxy %d: Could not start snapshot thread. Cache will not be persisted.\n", proxyNum);
 				}
-				// add file to blacklist
-				if (whichProxy(proxyNames, blackListFile) == proxyNum)
+				else
 				{
-					// add file to blacklist if it belongs to this proxy
-					printf("\tADDING: '%s' to PROXY %d blacklist\n", blackListFile, proxyNum);
-					proxy.blackListed[proxy.numBlacklist] = strcpy(malloc(strlen(blackListFile) + 1), blackListFile);
-					proxy.numBlacklist += 1;
+					pthread_detach(snapshot_thread);
 				}
-				i++;
 			}
-			fclose(fp);
 
-			printf("[+]Successfully added blacklisted objects to black List.\n");
+			LOG_INFO("[+]Successfully added blacklisted objects to black List.\n");
+
+			// picks up blacklist changes without a restart
+			struct blacklist_data *blacklist_data = malloc(sizeof(struct blacklist_data));
+			pthread_t blacklist_thread;
+			blacklist_data->proxy = &proxy;
+			blacklist_data->proxyNum = proxyNum;
+			blacklist_data->proxyNames = proxyNames;
+			if (pthread_create(&blacklist_thread, NULL, &blacklistLoop, blacklist_data))
+			{
+				LOG_WARN("[-]Proxy %d: Could not start blacklist thread. Blacklist changes need a restart.\n", proxyNum);
+			}
+			else
+			{
+				pthread_detach(blacklist_thread);
+			}
 
 			sockfd = socket(AF_INET, SOCK_STREAM, 0);
 			if (sockfd < 0)
 			{
-				printf("[-]Error in connection.\n");
+				LOG_ERROR("[-]Error in connection.\n");
 				exit(1);
 			}
-			printf("[+]Proxy Socket %d is created on Port %d.\n", proxyNum, port);
+			LOG_INFO("[+]Proxy Socket %d is created on Port %d.\n", proxyNum, port);
 
 			memset(&proxyAddr, '\0', sizeof(proxyAddr));
 			proxyAddr.sin_family = AF_INET;
@@ -547,13 +1609,13 @@ int main(int argc, char *argv[])
 			proxyAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
 			if (proxyAddr.sin_addr.s_addr == INADDR_NONE)
 			{
-				fprintf(stderr, "Invalid IP address 127.0.0.1 \n");
+				LOG_ERROR("Invalid IP address 127.0.0.1 \n");
 				usage();
 			}
 
 			if (getppid() != ppid_before_fork)
 			{
-				printf("parent gone!\n");
+				LOG_ERROR("parent gone!\n");
 				exit(1);
 			}
 			ret = bind(sockfd, (struct sockaddr *)&proxyAddr, sizeof(proxyAddr));
@@ -562,77 +1624,129 @@ int main(int argc, char *argv[])
 				err(1, "[-]Proxy %d: Error in binding.\n", proxyNum);
 				exit(1);
 			}
-			printf("[+]Proxy %d: Bind to port %d\n", proxyNum, port);
+			LOG_INFO("[+]Proxy %d: Bind to port %d\n", proxyNum, port);
+
+			if (listen(sockfd, LISTEN_BACKLOG) == 0)
+			{
+				LOG_INFO("[+]Proxy %d: Listening....\n\n", proxyNum);
+			}
+			else
+			{
+				LOG_ERROR("[-]Error in listen.\n");
+			}
+
+			if (originsInit(&proxy.origins, serverAddresses, serverPorts, numServers, proxy.codecs, batchSize, batchWindow) != 0)
+			{
+				LOG_ERROR("[-]Proxy %d: Could not set up the connections to the servers\n", proxyNum);
+				exit(1);
+			}
 
-			if (listen(sockfd, 10) == 0)
+			// refreshes stale and hot entries so clients do not wait for the server
+			struct thread_data *refresh_data = calloc(1, sizeof(struct thread_data));
+			pthread_t refresh_thread;
+			if (refresh_data == NULL)
+			{
+				LOG_ERROR("[-]Proxy %d: Could not allocate the refresh thread's data\n", proxyNum);
+				exit(1);
+			}
+			refresh_data->proxy = &proxy;
+			refresh_data->proxyNum = proxyNum;
+			if (pthread_create(&refresh_thread, NULL, &refreshLoop, refresh_data))
 			{
-				printf("[+]Proxy %d: Listening....\n\n", proxyNum);
+				LOG_WARN("[-]Proxy %d: Could not start refresh thread. Expired entries will be revalidated by clients.\n", proxyNum);
+				proxy.cache.staleSeconds = proxy.cache.refreshAhead = 0;
 			}
 			else
 			{
-				printf("[-]Error in listen.\n");
+				pthread_detach(refresh_thread);
 			}
 
 			while (1)
 			{
-				struct tls_config *pcfg = NULL;
-				struct tls *pctx = NULL;
 				struct tls *pcctx = NULL;
 
-				printf("[+]Accepting new connections..\n");
+				LOG_DEBUG("[+]Accepting new connections..\n");
+				addr_size = sizeof(newAddr);
 				newSocket = accept(sockfd, (struct sockaddr *)&newAddr, &addr_size);
 				if (newSocket < 0)
 				{
-					exit(1);
+					LOG_WARN("[-]Proxy %d: accept failed: %s\n", proxyNum, strerror(errno));
+					// out of descriptors or memory: give the open connections a moment to finish
+					if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+						usleep(100000);
+					continue;
+				}
+				// shed the connection before spending a TLS handshake and a thread on it;
+				// the client moves on to the next proxy in its ranking
+				if (atomic_fetch_add(&proxy.limits.connections, 1) >= proxy.limits.maxConnections)
+				{
+					atomic_fetch_sub(&proxy.limits.connections, 1);
+					LOG_WARN("[!]Proxy %d: %d connections open, closing the one from %s:%d\n", proxyNum, proxy.limits.maxConnections, inet_ntoa(newAddr.sin_addr), ntohs(newAddr.sin_port));
+					statsInc(STAT_SHED_CONNECTIONS);
+					close(newSocket);
+					continue;
 				}
 
 				/* Securing Connection with TLS              */
 				/* Handshake is established from proxy's end */
 
-				printf("[+]Proxy %d: Securing socket with TLS...\n", proxyNum);
+				LOG_DEBUG("[+]Proxy %d: Securing socket with TLS...\n", proxyNum);
 				if (tls_accept_socket(ctx, &cctx, newSocket) != 0)
 				{
-					err(1, "[-]New socket could not be secured.");
-					exit(1);
+					LOG_WARN("[-]Proxy %d: New socket could not be secured: %s\n", proxyNum, tls_error(ctx));
+					statsInc(STAT_HANDSHAKE_FAILURES);
+					atomic_fetch_sub(&proxy.limits.connections, 1);
+					close(newSocket);
+					continue;
 				}
-				printf("[+]Proxy %d: Socket secured with TLS.\n", proxyNum);
+				LOG_DEBUG("[+]Proxy %d: Socket secured with TLS.\n", proxyNum);
 
-				printf("[+]Proxy %d: Connection accepted from %s:%d\n", proxyNum, inet_ntoa(newAddr.sin_addr), ntohs(newAddr.sin_port));
+				LOG_INFO("[+]Proxy %d: Connection accepted from %s:%d\n", proxyNum, inet_ntoa(newAddr.sin_addr), ntohs(newAddr.sin_port));
 
 				pthread_t thread_id;
-				struct thread_data *thread_data = malloc(sizeof(struct thread_data));
-
+				struct thread_data *thread_data = slabAlloc(sizeof(struct thread_data));
+				if (thread_data == NULL)
+				{
+					LOG_WARN("[-]Proxy %d: Out of memory, closing the connection.\n", proxyNum);
+					statsInc(STAT_SHED_CONNECTIONS);
+					atomic_fetch_sub(&proxy.limits.connections, 1);
+					tls_free(cctx);
+					close(newSocket);
+					continue;
+				}
 				thread_data->proxy = &proxy;
 				thread_data->proxyNum = proxyNum;
 				thread_data->newSocket = newSocket;
 				thread_data->newAddr = newAddr;
-				thread_data->server = server;
-				thread_data->serverSock = serverSock;
-				thread_data->serverPort = serverPort;
 				thread_data->cctx = cctx;
-				thread_data->pctx = pctx;
-				thread_data->pcfg = pcfg;
 
 				// create a thread to handle this connection
 				if (pthread_create(&thread_id, NULL, &handleClient, thread_data))
 				{
-					fprintf(stderr, "Thread creation failed.\n");
-					return 1;
+					LOG_WARN("[-]Proxy %d: Thread creation failed, closing the connection.\n", proxyNum);
+					statsInc(STAT_SHED_CONNECTIONS);
+					atomic_fetch_sub(&proxy.limits.connections, 1);
+					tls_free(cctx);
+					close(newSocket);
+					slabFree(thread_data, sizeof(struct thread_data));
+					continue;
 				}
-				// close thread
-				pthread_join(thread_id, NULL);
+				// the thread owns thread_data and the connection from here on
+				pthread_detach(thread_id);
 				if (getppid() != ppid_before_fork)
 				{
-					printf("parent gone!\n");
+					LOG_ERROR("parent gone!\n");
 					exit(1);
 				}
 			}
-			printf("close\n");
+			LOG_DEBUG("close\n");
 			free(ctx); // Free context for next usage
 			close(newSocket); // Close socket
 			return 0;
 		}
 	}
-	wait(NULL);
+	// one proxy going down must not take the others with it (they die with us, see PR_SET_PDEATHSIG)
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
 	return 0;
 }
\ No newline at end of file
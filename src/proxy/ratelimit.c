@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ratelimit.h"
+#include "stats.h"
+
+/**
+ * Sets up limiter to allow rate requests per second per client, in bursts of up to burst.
+ * A rate of 0 turns rate limiting off, a burst of 0 allows one second's worth.
+ * Returns 0 on success, -1 on failure
+ * */
+int rateInit(struct RateLimiter *limiter, int rate, int burst)
+{
+	memset(limiter, 0, sizeof(*limiter));
+	if (rate <= 0)
+	{
+		return 0;
+	}
+	if (posix_memalign((void **)&limiter->shards, 64, RATE_SHARDS * sizeof(struct RateShard)) != 0)
+	{
+		limiter->shards = NULL;
+		return -1;
+	}
+	memset(limiter->shards, 0, RATE_SHARDS * sizeof(struct RateShard));
+	for (int i = 0; i < RATE_SHARDS; i++)
+		pthread_mutex_init(&limiter->shards[i].lock, NULL);
+	limiter->rate = rate;
+	limiter->burst = burst > 0 ? burst : rate;
+	return 0;
+}
+
+// spreads consecutive addresses over shards and slots
+static uint64_t mix(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key;
+}
+
+/**
+ * Takes a token from the client's bucket.
+ * Returns 1 if the client may make the request, 0 if it is over its rate
+ * */
+int rateAllow(struct RateLimiter *limiter, uint64_t key)
+{
+	if (limiter->shards == NULL)
+	{
+		return 1;
+	}
+	uint64_t h = mix(key), now = statsNowUsec();
+	struct RateShard *shard = &limiter->shards[h & (RATE_SHARDS - 1)];
+	struct RateBucket *bucket = NULL, *victim = NULL;
+	size_t slot = (h >> 32) & (RATE_SLOTS - 1);
+	int allowed;
+
+	pthread_mutex_lock(&shard->lock);
+	for (int i = 0; i < RATE_PROBES; i++)
+	{
+		struct RateBucket *b = &shard->buckets[(slot + i) & (RATE_SLOTS - 1)];
+		if (b->updated != 0 && b->key == key)
+		{
+			bucket = b;
+			break;
+		}
+		if (victim == NULL || b->updated < victim->updated)
+			victim = b;
+	}
+	if (bucket == NULL)
+	{
+		// a client we have not seen, or forgot, starts with a full bucket
+		bucket = victim;
+		bucket->key = key;
+		bucket->tokens = limiter->burst;
+	}
+	else
+	{
+		bucket->tokens += (now - bucket->updated) * limiter->rate / 1e6;
+		if (bucket->tokens > limiter->burst)
+			bucket->tokens = limiter->burst;
+	}
+	bucket->updated = now;
+	if ((allowed = bucket->tokens >= 1))
+		bucket->tokens -= 1;
+	pthread_mutex_unlock(&shard->lock);
+	return allowed;
+}
@@ -0,0 +1,42 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define RATE_SHARDS 16		// power of two
+#define RATE_SLOTS 256		// clients tracked per shard, power of two
+#define RATE_PROBES 8		// slots a client may be found in
+
+/**
+ * Token buckets, one per client, refilled at rate tokens per second up to burst.
+ * Clients are identified by a 64-bit key: their IPv4 address for now, a hash of their
+ * certificate once clients present one. The table is split into shards with a lock each,
+ * so clients in different shards never contend, and a check takes one uncontended lock.
+ * A shard holds a fixed number of clients; a new client takes the slot of the one that
+ * has been idle longest, whose bucket would have refilled by now anyway.
+ * */
+struct RateBucket
+{
+	uint64_t key;
+	uint64_t updated; // statsNowUsec() of the last refill, 0 for an empty slot
+	double tokens;
+};
+
+struct RateShard
+{
+	pthread_mutex_t lock;
+	struct RateBucket buckets[RATE_SLOTS];
+} __attribute__((aligned(64)));
+
+struct RateLimiter
+{
+	struct RateShard *shards; // NULL when rate limiting is off
+	double rate;
+	double burst;
+};
+
+int rateInit(struct RateLimiter *limiter, int rate, int burst);
+int rateAllow(struct RateLimiter *limiter, uint64_t key);
+
+#endif
@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "trace.h"
+
+/**
+ * Appends the buffered records to the file. Must be called with trace->lock held, and releases it:
+ * records go to the other buffer while this one is written, so recording never waits for the disk
+ * unless that buffer fills up too. writeLock is taken before lock is released, so buffers are
+ * written in the order they were filled.
+ * */
+static void flushRecords(struct Trace *trace)
+{
+	const char *records = (const char *)trace->records[trace->active];
+	size_t length = trace->numRecords * sizeof(struct TraceRecord), written = 0;
+	ssize_t n;
+
+	pthread_mutex_lock(&trace->writeLock);
+	trace->active ^= 1;
+	trace->numRecords = 0;
+	pthread_mutex_unlock(&trace->lock);
+	while (written < length)
+	{
+		if ((n = write(trace->fd, records + written, length - written)) < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			LOG_WARN("[-]Could not write trace: %s\n", strerror(errno));
+			break;
+		}
+		written += n;
+	}
+	pthread_mutex_unlock(&trace->writeLock);
+}
+
+/**
+ * Writes out what was recorded in the last second
+ * */
+static void *flushLoop(void *inputs)
+{
+	struct Trace *trace = (struct Trace *)inputs;
+
+	while (1)
+	{
+		sleep(1);
+		pthread_mutex_lock(&trace->lock);
+		if (trace->numRecords > 0)
+			flushRecords(trace);
+		else
+			pthread_mutex_unlock(&trace->lock);
+	}
+	return NULL;
+}
+
+/**
+ * Starts appending records to path. A file written by another version is started over.
+ * Returns 0 on success, -1 on failure
+ * */
+int traceOpen(struct Trace *trace, const char *path, int proxyNum)
+{
+	struct TraceHeader header = {.magic = "TLSTRACE", .version = TRACE_VERSION, .proxyNum = proxyNum}, existing;
+	pthread_t thread;
+
+	pthread_mutex_init(&trace->lock, NULL);
+	pthread_mutex_init(&trace->writeLock, NULL);
+	trace->active = trace->numRecords = 0;
+	if ((trace->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+	{
+		return -1;
+	}
+	if (pread(trace->fd, &existing, sizeof(existing), 0) != sizeof(existing) ||
+		memcmp(&existing, &header, sizeof(header)) != 0 ||
+		(lseek(trace->fd, 0, SEEK_END) - sizeof(header)) % sizeof(struct TraceRecord) != 0)
+	{
+		if (ftruncate(trace->fd, 0) != 0 || pwrite(trace->fd, &header, sizeof(header), 0) != sizeof(header))
+		{
+			close(trace->fd);
+			trace->fd = -1;
+			return -1;
+		}
+	}
+	lseek(trace->fd, 0, SEEK_END);
+	if (pthread_create(&thread, NULL, &flushLoop, trace) != 0)
+	{
+		close(trace->fd);
+		trace->fd = -1;
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+void traceRecord(struct Trace *trace, const struct TraceRecord *record)
+{
+	if (trace->fd < 0)
+	{
+		return;
+	}
+	pthread_mutex_lock(&trace->lock);
+	while (trace->numRecords == TRACE_BUFFER)
+	{
+		flushRecords(trace);
+		pthread_mutex_lock(&trace->lock);
+	}
+	trace->records[trace->active][trace->numRecords++] = *record;
+	pthread_mutex_unlock(&trace->lock);
+}
@@ -0,0 +1,59 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define TRACE_VERSION 1
+#define TRACE_BUFFER 1024 // records kept in memory, written out every second or when full
+
+/**
+ * A proxy's request trace: one fixed size record per client request, appended to a file
+ * after a header. Records hold a hash of the name rather than the name, so a trace is
+ * compact and does not leak what was requested. tools/cachesim replays traces.
+ * */
+enum TraceOutcome
+{
+	TRACE_HIT,		   // served from the cache
+	TRACE_REVALIDATED, // expired in the cache, and checked with the server
+	TRACE_MISS,		   // fetched from the server
+	TRACE_NOT_FOUND,   // the server does not have it
+	TRACE_NEGATIVE,	   // known not to exist, see the negative cache
+	TRACE_ERROR,	   // not in the cache, and the server could not be reached
+	TRACE_FORWARDED,   // answered by the proxy that owns it
+	TRACE_DENIED,	   // blacklisted
+	TRACE_REFUSED,	   // rate limited or too busy
+};
+
+struct TraceHeader
+{
+	char magic[8]; // "TLSTRACE"
+	uint32_t version;
+	uint32_t proxyNum;
+};
+
+struct TraceRecord
+{
+	uint64_t timestamp; // microseconds since the epoch, when the request was read
+	uint64_t key;		// hashString() of the name
+	uint32_t nameSum;	// stringToInt() of the name, all whichProxy() looks at
+	uint32_t size;		// bytes of the reply
+	uint32_t latency;	// microseconds until the reply was sent
+	uint8_t outcome;	// enum TraceOutcome
+	uint8_t reserved[3];
+};
+
+struct Trace
+{
+	pthread_mutex_t lock;
+	pthread_mutex_t writeLock; // held while a full buffer is written, without lock
+	int fd;					   // -1 when tracing is off
+	struct TraceRecord records[2][TRACE_BUFFER];
+	int active; // the buffer records are added to, the other one may be being written
+	int numRecords;
+};
+
+int traceOpen(struct Trace *trace, const char *path, int proxyNum);
+void traceRecord(struct Trace *trace, const struct TraceRecord *record);
+
+#endif
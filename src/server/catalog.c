@@ -0,0 +1,272 @@
+#define _GNU_SOURCE // memmem
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "catalog.h"
+#include "hash.h"
+
+#define CATALOG_MIN_BUCKETS 64
+
+void catalogInit(struct Catalog *catalog, size_t maxBytes)
+{
+	memset(catalog, 0, sizeof(*catalog));
+	catalog->maxBytes = maxBytes;
+}
+
+void catalogClear(struct Catalog *catalog)
+{
+	free(catalog->buckets);
+	arenaFree(&catalog->arena);
+	catalogInit(catalog, catalog->maxBytes);
+}
+
+size_t catalogBytes(const struct Catalog *catalog)
+{
+	return catalog->arena.bytes + catalog->numBuckets * sizeof(struct CatalogEntry);
+}
+
+// hashString() of the first length bytes of name
+static uint64_t hashName(const char *name, size_t length)
+{
+	return hashBytes(HASH_SEED, name, length);
+}
+
+static struct CatalogEntry *findBucket(struct CatalogEntry *buckets, size_t numBuckets, uint64_t hash,
+									   const char *name, size_t nameLength)
+{
+	size_t i = hash & (numBuckets - 1);
+	while (buckets[i].line != NULL &&
+		   !(buckets[i].hash == hash && buckets[i].nameLength == nameLength && memcmp(buckets[i].line, name, nameLength) == 0))
+		i = (i + 1) & (numBuckets - 1);
+	return &buckets[i];
+}
+
+/**
+ * Doubles the table once it is half full
+ * Returns 0 on success, -1 if that would take the catalog over maxBytes
+ * */
+static int grow(struct Catalog *catalog)
+{
+	size_t numBuckets = catalog->numBuckets == 0 ? CATALOG_MIN_BUCKETS : catalog->numBuckets * 2;
+	struct CatalogEntry *buckets;
+
+	if ((catalog->numEntries + 1) * 2 <= catalog->numBuckets)
+		return 0;
+	if (catalog->arena.bytes + numBuckets * sizeof(struct CatalogEntry) > catalog->maxBytes ||
+		(buckets = calloc(numBuckets, sizeof(struct CatalogEntry))) == NULL)
+		return -1;
+	for (size_t i = 0; i < catalog->numBuckets; i++)
+	{
+		struct CatalogEntry *entry = &catalog->buckets[i];
+		if (entry->line != NULL)
+			*findBucket(buckets, numBuckets, entry->hash, entry->line, entry->nameLength) = *entry;
+	}
+	free(catalog->buckets);
+	catalog->buckets = buckets;
+	catalog->numBuckets = numBuckets;
+	return 0;
+}
+
+/**
+ * Adds the length bytes of line, whose name is hashed to hash and nameLength long.
+ * Returns 0 if it was added or its name already was, -1 if the catalog is full
+ * */
+static int insertLine(struct Catalog *catalog, const char *line, size_t length, uint64_t hash, size_t nameLength)
+{
+	struct CatalogEntry *entry;
+	char *copy;
+
+	if (catalog->maxBytes == 0 || grow(catalog) != 0)
+		return -1;
+	entry = findBucket(catalog->buckets, catalog->numBuckets, hash, line, nameLength);
+	if (entry->line != NULL)
+		return 0;
+	if (catalogBytes(catalog) + length + 1 > catalog->maxBytes || (copy = arenaAlloc(&catalog->arena, length + 1)) == NULL)
+		return -1;
+	memcpy(copy, line, length);
+	copy[length] = '\0';
+	*entry = (struct CatalogEntry){.hash = hash, .line = copy, .nameLength = nameLength};
+	catalog->numEntries++;
+	return 0;
+}
+
+/**
+ * Adds a line as files.txt holds it, without the line break.
+ * Returns 0 on success, -1 if the line has no name or the catalog is full
+ * */
+int catalogInsert(struct Catalog *catalog, const char *line)
+{
+	const char *separator = strstr(line, ": ");
+	if (separator == NULL)
+	{
+		return -1;
+	}
+	return insertLine(catalog, line, strlen(line), hashName(line, separator - line), separator - line);
+}
+
+/**
+ * Returns the line for the file called name, NULL if it is not in the catalog
+ * */
+const char *catalogLookup(struct Catalog *catalog, const char *name)
+{
+	size_t nameLength = strlen(name);
+
+	if (catalog->numEntries == 0)
+	{
+		return NULL;
+	}
+	return findBucket(catalog->buckets, catalog->numBuckets, hashName(name, nameLength), name, nameLength)->line;
+}
+
+/**
+ * Empties the catalog if path is not the file it was filled from
+ * Returns 1 if it was emptied, 0 if not, -1 if path cannot be read
+ * */
+int catalogCheck(struct Catalog *catalog, const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0)
+	{
+		return -1;
+	}
+	if (st.st_mtime == catalog->mtime && st.st_size == catalog->size && st.st_ino == catalog->inode)
+	{
+		return 0;
+	}
+	catalogClear(catalog);
+	catalog->mtime = st.st_mtime;
+	catalog->size = st.st_size;
+	catalog->inode = st.st_ino;
+	return 1;
+}
+
+// where one line of the file lies, found by a loader thread
+struct CatalogLine
+{
+	size_t offset;
+	size_t length; // without the line break
+	size_t nameLength;
+	uint64_t hash;
+};
+
+// one loader thread's share of the file: the lines starting in [start, end)
+struct load_data
+{
+	const char *text;
+	size_t start;
+	size_t end;
+	size_t size; // of text
+	struct CatalogLine *lines;
+	size_t numLines;
+};
+
+/**
+ * Finds the lines in a share of the file and hashes their names
+ * */
+static void *loadLines(void *inputs)
+{
+	struct load_data *data = (struct load_data *)inputs;
+	size_t capacity = 0, position = data->start;
+
+	while (position < data->end)
+	{
+		const char *line = data->text + position;
+		const char *newline = memchr(line, '\n', data->size - position);
+		size_t length = newline != NULL ? (size_t)(newline - line) : data->size - position;
+		size_t next = position + length + 1;
+		const char *separator;
+
+		// like getFileContent(), which drops the "\r\n"
+		if (length > 0 && line[length - 1] == '\r')
+			length--;
+		separator = memmem(line, length, ": ", 2);
+		if (separator != NULL)
+		{
+			if (data->numLines == capacity)
+			{
+				capacity = capacity == 0 ? 256 : capacity * 2;
+				struct CatalogLine *lines = realloc(data->lines, capacity * sizeof(struct CatalogLine));
+				if (lines == NULL)
+					break;
+				data->lines = lines;
+			}
+			data->lines[data->numLines++] = (struct CatalogLine){.offset = position, .length = length, .nameLength = separator - line, .hash = hashName(line, separator - line)};
+		}
+		position = next;
+	}
+	return NULL;
+}
+
+/**
+ * Fills the catalog with every line of path, or as many as fit in maxBytes.
+ * threads threads split the file between them to find and hash the lines,
+ * which are then added in file order, so the first line of a name wins like in a scan.
+ * Returns the number of lines in the catalog, -1 if path cannot be read
+ * */
+int catalogLoad(struct Catalog *catalog, const char *path, int threads)
+{
+	struct load_data data[threads];
+	pthread_t ids[threads];
+	int started[threads], fd;
+	char *text;
+	ssize_t n;
+	size_t size = 0;
+
+	if (catalogCheck(catalog, path) < 0 || (fd = open(path, O_RDONLY)) < 0)
+	{
+		return -1;
+	}
+	if ((text = malloc(catalog->size + 1)) == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+	while (size < (size_t)catalog->size && (n = read(fd, text + size, catalog->size - size)) > 0)
+		size += n;
+	close(fd);
+
+	// each thread takes the lines that start in its share
+	for (int i = 0; i < threads; i++)
+	{
+		data[i] = (struct load_data){.text = text, .start = size * i / threads, .end = size * (i + 1) / threads, .size = size};
+		if (data[i].start > 0)
+		{
+			const char *newline = memchr(text + data[i].start - 1, '\n', size - data[i].start + 1);
+			data[i].start = newline != NULL ? (size_t)(newline - text) + 1 : size;
+		}
+	}
+	for (int i = 0; i < threads; i++)
+	{
+		if (i + 1 < threads)
+			data[i].end = data[i + 1].start;
+		started[i] = i > 0 && pthread_create(&ids[i], NULL, &loadLines, &data[i]) == 0;
+	}
+	loadLines(&data[0]);
+	for (int i = 1; i < threads; i++)
+	{
+		if (started[i])
+			pthread_join(ids[i], NULL);
+		else
+			loadLines(&data[i]);
+	}
+
+	catalog->complete = 1;
+	for (int i = 0; i < threads; i++)
+	{
+		for (size_t j = 0; j < data[i].numLines && catalog->complete; j++)
+		{
+			struct CatalogLine *line = &data[i].lines[j];
+			if (insertLine(catalog, text + line->offset, line->length, line->hash, line->nameLength) != 0)
+				catalog->complete = 0;
+		}
+		free(data[i].lines);
+	}
+	free(text);
+	return catalog->numEntries;
+}
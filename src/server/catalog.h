@@ -0,0 +1,47 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "arena.h"
+
+/**
+ * The server's in-memory copy of files.txt lines, indexed by file name: the text
+ * before the line's first ": ". Lines are added when they are first looked up, or all
+ * at once by catalogLoad(), until the lines and the table take maxBytes.
+ * The catalog remembers which version of files.txt it was filled from, and
+ * catalogCheck() empties it when the file changed since. Not thread safe.
+ * */
+struct CatalogEntry
+{
+	uint64_t hash;	   // hashString() of the name
+	const char *line;  // NULL for an empty bucket
+	size_t nameLength; // the name is the start of line
+};
+
+struct Catalog
+{
+	struct CatalogEntry *buckets; // open addressing, numBuckets is a power of two
+	size_t numBuckets;
+	size_t numEntries;
+	size_t maxBytes; // 0 turns the catalog off
+	int complete;	 // every line of the file is in the catalog
+	struct Arena arena;
+	// files.txt when the catalog was filled
+	time_t mtime;
+	off_t size;
+	ino_t inode;
+};
+
+void catalogInit(struct Catalog *catalog, size_t maxBytes);
+int catalogLoad(struct Catalog *catalog, const char *path, int threads);
+int catalogCheck(struct Catalog *catalog, const char *path);
+const char *catalogLookup(struct Catalog *catalog, const char *name);
+int catalogInsert(struct Catalog *catalog, const char *line);
+size_t catalogBytes(const struct Catalog *catalog);
+void catalogClear(struct Catalog *catalog);
+
+#endif
@@ -14,12 +14,47 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <sys/sendfile.h>
 #include <fcntl.h>
 #include <math.h>
+#include <time.h>
 #include <tls.h> // for TLS
+
+#include "catalog.h"
+#include "compress.h"
+#include "hash.h"
+#include "log.h"
+#include "net.h"
+#include "protocol.h"
+#include "stats.h"
+#include "storage.h"
+
 #define PORT 9998
+#define ADMIN_PORT 9989
+#define OBJECT_TTL 60 // seconds a proxy may serve an object before revalidating it
+#define LISTEN_BACKLOG 128
+#define HANDSHAKE_TIMEOUT 2000 // milliseconds a proxy has to complete the TLS handshake
+#define IDLE_TIMEOUT 30000	   // milliseconds a proxy may keep its connection open between multi-gets
+#define FILES_PATH "../../src/server/files.txt"
+#define CATALOG_MEGABYTES 64 // memory for files.txt lines kept in memory, 0 disables the catalog
+#define LOAD_THREADS 4
+
+// files.txt lines looked up before; filled at startup when preloading, and inherited by every connection
+static struct Catalog catalog;
+// the directory files are served from instead of files.txt, with the files each connection keeps open
+static struct Store store = {.root = -1};
+
+/**
+ * A files.txt line is "<name>: <content>"; it is the file called name only if its name is exactly
+ * name, the same rule the catalog and the storage directory follow
+ * */
+static int lineHasName(const char *line, const char *name)
+{
+	size_t length = strlen(name);
+	return strncmp(line, name, length) == 0 && line[length] == ':' && line[length + 1] == ' ';
+}
 
 /**
  *  Finds the filename in the database and puts the content into buffer 
@@ -36,7 +71,7 @@ int getFileContent(FILE *database, const char *filename, char *buffer)
 	{
 		line[read-2] = '\0';
 		//printf("'%s'\n", line);
-		if (strstr(line, filename) != NULL)
+		if (lineHasName(line, filename))
 		{
 			strcpy(buffer, line);
 			return 0;
@@ -45,10 +80,255 @@ int getFileContent(FILE *database, const char *filename, char *buffer)
 	return -1;
 }
 
+/**
+ * Finds each of the count names in one pass over the database, the first line with
+ * a name being its file like in getFileContent(). contents must hold count buffers of 1024 bytes.
+ * found[i] is set to 1 if names[i] was found
+ * */
+static void getFileContents(FILE *database, char **names, int count, char (*contents)[1024], int *found)
+{
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t read;
+	int missing = count;
+
+	memset(found, 0, count * sizeof(int));
+	while (missing > 0 && (read = getline(&line, &len, database)) > 0)
+	{
+		line[read - 2] = '\0';
+		for (int i = 0; i < count; i++)
+		{
+			if (!found[i] && lineHasName(line, names[i]))
+			{
+				strcpy(contents[i], line);
+				found[i] = 1;
+				missing--;
+			}
+		}
+	}
+	free(line);
+}
+
+/**
+ * Finds each of the count names in the catalog, and those that are not there in one pass over
+ * files.txt, adding what that pass finds to the catalog, or in the storage directory if there is one.
+ * found[i] is set to 1 if names[i] was found
+ * */
+static void findFiles(char **names, int count, char (*contents)[1024], int *found)
+{
+	char *missing[count];
+	int missingIndex[count], missingFound[count], numMissing = 0;
+	FILE *db;
+
+	if (store.root >= 0)
+	{
+		storeFind(&store, names, count, contents, found);
+		return;
+	}
+	// the copy of a file that changed since is dropped
+	catalogCheck(&catalog, FILES_PATH);
+	for (int i = 0; i < count; i++)
+	{
+		const char *line = catalogLookup(&catalog, names[i]);
+		if ((found[i] = line != NULL))
+		{
+			statsInc(STAT_CATALOG_HITS);
+			strcpy(contents[i], line);
+		}
+		else
+		{
+			statsInc(STAT_CATALOG_MISSES);
+			missingIndex[numMissing] = i;
+			missing[numMissing++] = names[i];
+		}
+	}
+	if (numMissing == 0)
+	{
+		return;
+	}
+	if ((db = fopen(FILES_PATH, "r")) == NULL)
+	{
+		LOG_ERROR("[-]Error! opening file 'files.txt'\n");
+		return;
+	}
+	if (numMissing == 1)
+		missingFound[0] = getFileContent(db, missing[0], contents[missingIndex[0]]) == 0;
+	else
+	{
+		char(*missingContents)[1024] = malloc(numMissing * sizeof(*missingContents));
+		if (missingContents != NULL)
+		{
+			getFileContents(db, missing, numMissing, missingContents, missingFound);
+			for (int i = 0; i < numMissing; i++)
+			{
+				if (missingFound[i])
+					strcpy(contents[missingIndex[i]], missingContents[i]);
+			}
+			free(missingContents);
+		}
+		else
+			memset(missingFound, 0, sizeof(missingFound));
+	}
+	fclose(db);
+	for (int i = 0; i < numMissing; i++)
+	{
+		if ((found[missingIndex[i]] = missingFound[i]))
+			catalogInsert(&catalog, contents[missingIndex[i]]);
+	}
+}
+
+/**
+ * Puts the reply for a file whose files.txt line is fileContent, NULL if it does not exist,
+ * into reply (ORIGIN_REPLY_SIZE bytes), for a proxy that has cachedVersion and accepts codecs.
+ * Returns the reply length
+ * */
+static int formatReply(const char *fileContent, uint64_t cachedVersion, unsigned codecs, int ttl, char *reply)
+{
+	char compressed[1024];
+	uint64_t version;
+	int codec, replyLength;
+	ssize_t compressedLength;
+
+	if (fileContent == NULL)
+	{
+		statsInc(STAT_OBJECTS_MISSING);
+		return snprintf(reply, ORIGIN_REPLY_SIZE, "%s", ORIGIN_NOT_FOUND_REPLY) + 1;
+	}
+	// the version changes whenever the object's line in files.txt, or its file, does
+	version = hashString(fileContent);
+	if (version == cachedVersion)
+	{
+		statsInc(STAT_NOT_MODIFIED);
+		replyLength = snprintf(reply, ORIGIN_REPLY_SIZE, "NOTMODIFIED %" PRIx64 " %d", version, ttl) + 1;
+	}
+	else if ((codec = codecPick(codecs)) != CODEC_NONE &&
+			 (compressedLength = codecCompress(codec, fileContent, strlen(fileContent), compressed, sizeof(compressed))) > 0)
+	{
+		LOG_DEBUG("Sending file compressed with %s to proxy: '%s'\n", codecName(codec), fileContent);
+		statsInc(STAT_OBJECTS_SERVED);
+		statsInc(STAT_COMPRESSED_REPLIES);
+		statsAdd(STAT_COMPRESSION_SAVED_BYTES, strlen(fileContent) - compressedLength);
+		replyLength = snprintf(reply, ORIGIN_REPLY_SIZE, "OKZ %" PRIx64 " %d %d %zd\n", version, ttl, codec, compressedLength);
+		memcpy(reply + replyLength, compressed, compressedLength);
+		replyLength += compressedLength;
+	}
+	else
+	{
+		LOG_DEBUG("Sending file: filecontent to proxy: '%s'\n", fileContent);
+		statsInc(STAT_OBJECTS_SERVED);
+		replyLength = snprintf(reply, ORIGIN_REPLY_SIZE, "OK %" PRIx64 " %d\n%s", version, ttl, fileContent) + 1;
+	}
+	return replyLength;
+}
+
+static int writeFull(struct tls *cctx, const char *buffer, size_t length)
+{
+	size_t sent = 0;
+	ssize_t n;
+
+	while (sent < length)
+	{
+		n = tls_write(cctx, buffer + sent, length - sent);
+		if (n == TLS_WANT_POLLIN || n == TLS_WANT_POLLOUT)
+			continue;
+		if (n <= 0)
+			return -1;
+		sent += n;
+	}
+	return 0;
+}
+
+/**
+ * Answers a multi-get (see protocol.h) whose first received bytes are in first,
+ * with one pass over the database.
+ * Returns 0 on success, -1 if the connection failed or the request is corrupt
+ * */
+static int serveBatch(struct tls *cctx, const char *first, size_t received, int ttl)
+{
+	char *names[ORIGIN_BATCH_MAX], *line, *end;
+	// each connection has a process of its own
+	static char request[ORIGIN_BATCH_REQUEST_SIZE], contents[ORIGIN_BATCH_MAX][1024], reply[ORIGIN_REPLY_SIZE];
+	static char replies[ORIGIN_BATCH_MAX * (ORIGIN_REPLY_SIZE + 24) + 32];
+	uint64_t versions[ORIGIN_BATCH_MAX];
+	int count, found[ORIGIN_BATCH_MAX], offset = 0, length, repliesLength;
+	unsigned codecs;
+	ssize_t n;
+
+	memcpy(request, first, received);
+	// the request ends with a NUL
+	while (memchr(request, '\0', received) == NULL)
+	{
+		if (received == ORIGIN_BATCH_REQUEST_SIZE ||
+			(n = tls_read(cctx, request + received, ORIGIN_BATCH_REQUEST_SIZE - received)) <= 0)
+			return -1;
+		received += n;
+	}
+	if (sscanf(request, ORIGIN_MULTI_GET " %d %x\n%n", &count, &codecs, &offset) != 2 || offset == 0 ||
+		count < 0 || count > ORIGIN_BATCH_MAX)
+		return -1;
+	line = request + offset;
+	for (int i = 0; i < count; i++)
+	{
+		versions[i] = strtoull(line, &names[i], 16);
+		if (*names[i] != ' ' || (end = strchr(names[i], '\n')) == NULL)
+			return -1;
+		*end = '\0';
+		names[i]++;
+		line = end + 1;
+	}
+	LOG_INFO("[+]Proxy requests %d files\n", count);
+	statsInc(STAT_ORIGIN_BATCHES);
+	statsAdd(STAT_ORIGIN_BATCHED_FILES, count);
+	statsAdd(STAT_REQUESTS, count);
+
+	findFiles(names, count, contents, found);
+	repliesLength = snprintf(replies, sizeof(replies), ORIGIN_MULTI_GET " %d\n", count);
+	for (int i = 0; i < count; i++)
+	{
+		length = formatReply(found[i] ? contents[i] : NULL, versions[i], codecs, ttl, reply);
+		repliesLength += snprintf(replies + repliesLength, sizeof(replies) - repliesLength, "%d\n", length);
+		memcpy(replies + repliesLength, reply, length);
+		repliesLength += length;
+	}
+	if (writeFull(cctx, replies, repliesLength) != 0)
+	{
+		LOG_WARN("[-]Could not send replies to proxy: %s\n", tls_error(cctx));
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Fills the catalog with all of files.txt
+ * */
+static void preloadCatalog(int threads)
+{
+	static int64_t entries, bytes; // what the gauges report
+
+	int loaded = catalogLoad(&catalog, FILES_PATH, threads);
+	if (loaded < 0)
+	{
+		LOG_WARN("[-]Could not preload 'files.txt'\n");
+		loaded = 0;
+	}
+	else if (!catalog.complete)
+	{
+		LOG_WARN("[!]Preloaded %d files, the rest of 'files.txt' does not fit in the catalog\n", loaded);
+	}
+	else
+	{
+		LOG_INFO("[+]Preloaded %d files, %zu bytes\n", loaded, catalogBytes(&catalog));
+	}
+	statsGaugeAdd(GAUGE_CATALOG_ENTRIES, loaded - entries);
+	statsGaugeAdd(GAUGE_CATALOG_BYTES, (int64_t)catalogBytes(&catalog) - bytes);
+	entries = loaded;
+	bytes = catalogBytes(&catalog);
+}
+
 static void usage()
 {
 	extern char *__progname;
-	fprintf(stderr, "usage: %s\n", __progname);
+	fprintf(stderr, "usage: %s [-l error|warn|info|debug] [-t ttl] [-c catalog-megabytes] [-p] [-j load-threads] [-r root-dir] [-a address] [-P port] [-A admin-port]\n", __progname);
 	exit(1);
 }
 
@@ -82,6 +362,55 @@ int main(int argc, char *argv[])
 	struct tls *cctx = NULL;
 	uint8_t *mem;
 	size_t mem_len;
+	int ch, level = LOG_LEVEL_INFO, ttl = OBJECT_TTL;
+	int catalogMegabytes = CATALOG_MEGABYTES, preload = 0, loadThreads = LOAD_THREADS;
+	const char *root = NULL;
+	int listenPort = PORT, adminPort = ADMIN_PORT;
+	struct in_addr listenAddress = {.s_addr = htonl(INADDR_LOOPBACK)};
+
+	while ((ch = getopt(argc, argv, "a:A:c:j:l:pP:r:t:")) != -1)
+	{
+		switch (ch)
+		{
+		case 'a':
+			if (inet_pton(AF_INET, optarg, &listenAddress) != 1)
+				usage();
+			break;
+		case 'A':
+			if ((adminPort = atoi(optarg)) <= 0 || adminPort > 65535)
+				usage();
+			break;
+		case 'c':
+			if ((catalogMegabytes = atoi(optarg)) < 0)
+				usage();
+			break;
+		case 'j':
+			if ((loadThreads = atoi(optarg)) <= 0)
+				usage();
+			break;
+		case 'p':
+			preload = 1;
+			break;
+		case 'P':
+			if ((listenPort = atoi(optarg)) <= 0 || listenPort > 65535)
+				usage();
+			break;
+		case 'r':
+			root = optarg;
+			break;
+		case 'l':
+			if ((level = logParseLevel(optarg)) < 0)
+				usage();
+			break;
+		case 't':
+			if ((ttl = atoi(optarg)) < 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	logInit(level);
 
 		//Init TLS
 	if (tls_init() != 0)
@@ -96,7 +425,7 @@ int main(int argc, char *argv[])
 		err(1, "tls_config_new:");
 	}
 
-	printf("[+]TLS config created.\n");
+	LOG_DEBUG("[+]TLS config created.\n");
 
 	/*Setting the auth certificate for proxy*/
 
@@ -105,37 +434,59 @@ int main(int argc, char *argv[])
 		err(1, "[-]tls_config_set_ca_file error\n");
 	}
 
-	printf("[+]TLS server root certificate set.\n");
+	LOG_DEBUG("[+]TLS server root certificate set.\n");
 
 	if(tls_config_set_cert_file(cfg, "../../certificates/root.pem") != 0) //Set server certificate
 	{
 		err(1, "[-]tls_config_set_cert_file error\n");
 	}
 
-	printf("[+]TLS server certificate set.\n");
+	LOG_DEBUG("[+]TLS server certificate set.\n");
 
 	if(tls_config_set_key_file(cfg, "../../certificates//root/private/ca.key.pem") != 0) //Set server certificate
 	{
 		err(1, "[-]tls_config_set_key_file error");
 	}
 
-	printf("[+]TLS server private key set.\n");
+	LOG_DEBUG("[+]TLS server private key set.\n");
 
 	if((ctx = tls_server())== NULL)
 	{
 		err(1, "[-]tls_server error");
 	}
 
-	printf("[+]TLS server created.\n");
+	LOG_DEBUG("[+]TLS server created.\n");
 
 	if(tls_configure(ctx, cfg) != 0)
 	{
 		err(1, "[-]tls_configure: %s", tls_error(ctx));
 	}
-	printf("[+]TLS server instance created.\n");
+	LOG_DEBUG("[+]TLS server instance created.\n");
 
 	errno = 0;
-	port = PORT;
+	port = listenPort;
+
+	// counters live in shared memory so the per-connection children below report into them
+	statsInit(ROLE_SERVER, 0);
+	if (statsStartAdmin(adminPort) != 0)
+	{
+		LOG_WARN("[-]Could not open admin port %d. Metrics disabled.\n", adminPort);
+	}
+	if (root != NULL)
+	{
+		if (storeOpen(&store, root) != 0)
+		{
+			err(1, "[-]Could not open storage directory '%s'", root);
+		}
+		LOG_INFO("[+]Serving files from '%s'\n", root);
+		// files.txt is not used
+		catalogMegabytes = 0;
+	}
+	catalogInit(&catalog, (size_t)catalogMegabytes << 20);
+	if (preload && catalogMegabytes > 0)
+	{
+		preloadCatalog(loadThreads);
+	}
 
 	FILE *fp;
 	char fileName[1024];
@@ -146,98 +497,129 @@ int main(int argc, char *argv[])
 	sockfd = socket(AF_INET, SOCK_STREAM, 0);
 	if (sockfd < 0)
 	{
-		printf("[-]Error in connection.\n");
+		LOG_ERROR("[-]Error in connection.\n");
 		exit(1);
 	}
-	printf("[+]Server Socket is created.\n");
+	LOG_INFO("[+]Server Socket is created.\n");
 
 	memset(&serverAddr, '\0', sizeof(serverAddr));
 	serverAddr.sin_family = AF_INET;
 	serverAddr.sin_port = htons(port);
-	serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	serverAddr.sin_addr = listenAddress;
 
 	ret = bind(sockfd, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
 	if (ret < 0)
 	{
-		printf("[-]Error in binding.\n");
+		LOG_ERROR("[-]Error in binding.\n");
 		exit(1);
 	}
-	printf("[+]Bind to port %d\n", port);
+	LOG_INFO("[+]Bind to %s port %d\n", inet_ntoa(listenAddress), port);
 
-	if (listen(sockfd, 10) == 0)
+	if (listen(sockfd, LISTEN_BACKLOG) == 0)
 	{
-		printf("[+]Listening....\n");
+		LOG_INFO("[+]Listening....\n");
 	}
 	else
 	{
-		printf("[-]Error in binding.\n");
+		LOG_ERROR("[-]Error in binding.\n");
 	}
 
 	while (1)
 	{
-		printf("[+]Accepting new connections..\n");
+		// reap the children of finished connections
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			;
+		LOG_DEBUG("[+]Accepting new connections..\n");
+		addr_size = sizeof(newAddr);
 		newSocket = accept(sockfd, (struct sockaddr *)&newAddr, &addr_size);
 		if (newSocket < 0)
 		{
-			exit(1);
+			LOG_WARN("[-]accept failed: %s\n", strerror(errno));
+			// out of descriptors or memory: give the open connections a moment to finish
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+				usleep(100000);
+			continue;
+		}
+		LOG_INFO("[+]Connection accepted from %s:%d\n", inet_ntoa(newAddr.sin_addr), ntohs(newAddr.sin_port));
+
+		// the connection's process should start from the current files.txt
+		if (preload && catalogMegabytes > 0 && catalogCheck(&catalog, FILES_PATH) == 1)
+		{
+			preloadCatalog(loadThreads);
 		}
-		printf("[+]Connection accepted from %s:%d\n", inet_ntoa(newAddr.sin_addr), ntohs(newAddr.sin_port));
 
-		printf("[+]Securing socket with TLS...\n");
+		LOG_DEBUG("[+]Securing socket with TLS...\n");
 		if(tls_accept_socket(ctx, &cctx, newSocket) != 0)
 		{
-			errx(1, "[-]New socket could not be accepted.\n");
+			LOG_WARN("[-]New socket could not be accepted: %s\n", tls_error(ctx));
+			statsInc(STAT_HANDSHAKE_FAILURES);
+			close(newSocket);
+			continue;
 		}
-		printf("[+]Socket secured with TLS.\n");
-		printf("[+]Connection accepted from %s:%d\n", inet_ntoa(newAddr.sin_addr), ntohs(newAddr.sin_port));
+		LOG_DEBUG("[+]Socket secured with TLS.\n");
+		LOG_DEBUG("[+]Connection accepted from %s:%d\n", inet_ntoa(newAddr.sin_addr), ntohs(newAddr.sin_port));
 
 		if ((childpid = fork()) == 0)
 		{
 			close(sockfd);
 
+			const char *error = NULL;
+			statsInc(STAT_CONNECTIONS);
+			statsGaugeAdd(GAUGE_ACTIVE_CONNECTIONS, 1);
+			// a proxy keeps its connection open for its next multi-get, but not forever
+			if ((ret = netAcceptHandshake(cctx, newSocket, HANDSHAKE_TIMEOUT, IDLE_TIMEOUT, &error)) != 0)
+			{
+				if (ret == NET_TIMED_OUT)
+					statsInc(STAT_HANDSHAKE_TIMEOUTS);
+				LOG_WARN("[-]TLS handshake with %s:%d failed: %s\n", inet_ntoa(newAddr.sin_addr), ntohs(newAddr.sin_port), error);
+				statsInc(STAT_HANDSHAKE_FAILURES);
+				statsGaugeAdd(GAUGE_ACTIVE_CONNECTIONS, -1);
+				close(newSocket);
+				exit(1);
+			}
+
 			while (1)
 			{
 				ssize_t msgLength;
 				//if ((msgLength = recv(newSocket, buffer, sizeof(buffer), 0)) <= 0)
-				if ((msgLength = tls_read(cctx, buffer, sizeof(buffer))) <= 0)
+				if ((msgLength = tls_read(cctx, buffer, sizeof(buffer) - 1)) <= 0)
 				{ // check to see if client closed connection
-					printf("[-]Disconnected from %s:%d\n", inet_ntoa(newAddr.sin_addr), ntohs(newAddr.sin_port));
+					LOG_INFO("[-]Disconnected from %s:%d\n", inet_ntoa(newAddr.sin_addr), ntohs(newAddr.sin_port));
 					break;
 				}
 				else // sending the file back to the proxy.
 				{
 					int fd;
-					char fileContent[1024], c;
+					char fileContent[1024], reply[ORIGIN_REPLY_SIZE], c;
+					uint64_t cachedVersion;
+					unsigned codecs;
+					int replyLength;
 					buffer[msgLength] = '\0'; // make sure that we only look at the message we read in
-					printf("[+]Proxy requests: '%s'\n", buffer);
-					// find the file from filename
-					FILE *db;
-					if ((db = fopen("../../src/server/files.txt", "r")) == NULL)
-					{ // will store the filename: content for all files in files.txt
-						printf("[-]Error! opening file 'files.txt'\n");
-						strncpy(buffer, "File does not exist.", sizeof(buffer));
-						//send(newSocket, buffer, sizeof(buffer), 0);
-						if((tls_write(cctx, buffer, sizeof(buffer))) <= 0)
-						{
-							err(1, "tls_write: %s", tls_error(ctx));
-						};
-						bzero(buffer, sizeof(buffer));
-						bzero(fileName, sizeof(fileName));
-						close(newSocket);
-						break;
+					if (strncmp(buffer, ORIGIN_MULTI_GET " ", strlen(ORIGIN_MULTI_GET " ")) == 0)
+					{
+						if (serveBatch(cctx, buffer, msgLength, ttl) != 0)
+							break;
+						continue;
 					}
-
-					if (getFileContent(db, buffer, fileContent) == -1)
+					protocolParseRequest(buffer, &cachedVersion, &codecs);
+					LOG_INFO("[+]Proxy requests: '%s'\n", buffer);
+					statsInc(STAT_REQUESTS);
+					// find the file from filename
+					char *name = buffer;
+					int found;
+					findFiles(&name, 1, &fileContent, &found);
+					if (!found)
 					{ // if file does not exist in files.txt
 
-						printf("[-]'%s' does not exist\n", buffer);
-						strncpy(buffer, "File does not exist.", sizeof(buffer));
+						LOG_INFO("[-]'%s' does not exist\n", buffer);
+						statsInc(STAT_OBJECTS_MISSING);
+						strncpy(buffer, ORIGIN_NOT_FOUND_REPLY, sizeof(buffer));
 						// send(newSocket, buffer, sizeof(buffer), 0);
-						if((tls_write(cctx, buffer, sizeof(buffer))) <= 0)
+						if((tls_write(cctx, buffer, strlen(buffer) + 1)) <= 0)
 						{
 							err(1, "tls_write: %s", tls_error(ctx));
 						};
-						printf("[-]Disconnected from proxy\n\n");
+						LOG_INFO("[-]Disconnected from proxy\n\n");
 						bzero(buffer, sizeof(buffer));
 						bzero(fileName, sizeof(fileName));
 						close(newSocket);
@@ -245,13 +627,13 @@ int main(int argc, char *argv[])
 					}
 					else
 					{
-						printf("Sending file: filecontent to proxy: '%s'\n",fileContent);
+						replyLength = formatReply(fileContent, cachedVersion, codecs, ttl, reply);
 						//send(newSocket, fileContent, sizeof(fileContent), 0);
-						if((tls_write(cctx, fileContent, sizeof(fileContent))) <= 0)
+						if((tls_write(cctx, reply, replyLength)) <= 0)
 						{
 							err(1, "tls_write: %s", tls_error(ctx));
 						};
-						printf("[+]Finished sending file to Proxy\n\n");
+						LOG_INFO("[+]Finished sending file to Proxy\n\n");
 						bzero(buffer, sizeof(buffer));
 						bzero(fileName, sizeof(fileName));
 						close(newSocket);
@@ -260,7 +642,16 @@ int main(int argc, char *argv[])
 					
 				}
 			}
+			statsGaugeAdd(GAUGE_ACTIVE_CONNECTIONS, -1);
+			exit(0);
+		}
+		else if (childpid < 0)
+		{
+			LOG_WARN("[-]fork failed: %s\n", strerror(errno));
 		}
+		// the child has its own copy of the connection
+		tls_free(cctx);
+		close(newSocket);
 	}
 	close(newSocket);
 
@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "log.h"
+#include "protocol.h"
+#include "stats.h"
+#include "storage.h"
+
+/**
+ * Opens root as the directory objects are served from
+ * Returns 0 on success, -1 if it is not a directory that can be opened
+ * */
+int storeOpen(struct Store *store, const char *root)
+{
+	memset(store, 0, sizeof(*store));
+	for (int i = 0; i < STORE_FD_CACHE; i++)
+		store->files[i].fd = -1;
+	if ((store->root = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Names are paths below the root: not absolute, and without ".." components
+ * */
+static int validName(const char *name)
+{
+	const char *component = name;
+
+	if (name[0] == '\0' || name[0] == '/')
+		return 0;
+	while (component != NULL)
+	{
+		if (strncmp(component, "..", 2) == 0 && (component[2] == '/' || component[2] == '\0'))
+			return 0;
+		if ((component = strchr(component, '/')) != NULL)
+			component++;
+	}
+	return 1;
+}
+
+/**
+ * Opens name below the root one component at a time, so that no symbolic link on the way,
+ * which could lead out of the root, is followed. O_NOFOLLOW alone only covers the last one.
+ * Returns the descriptor, -1 on failure
+ * */
+static int openBeneath(int root, const char *name)
+{
+	char path[1024], *component, *next;
+	int dir = root, fd;
+
+	if (snprintf(path, sizeof(path), "%s", name) >= (int)sizeof(path))
+	{
+		return -1;
+	}
+	for (component = path; (next = strchr(component, '/')) != NULL; component = next + 1)
+	{
+		*next = '\0';
+		if (*component == '\0')
+			continue;
+		fd = openat(dir, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (dir != root)
+			close(dir);
+		if (fd < 0)
+			return -1;
+		dir = fd;
+	}
+	fd = openat(dir, component, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (dir != root)
+		close(dir);
+	return fd;
+}
+
+static void closeFile(struct StoreFile *file)
+{
+	if (file->name == NULL)
+		return;
+	close(file->fd);
+	free(file->name);
+	file->name = NULL;
+	file->fd = -1;
+}
+
+/**
+ * Returns an open descriptor for name, from the open files if it was opened within STORE_FD_TTL,
+ * -1 if it cannot be opened
+ * */
+static int openFile(struct Store *store, const char *name)
+{
+	uint64_t hash = hashString(name);
+	time_t now = time(NULL);
+	struct StoreFile *file = NULL;
+	int fd;
+
+	store->lookups++;
+	for (int i = 0; i < STORE_FD_CACHE; i++)
+	{
+		struct StoreFile *candidate = &store->files[i];
+		if (candidate->name != NULL && candidate->hash == hash && strcmp(candidate->name, name) == 0)
+		{
+			if (now - candidate->opened < STORE_FD_TTL)
+			{
+				statsInc(STAT_STORE_FD_HITS);
+				candidate->used = store->lookups;
+				return candidate->fd;
+			}
+			closeFile(candidate);
+			file = candidate;
+			break;
+		}
+	}
+	statsInc(STAT_STORE_FD_MISSES);
+	if ((fd = openBeneath(store->root, name)) < 0)
+	{
+		return -1;
+	}
+	// the least recently used file makes room
+	for (int i = 0; file == NULL && i < STORE_FD_CACHE; i++)
+	{
+		if (store->files[i].name == NULL)
+			file = &store->files[i];
+	}
+	if (file == NULL)
+	{
+		file = &store->files[0];
+		for (int i = 1; i < STORE_FD_CACHE; i++)
+		{
+			if (store->files[i].used < file->used)
+				file = &store->files[i];
+		}
+		closeFile(file);
+	}
+	if ((file->name = strdup(name)) == NULL)
+	{
+		// served, just not kept open
+		return fd;
+	}
+	file->hash = hash;
+	file->fd = fd;
+	file->opened = now;
+	file->used = store->lookups;
+	return fd;
+}
+
+/**
+ * Closes fd unless it is one of the open files
+ * */
+static void releaseFile(struct Store *store, int fd)
+{
+	for (int i = 0; i < STORE_FD_CACHE; i++)
+	{
+		if (store->files[i].name != NULL && store->files[i].fd == fd)
+			return;
+	}
+	close(fd);
+}
+
+static ssize_t readFull(int fd, char *buffer, size_t length, off_t offset)
+{
+	size_t done = 0;
+	ssize_t n = 0;
+
+	while (done < length)
+	{
+		if ((n = pread(fd, buffer + done, length - done, offset + done)) < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	return n < 0 && done == 0 ? -1 : (ssize_t)done;
+}
+
+#ifdef HAVE_LIBURING
+/**
+ * Reads sizes[i] bytes of fds[i] into buffers[i] for each of the count files with an fd,
+ * with one submission, and finishes short reads with pread().
+ * Sets lengths[i] to the bytes read, -1 if the read failed.
+ * Returns 0 on success, -1 if the ring cannot be used
+ * */
+static int readAll(struct Store *store, const int *fds, char **buffers, const size_t *sizes, ssize_t *lengths, int count)
+{
+	struct io_uring_cqe *cqe;
+	int submitted = 0, queued[count];
+
+	// a ring cannot be shared with the processes forked after it was set up
+	if (store->ringOwner != getpid())
+	{
+		store->ringOwner = 0;
+		if (io_uring_queue_init(ORIGIN_BATCH_MAX, &store->ring, 0) != 0)
+			return -1;
+		store->ringOwner = getpid();
+	}
+	for (int i = 0; i < count; i++)
+	{
+		struct io_uring_sqe *sqe;
+		if ((queued[i] = fds[i] >= 0 && (sqe = io_uring_get_sqe(&store->ring)) != NULL))
+		{
+			io_uring_prep_read(sqe, fds[i], buffers[i], sizes[i], 0);
+			io_uring_sqe_set_data(sqe, (void *)(intptr_t)i);
+			submitted++;
+		}
+	}
+	if (submitted > 0 && io_uring_submit(&store->ring) < 0)
+	{
+		io_uring_queue_exit(&store->ring);
+		store->ringOwner = 0;
+		return -1;
+	}
+	for (int done = 0; done < submitted; done++)
+	{
+		int i, ret;
+		while ((ret = io_uring_wait_cqe(&store->ring, &cqe)) == -EINTR)
+			;
+		if (ret != 0)
+		{
+			// the reads still in flight must not land in buffers the caller reuses
+			io_uring_queue_exit(&store->ring);
+			store->ringOwner = 0;
+			return -1;
+		}
+		i = (int)(intptr_t)io_uring_cqe_get_data(cqe);
+		lengths[i] = cqe->res;
+		io_uring_cqe_seen(&store->ring, cqe);
+		if (lengths[i] >= 0 && (size_t)lengths[i] < sizes[i])
+		{
+			ssize_t rest = readFull(fds[i], buffers[i] + lengths[i], sizes[i] - lengths[i], lengths[i]);
+			lengths[i] += rest > 0 ? rest : 0;
+		}
+	}
+	// files the ring had no room for
+	for (int i = 0; i < count; i++)
+	{
+		if (fds[i] >= 0 && !queued[i])
+			lengths[i] = readFull(fds[i], buffers[i], sizes[i], 0);
+	}
+	return 0;
+}
+#endif
+
+/**
+ * Reads each of the count named files under the root into contents[i] as "<name>: <content>",
+ * the form of a files.txt line. found[i] is set to 1 if names[i] was read. A file that does not
+ * fit in contents[i] is not served. Contents are text: they end at their first NUL.
+ * */
+void storeFind(struct Store *store, char **names, int count, char (*contents)[1024], int *found)
+{
+	int fds[count];
+	char *buffers[count];
+	size_t sizes[count];
+	ssize_t lengths[count];
+
+	for (int i = 0; i < count; i++)
+	{
+		struct stat st;
+		int prefix;
+
+		found[i] = 0;
+		lengths[i] = -1;
+		if (!validName(names[i]) || (fds[i] = openFile(store, names[i])) < 0)
+		{
+			LOG_DEBUG("[-]'%s' is not in the storage directory\n", names[i]);
+			fds[i] = -1;
+			continue;
+		}
+		prefix = snprintf(contents[i], sizeof(contents[i]), "%s: ", names[i]);
+		if (fstat(fds[i], &st) != 0 || !S_ISREG(st.st_mode))
+		{
+			releaseFile(store, fds[i]);
+			fds[i] = -1;
+			continue;
+		}
+		if (prefix >= (int)sizeof(contents[i]) || st.st_size >= (off_t)sizeof(contents[i]) - prefix)
+		{
+			LOG_WARN("[!]'%s' is too large to serve, %jd bytes\n", names[i], (intmax_t)st.st_size);
+			statsInc(STAT_STORE_TOO_LARGE);
+			releaseFile(store, fds[i]);
+			fds[i] = -1;
+			continue;
+		}
+		buffers[i] = contents[i] + prefix;
+		sizes[i] = st.st_size;
+	}
+
+#ifdef HAVE_LIBURING
+	if (readAll(store, fds, buffers, sizes, lengths, count) != 0)
+#endif
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (fds[i] >= 0)
+				lengths[i] = readFull(fds[i], buffers[i], sizes[i], 0);
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		if (fds[i] < 0)
+			continue;
+		if ((found[i] = lengths[i] >= 0))
+			buffers[i][lengths[i]] = '\0';
+		releaseFile(store, fds[i]);
+	}
+}
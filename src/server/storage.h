@@ -0,0 +1,46 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#define STORE_FD_CACHE 64 // open files kept per connection, at least ORIGIN_BATCH_MAX
+#define STORE_FD_TTL 1	  // seconds an open file is used before it is opened again, in case it was replaced
+
+/**
+ * Objects stored as files under a root directory, served instead of files.txt lines.
+ * A file's object is "<fileName>: <content>", just like a files.txt line, so it has to fit
+ * in one reply, and its name is its path relative to the root.
+ * Recently used files are kept open. The files of a multi-get are read with one io_uring
+ * submission when the server is built with liburing, and with pread() otherwise.
+ * Every connection's process has its own open files and ring. Not thread safe.
+ * */
+struct StoreFile
+{
+	char *name; // NULL for an empty slot
+	uint64_t hash;
+	int fd;
+	time_t opened;
+	uint64_t used; // when it was last used, in lookups
+};
+
+struct Store
+{
+	int root; // directory descriptor, -1 when objects come from files.txt
+	struct StoreFile files[STORE_FD_CACHE];
+	uint64_t lookups;
+#ifdef HAVE_LIBURING
+	struct io_uring ring;
+	pid_t ringOwner; // the process that set up ring, 0 for none
+#endif
+};
+
+int storeOpen(struct Store *store, const char *root);
+void storeFind(struct Store *store, char **names, int count, char (*contents)[1024], int *found);
+
+#endif
@@ -0,0 +1,410 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define MAX_PROXIES 8
+#define MAX_CAPACITIES 32
+#define MIN_CAPACITY 16
+#define MAX_CAPACITY 16384
+
+enum Policy
+{
+	POLICY_LRU, // what the proxy's cache does
+	POLICY_FIFO,
+	POLICY_CLOCK,
+	POLICY_RANDOM,
+	NUM_POLICIES
+};
+
+static const char *policyNames[NUM_POLICIES] = {"lru", "fifo", "clock", "random"};
+
+// the proxies' names, as whichProxy() hashes them; the first five are the real ones
+static const char *proxyNames[MAX_PROXIES] = {"ProxyOne", "ProxyTwo", "ProxyThree", "ProxyFour", "ProxyFive",
+											  "ProxySix", "ProxySeven", "ProxyEight"};
+
+#define NONE UINT32_MAX
+
+/**
+ * One proxy's cache of capacity objects, keyed by name hash.
+ * Slots are indexed by a linear probing table, and kept in a list for LRU and FIFO.
+ * */
+struct SimCache
+{
+	enum Policy policy;
+	uint32_t capacity;
+	uint32_t used;
+	uint64_t *keys;
+	uint32_t *prev, *next; // most recently inserted or used first
+	uint32_t head, tail;
+	uint8_t *referenced; // CLOCK
+	uint32_t hand;
+	uint32_t *table; // slot numbers, NONE for empty
+	uint32_t tableMask;
+	uint64_t random;
+};
+
+static void usage()
+{
+	extern char *__progname;
+	fprintf(stderr, "usage: %s [-c capacity,...] [-n proxies,...] [-P lru|fifo|clock|random,...] trace...\n", __progname);
+	exit(1);
+}
+
+/**
+ * Parses a comma separated list of at most max numbers in [low, high]
+ * Returns how many there are, -1 if the list is not valid
+ * */
+static int parseList(const char *list, int *values, int max, int low, int high)
+{
+	int count = 0;
+	char *end;
+
+	while (*list != '\0')
+	{
+		long value = strtol(list, &end, 10);
+		if (end == list || (*end != ',' && *end != '\0') || value < low || value > high || count == max)
+			return -1;
+		values[count++] = value;
+		list = *end == ',' ? end + 1 : end;
+	}
+	return count;
+}
+
+static void simInit(struct SimCache *cache, enum Policy policy, uint32_t capacity)
+{
+	uint32_t tableSize = 1;
+
+	while (tableSize < capacity * 2)
+		tableSize *= 2;
+	*cache = (struct SimCache){.policy = policy, .capacity = capacity, .head = NONE, .tail = NONE,
+							   .tableMask = tableSize - 1, .random = 88172645463325252ULL};
+	cache->keys = malloc(capacity * sizeof(uint64_t));
+	cache->prev = malloc(capacity * sizeof(uint32_t));
+	cache->next = malloc(capacity * sizeof(uint32_t));
+	cache->referenced = calloc(capacity, 1);
+	cache->table = malloc(tableSize * sizeof(uint32_t));
+	if (cache->keys == NULL || cache->prev == NULL || cache->next == NULL || cache->referenced == NULL || cache->table == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	memset(cache->table, 0xff, tableSize * sizeof(uint32_t));
+}
+
+static void simFree(struct SimCache *cache)
+{
+	free(cache->keys);
+	free(cache->prev);
+	free(cache->next);
+	free(cache->referenced);
+	free(cache->table);
+}
+
+// the keys are already hashes, but FNV-1a barely mixes its low bits
+static uint32_t bucketOf(const struct SimCache *cache, uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key & cache->tableMask;
+}
+
+/**
+ * Returns the index in table of key, or of the empty bucket it would go in
+ * */
+static uint32_t findBucket(const struct SimCache *cache, uint64_t key)
+{
+	uint32_t i = bucketOf(cache, key);
+	while (cache->table[i] != NONE && cache->keys[cache->table[i]] != key)
+		i = (i + 1) & cache->tableMask;
+	return i;
+}
+
+// backward shift deletion, so lookups never need tombstones
+static void removeBucket(struct SimCache *cache, uint32_t i)
+{
+	uint32_t j = i;
+
+	cache->table[i] = NONE;
+	while (1)
+	{
+		j = (j + 1) & cache->tableMask;
+		if (cache->table[j] == NONE)
+			return;
+		uint32_t home = bucketOf(cache, cache->keys[cache->table[j]]);
+		// move the entry back unless its home lies cyclically in (i, j]
+		if (i <= j ? (home <= i || home > j) : (home <= i && home > j))
+		{
+			cache->table[i] = cache->table[j];
+			cache->table[j] = NONE;
+			i = j;
+		}
+	}
+}
+
+static void listRemove(struct SimCache *cache, uint32_t slot)
+{
+	if (cache->prev[slot] != NONE)
+		cache->next[cache->prev[slot]] = cache->next[slot];
+	else
+		cache->head = cache->next[slot];
+	if (cache->next[slot] != NONE)
+		cache->prev[cache->next[slot]] = cache->prev[slot];
+	else
+		cache->tail = cache->prev[slot];
+}
+
+static void listPushFront(struct SimCache *cache, uint32_t slot)
+{
+	cache->prev[slot] = NONE;
+	cache->next[slot] = cache->head;
+	if (cache->head != NONE)
+		cache->prev[cache->head] = slot;
+	else
+		cache->tail = slot;
+	cache->head = slot;
+}
+
+static uint32_t pickVictim(struct SimCache *cache)
+{
+	uint32_t victim;
+
+	switch (cache->policy)
+	{
+	case POLICY_CLOCK:
+		while (cache->referenced[cache->hand])
+		{
+			cache->referenced[cache->hand] = 0;
+			cache->hand = (cache->hand + 1) % cache->capacity;
+		}
+		victim = cache->hand;
+		cache->hand = (cache->hand + 1) % cache->capacity;
+		return victim;
+	case POLICY_RANDOM:
+		// xorshift64, the same sequence on every run
+		cache->random ^= cache->random << 13;
+		cache->random ^= cache->random >> 7;
+		cache->random ^= cache->random << 17;
+		return cache->random % cache->capacity;
+	default:
+		return cache->tail;
+	}
+}
+
+/**
+ * Looks key up, and inserts it on a miss
+ * Returns 1 on a hit, 0 on a miss
+ * */
+static int simAccess(struct SimCache *cache, uint64_t key)
+{
+	uint32_t bucket = findBucket(cache, key), slot;
+
+	if ((slot = cache->table[bucket]) != NONE)
+	{
+		if (cache->policy == POLICY_LRU)
+		{
+			listRemove(cache, slot);
+			listPushFront(cache, slot);
+		}
+		cache->referenced[slot] = 1;
+		return 1;
+	}
+	if (cache->used < cache->capacity)
+		slot = cache->used++;
+	else
+	{
+		slot = pickVictim(cache);
+		removeBucket(cache, findBucket(cache, cache->keys[slot]));
+		listRemove(cache, slot);
+		// the victim's bucket may have been where key belongs
+		bucket = findBucket(cache, key);
+	}
+	cache->keys[slot] = key;
+	cache->referenced[slot] = 0;
+	cache->table[bucket] = slot;
+	listPushFront(cache, slot);
+	return 0;
+}
+
+static int nameSum(const char *name)
+{
+	int sum = 0;
+	while (*name != '\0')
+		sum += *name++;
+	return sum;
+}
+
+/**
+ * whichProxy() among the first numProxies proxies
+ * */
+static int ownerOf(uint32_t sum, int numProxies)
+{
+	int best = 0, bestScore = 0;
+
+	for (int i = 0; i < numProxies; i++)
+	{
+		int score = (int)(sum + nameSum(proxyNames[i])) % 17;
+		if (i == 0 || score > bestScore)
+		{
+			best = i;
+			bestScore = score;
+		}
+	}
+	return best;
+}
+
+// requests the proxies' caches were asked about; the others never reach a cache
+static int consultsCache(int outcome)
+{
+	return outcome == TRACE_HIT || outcome == TRACE_REVALIDATED || outcome == TRACE_MISS || outcome == TRACE_ERROR;
+}
+
+static int byTime(const void *a, const void *b)
+{
+	const struct TraceRecord *x = a, *y = b;
+	return (x->timestamp > y->timestamp) - (x->timestamp < y->timestamp);
+}
+
+/**
+ * Appends the cache requests in the trace at path to *records
+ * Returns 0 on success, -1 if it is not a trace
+ * */
+static int readTrace(const char *path, struct TraceRecord **records, size_t *numRecords, size_t *capacity, uint64_t *traceHits)
+{
+	struct TraceHeader header;
+	struct TraceRecord record;
+	FILE *fp = fopen(path, "rb");
+
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, "TLSTRACE", 8) != 0 || header.version != TRACE_VERSION)
+	{
+		fclose(fp);
+		return -1;
+	}
+	while (fread(&record, sizeof(record), 1, fp) == 1)
+	{
+		if (!consultsCache(record.outcome))
+			continue;
+		if (*numRecords == *capacity)
+		{
+			*capacity = *capacity == 0 ? 4096 : *capacity * 2;
+			if ((*records = realloc(*records, *capacity * sizeof(struct TraceRecord))) == NULL)
+			{
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+		}
+		(*records)[(*numRecords)++] = record;
+		*traceHits += record.outcome == TRACE_HIT || record.outcome == TRACE_REVALIDATED;
+	}
+	fclose(fp);
+	return 0;
+}
+
+/**
+ * Replays proxy traces against caches of other sizes, eviction policies and numbers of proxies,
+ * and prints the hit ratio of each combination, one per line, for plotting hit ratio curves.
+ * Traces of several proxies are merged in time order. Only requests that reached a cache
+ * are replayed, each by the proxy whichProxy() gives it to. Objects never expire here.
+ * */
+int main(int argc, char *argv[])
+{
+	int capacities[MAX_CAPACITIES], proxyCounts[MAX_PROXIES] = {5}, policies[NUM_POLICIES];
+	int numCapacities = 0, numProxyCounts = 1, numPolicies = NUM_POLICIES, ch;
+	struct TraceRecord *records = NULL;
+	size_t numRecords = 0, capacity = 0;
+	uint64_t traceHits = 0, totalBytes = 0;
+
+	for (int c = MIN_CAPACITY; c <= MAX_CAPACITY; c *= 2)
+		capacities[numCapacities++] = c;
+	for (int i = 0; i < NUM_POLICIES; i++)
+		policies[i] = i;
+
+	while ((ch = getopt(argc, argv, "c:n:P:")) != -1)
+	{
+		switch (ch)
+		{
+		case 'c':
+			if ((numCapacities = parseList(optarg, capacities, MAX_CAPACITIES, 1, 1 << 24)) <= 0)
+				usage();
+			break;
+		case 'n':
+			if ((numProxyCounts = parseList(optarg, proxyCounts, MAX_PROXIES, 1, MAX_PROXIES)) <= 0)
+				usage();
+			break;
+		case 'P':
+			numPolicies = 0;
+			for (char *name = strtok(optarg, ","); name != NULL; name = strtok(NULL, ","))
+			{
+				int policy = 0;
+				while (policy < NUM_POLICIES && strcmp(name, policyNames[policy]) != 0)
+					policy++;
+				if (policy == NUM_POLICIES || numPolicies == NUM_POLICIES)
+					usage();
+				policies[numPolicies++] = policy;
+			}
+			if (numPolicies == 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind == argc)
+		usage();
+
+	for (int i = optind; i < argc; i++)
+	{
+		if (readTrace(argv[i], &records, &numRecords, &capacity, &traceHits) != 0)
+		{
+			fprintf(stderr, "%s: not a trace, or written by another version\n", argv[i]);
+			return 1;
+		}
+	}
+	if (numRecords == 0)
+	{
+		fprintf(stderr, "No cache requests in the traces\n");
+		return 1;
+	}
+	qsort(records, numRecords, sizeof(struct TraceRecord), byTime);
+	for (size_t i = 0; i < numRecords; i++)
+		totalBytes += records[i].size;
+	fprintf(stderr, "%zu cache requests, hit ratio %.4f as traced\n", numRecords, (double)traceHits / numRecords);
+
+	printf("policy proxies capacity requests hit_ratio byte_hit_ratio\n");
+	for (int p = 0; p < numPolicies; p++)
+	{
+		for (int n = 0; n < numProxyCounts; n++)
+		{
+			for (int c = 0; c < numCapacities; c++)
+			{
+				struct SimCache caches[MAX_PROXIES];
+				uint64_t hits = 0, hitBytes = 0;
+
+				for (int i = 0; i < proxyCounts[n]; i++)
+					simInit(&caches[i], policies[p], capacities[c]);
+				for (size_t i = 0; i < numRecords; i++)
+				{
+					if (simAccess(&caches[ownerOf(records[i].nameSum, proxyCounts[n])], records[i].key))
+					{
+						hits++;
+						hitBytes += records[i].size;
+					}
+				}
+				for (int i = 0; i < proxyCounts[n]; i++)
+					simFree(&caches[i]);
+				printf("%s %d %d %zu %.4f %.4f\n", policyNames[policies[p]], proxyCounts[n], capacities[c], numRecords,
+					   (double)hits / numRecords, totalBytes > 0 ? (double)hitBytes / totalBytes : 0.0);
+			}
+		}
+	}
+	free(records);
+	return 0;
+}
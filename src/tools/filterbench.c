@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "filter.h"
+
+#define NUM_KEYS 10000
+#define NUM_PROBES 1000000
+#define NUM_ROUNDS 5
+
+static void usage()
+{
+	extern char *__progname;
+	fprintf(stderr, "usage: %s [-n keys] [-p probes]\n", __progname);
+	exit(1);
+}
+
+static double nowNsec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Names shaped like the blacklist's: directories, numbers and extensions
+ * */
+static char **makeNames(const char *kind, int count)
+{
+	static const char *extensions[] = {"txt", "html", "png", "exe", "pdf"};
+	char **names = malloc(count * sizeof(char *));
+	char name[64];
+
+	for (int i = 0; i < count; i++)
+	{
+		snprintf(name, sizeof(name), "%s%d/file%d.%s", kind, i % 97, i, extensions[i % 5]);
+		names[i] = strdup(name);
+	}
+	return names;
+}
+
+/**
+ * Compares the membership filters the proxy can put in front of its blacklist:
+ * memory per key, false positive rate on names that were never added, and lookup time.
+ * */
+int main(int argc, char *argv[])
+{
+	int numKeys = NUM_KEYS, numProbes = NUM_PROBES, ch;
+
+	while ((ch = getopt(argc, argv, "n:p:")) != -1)
+	{
+		switch (ch)
+		{
+		case 'n':
+			if ((numKeys = atoi(optarg)) <= 0)
+				usage();
+			break;
+		case 'p':
+			if ((numProbes = atoi(optarg)) <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+
+	char **keys = makeNames("blocked", numKeys);
+	char **probes = makeNames("allowed", numProbes);
+
+	printf("%d keys, %d probes\n", numKeys, numProbes);
+	printf("%-8s %12s %12s %12s %12s %12s\n", "filter", "bytes", "bytes/key", "fp rate", "ns/lookup", "build ms");
+	for (int kind = FILTER_BLOOM; kind <= FILTER_XOR; kind++)
+	{
+		struct Arena arena = {0};
+		struct Filter filter;
+		double start = nowNsec();
+
+		if (filterBuild(&filter, kind, keys, numKeys, &arena) != 0)
+		{
+			printf("%-8s could not be built\n", filterKindName(kind));
+			arenaFree(&arena);
+			continue;
+		}
+		double buildNsec = nowNsec() - start;
+
+		for (int i = 0; i < numKeys; i++)
+		{
+			if (!filterContains(&filter, keys[i]))
+			{
+				printf("[-]%s misses '%s'\n", filterKindName(kind), keys[i]);
+				return 1;
+			}
+		}
+
+		// best of a few rounds, the first one also warms the caches
+		long positives = 0;
+		double best = 0;
+		for (int round = 0; round < NUM_ROUNDS; round++)
+		{
+			positives = 0;
+			start = nowNsec();
+			for (int i = 0; i < numProbes; i++)
+				positives += filterContains(&filter, probes[i]);
+			double elapsed = nowNsec() - start;
+			if (round == 0 || elapsed < best)
+				best = elapsed;
+		}
+
+		size_t bytes = filterBytes(&filter);
+		printf("%-8s %12zu %12.2f %11.4f%% %12.1f %12.2f\n", filterKindName(kind), bytes, (double)bytes / numKeys,
+			   100.0 * positives / numProbes, best / numProbes, buildNsec / 1e6);
+		arenaFree(&arena);
+	}
+	return 0;
+}